@@ -0,0 +1,57 @@
+#ifndef ALIGNEDALLOCATOR_H
+#define ALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * a minimal allocator that hands out memory aligned to a given boundary, so
+ * contiguous numeric buffers start on a cache line and can be streamed by
+ * vectorized loops.
+ * @tparam T element type
+ * @tparam Alignment alignment in bytes (power of two)
+ */
+template <typename T, std::size_t Alignment = CACHE_LINE_SIZE>
+class AlignedAllocator
+{
+ public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind
+  {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator () noexcept = default;
+
+  template <typename U>
+  AlignedAllocator (const AlignedAllocator<U, Alignment>&) noexcept {}
+
+  T *allocate (std::size_t n)
+  {
+    return static_cast<T *>(::operator new (n * sizeof (T),
+                                            std::align_val_t (Alignment)));
+  }
+
+  void deallocate (T *ptr, std::size_t) noexcept
+  {
+    ::operator delete (ptr, std::align_val_t (Alignment));
+  }
+
+  template <typename U>
+  bool operator== (const AlignedAllocator<U, Alignment>&) const noexcept
+  {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!= (const AlignedAllocator<U, Alignment>&) const noexcept
+  {
+    return false;
+  }
+};
+
+#endif //ALIGNEDALLOCATOR_H
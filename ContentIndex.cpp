@@ -0,0 +1,229 @@
+#include "ContentIndex.h"
+#include "ParallelFor.h"
+#include "SimilarityKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#define TRAIN_ITERATIONS 8 // rounds of k-means
+#define TRAIN_ROWS_PER_LIST 64 // rows sampled per list to train on
+#define RETRAIN_GROWTH 2 // retrain once the catalog grows this many times
+
+ContentIndex::ContentIndex (std::size_t num_lists, std::size_t num_probes)
+    : _num_lists (std::max<std::size_t> (num_lists, 1)),
+      _num_probes (num_probes), _num_movies (0), _num_features (0),
+      _trained_movies (0)
+{
+}
+
+/**
+ * @param catalog const MovieCatalog&
+ * @param id movie_id
+ * @param scores buffer of one score per list
+ * @return the list whose centroid is the most similar to row <id>
+ */
+std::uint32_t ContentIndex::nearest_list (const MovieCatalog& catalog,
+                                          movie_id id, double *scores) const
+{
+  SimilarityKernels::score_block (catalog.get_features (id),
+                                  catalog.get_norm (id), _centroids.data (),
+                                  _centroid_norms.data (), _lists.size (),
+                                  catalog.get_num_features (), scores);
+  std::uint32_t best = 0;
+  for (std::uint32_t list = 1; list < _lists.size (); list++)
+  {
+    if (scores[list] > scores[best] || std::isnan (scores[best]))
+    {
+      best = list;
+    }
+  }
+  return best;
+}
+
+/**
+ * spherical k-means over an evenly strided sample of the rows: every
+ * round assigns the sample to its nearest centroid and moves each centroid
+ * to the normalized sum of its members' unit rows. a list left empty keeps
+ * its centroid. the centroids start at evenly strided rows, so the index
+ * is the same on every run.
+ */
+void ContentIndex::train (const MovieCatalog& catalog, unsigned n_threads)
+{
+  std::size_t num_movies = catalog.get_num_movies ();
+  std::size_t num_features = catalog.get_num_features ();
+  std::size_t num_lists = std::min (_num_lists, num_movies);
+  std::size_t num_samples = std::min (num_movies,
+                                      num_lists * TRAIN_ROWS_PER_LIST);
+  std::vector<movie_id> samples (num_samples);
+  for (std::size_t s = 0; s < num_samples; s++)
+  {
+    samples[s] = static_cast<movie_id>(s * num_movies / num_samples);
+  }
+  _lists.assign (num_lists, std::vector<movie_id> ());
+  _centroids.assign (num_lists * num_features, 0.0);
+  _centroid_norms.assign (num_lists, 1.0);
+  for (std::size_t list = 0; list < num_lists; list++)
+  {
+    auto id = static_cast<movie_id>(list * num_movies / num_lists);
+    const double *row = catalog.get_features (id);
+    double norm = catalog.get_norm (id);
+    for (std::size_t i = 0; i < num_features; i++)
+    {
+      _centroids[list * num_features + i] = norm > 0.0 ? row[i] / norm : 0.0;
+    }
+    _centroid_norms[list] = norm > 0.0 ? 1.0 : 0.0;
+  }
+  std::vector<std::uint32_t> assigned (num_samples);
+  std::vector<double> sums;
+  for (int round = 0; round < TRAIN_ITERATIONS; round++)
+  {
+    parallel_for (0, num_samples, n_threads,
+                  [&] (std::size_t first, std::size_t last)
+                  {
+                    std::vector<double> scores (num_lists);
+                    for (std::size_t s = first; s < last; s++)
+                    {
+                      assigned[s] = nearest_list (catalog, samples[s],
+                                                  scores.data ());
+                    }
+                  });
+    sums.assign (num_lists * num_features, 0.0);
+    std::vector<std::size_t> sizes (num_lists, 0);
+    for (std::size_t s = 0; s < num_samples; s++)
+    {
+      const double *row = catalog.get_features (samples[s]);
+      double norm = catalog.get_norm (samples[s]);
+      if (norm > 0.0)
+      {
+        double *sum = sums.data () + assigned[s] * num_features;
+        for (std::size_t i = 0; i < num_features; i++)
+        {
+          sum[i] += row[i] / norm;
+        }
+        sizes[assigned[s]]++;
+      }
+    }
+    for (std::size_t list = 0; list < num_lists; list++)
+    {
+      const double *sum = sums.data () + list * num_features;
+      double norm = SimilarityKernels::calc_norm (sum, num_features);
+      if (sizes[list] == 0 || !(norm > 0.0))
+      {
+        continue;
+      }
+      for (std::size_t i = 0; i < num_features; i++)
+      {
+        _centroids[list * num_features + i] = sum[i] / norm;
+      }
+      _centroid_norms[list] = 1.0;
+    }
+  }
+  _num_features = num_features;
+  _num_movies = 0; // every movie is assigned again
+  _trained_movies = num_movies;
+}
+
+/**
+ * assigns the new movies in parallel, then appends them to their lists in
+ * id order, so every list stays sorted.
+ */
+void ContentIndex::update (const MovieCatalog& catalog, unsigned n_threads)
+{
+  std::size_t num_movies = catalog.get_num_movies ();
+  if (num_movies == 0 || num_movies == _num_movies)
+  {
+    return;
+  }
+  if (_trained_movies == 0 || num_movies >= RETRAIN_GROWTH * _trained_movies)
+  {
+    train (catalog, n_threads);
+  }
+  std::size_t old_movies = _num_movies;
+  _list_of.resize (num_movies);
+  parallel_for (old_movies, num_movies,
+                threads_for_work (n_threads, (num_movies - old_movies)
+                                             * _lists.size ()),
+                [&] (std::size_t first, std::size_t last)
+                {
+                  std::vector<double> scores (_lists.size ());
+                  for (std::size_t id = first; id < last; id++)
+                  {
+                    _list_of[id] = nearest_list
+                        (catalog, static_cast<movie_id>(id), scores.data ());
+                  }
+                });
+  for (std::size_t id = old_movies; id < num_movies; id++)
+  {
+    _lists[_list_of[id]].push_back (static_cast<movie_id>(id));
+  }
+  _num_movies = num_movies;
+}
+
+void ContentIndex::reassign (const MovieCatalog& catalog, movie_id id)
+{
+  if (id >= _num_movies)
+  {
+    return;
+  }
+  std::vector<double> scores (_lists.size ());
+  std::uint32_t list = nearest_list (catalog, id, scores.data ());
+  if (list == _list_of[id])
+  {
+    return;
+  }
+  std::vector<movie_id>& old_list = _lists[_list_of[id]];
+  old_list.erase (std::lower_bound (old_list.begin (), old_list.end (), id));
+  std::vector<movie_id>& new_list = _lists[list];
+  new_list.insert (std::lower_bound (new_list.begin (), new_list.end (), id),
+                   id);
+  _list_of[id] = list;
+}
+
+void ContentIndex::probe (const double *query, double query_norm,
+                          std::vector<double>& scores,
+                          std::vector<std::uint32_t>& lists) const
+{
+  std::size_t num_lists = _lists.size ();
+  scores.resize (num_lists);
+  SimilarityKernels::score_block (query, query_norm, _centroids.data (),
+                                  _centroid_norms.data (), num_lists,
+                                  _num_features, scores.data ());
+  lists.resize (num_lists);
+  std::iota (lists.begin (), lists.end (), 0);
+  std::size_t num_probes = std::min (_num_probes, num_lists);
+  // NaN scores (a degenerate query or centroid) rank last:
+  auto more_similar = [&scores] (std::uint32_t l1, std::uint32_t l2)
+  {
+    double s1 = std::isnan (scores[l1]) ? -INFINITY : scores[l1];
+    double s2 = std::isnan (scores[l2]) ? -INFINITY : scores[l2];
+    return s1 > s2 || (s1 == s2 && l1 < l2);
+  };
+  std::partial_sort (lists.begin (), lists.begin () + num_probes,
+                     lists.end (), more_similar);
+  lists.resize (num_probes);
+}
+
+const std::vector<movie_id>& ContentIndex::get_list (std::uint32_t list) const
+{
+  return _lists[list];
+}
+
+void ContentIndex::set_num_probes (std::size_t num_probes)
+{
+  _num_probes = num_probes;
+}
+
+std::size_t ContentIndex::get_num_probes () const
+{
+  return _num_probes;
+}
+
+std::size_t ContentIndex::get_num_lists () const
+{
+  return _lists.size ();
+}
+
+std::size_t ContentIndex::get_num_movies () const
+{
+  return _num_movies;
+}
@@ -0,0 +1,98 @@
+#ifndef CONTENTINDEX_H
+#define CONTENTINDEX_H
+
+#include <cstdint>
+#include <vector>
+#include "MovieCatalog.h"
+
+/**
+ * an inverted file (IVF) index over the normalized feature rows of a
+ * catalog, for approximate content recommendations.
+ * movies are clustered by spherical k-means into lists around unit
+ * centroids. a query only scores the movies of the num_probes lists whose
+ * centroids are most similar to it, so num_probes trades recall for
+ * latency: probing every list is the exact scan.
+ */
+class ContentIndex
+{
+ private:
+  std::size_t _num_lists;
+  std::size_t _num_probes;
+  std::size_t _num_movies; // movies assigned to lists so far
+  std::size_t _num_features;
+  std::size_t _trained_movies; // catalog size when the centroids were
+                               // trained
+  feature_buffer _centroids; // _lists.size() unit rows
+  std::vector<double> _centroid_norms; // 1, or 0 for a degenerate centroid
+  std::vector<std::vector<movie_id>> _lists; // members, ascending ids
+  std::vector<std::uint32_t> _list_of; // _list_of[id] is the list of <id>
+
+  std::uint32_t nearest_list (const MovieCatalog& catalog, movie_id id,
+                              double *scores) const;
+  void train (const MovieCatalog& catalog, unsigned n_threads);
+
+ public:
+  /**
+   * @param num_lists number of lists (clusters) to split the movies into
+   * @param num_probes number of lists a query scores
+   */
+  ContentIndex (std::size_t num_lists, std::size_t num_probes);
+
+  /**
+   * brings the index up to date with the catalog: movies added since the
+   * last call join the list of their nearest centroid. the centroids are
+   * trained on the first call, and trained again once the catalog has
+   * doubled since, so the lists do not drift far from the data.
+   * @param catalog the catalog the index is built from
+   * @param n_threads number of threads, 0 for one per hardware thread
+   */
+  void update (const MovieCatalog& catalog, unsigned n_threads);
+
+  /**
+   * moves an indexed movie to the list of its nearest centroid, after its
+   * features changed
+   * @param catalog the catalog the index is built from
+   * @param id movie_id of the changed movie
+   */
+  void reassign (const MovieCatalog& catalog, movie_id id);
+
+  /**
+   * picks the lists a query scores
+   * @param query first element of the query vector
+   * @param query_norm norm of the query vector
+   * @param scores buffer for the similarity of the query to every centroid
+   * @param lists output, the num_probes most similar lists, most similar
+   * first
+   */
+  void probe (const double *query, double query_norm,
+              std::vector<double>& scores,
+              std::vector<std::uint32_t>& lists) const;
+
+  /**
+   * @param list index of a list
+   * @return ids of the movies in the list, ascending
+   */
+  const std::vector<movie_id>& get_list (std::uint32_t list) const;
+
+  /**
+   * @param num_probes number of lists a query scores
+   */
+  void set_num_probes (std::size_t num_probes);
+
+  /**
+   * @return number of lists a query scores
+   */
+  std::size_t get_num_probes () const;
+
+  /**
+   * @return number of lists the movies were split into
+   */
+  std::size_t get_num_lists () const;
+
+  /**
+   * @return the number of movies the index covers
+   */
+  std::size_t get_num_movies () const;
+};
+
+#endif //CONTENTINDEX_H
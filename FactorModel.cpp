@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "FactorModel.h"
+#include "RSUser.h"
+#include "ParallelFor.h"
+#include "SimilarityKernels.h"
+
+#define SOLVE_BLOCK_ROWS 64 // rows one thread solves per scheduled block
+#define INIT_SCALE 0.1 // the first movie factors are in +-INIT_SCALE / 2
+#define MIN_PIVOT 1e-12
+
+/**
+ * splitmix64: a well mixed 64 bit hash, used instead of a random engine so
+ * the split and the first factors only depend on the seed, and can be drawn
+ * from any thread in any order
+ * @param x std::uint64_t
+ * @return the hash of x
+ */
+static std::uint64_t mix (std::uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * @param seed std::uint64_t
+ * @param a first key
+ * @param b second key
+ * @return a number in [0, 1) fixed by the seed and the keys
+ */
+static double uniform (std::uint64_t seed, std::uint64_t a, std::uint64_t b)
+{
+  return static_cast<double>(mix (mix (seed ^ mix (a)) ^ b) >> 11)
+         * 0x1.0p-53;
+}
+
+/**
+ * buffers of one solving thread: the normal equations of one row
+ */
+struct solve_scratch
+{
+  std::vector<double> lhs; // size x size, row-major
+  std::vector<double> rhs;
+};
+
+/**
+ * solves lhs * x = rhs for a symmetric positive definite lhs by cholesky
+ * decomposition. lhs is overwritten with its factor and rhs with x.
+ * @param lhs row-major size x size matrix
+ * @param rhs vector of size elements
+ * @param size std::size_t
+ */
+static void solve_cholesky (double *lhs, double *rhs, std::size_t size)
+{
+  for (std::size_t j = 0; j < size; j++)
+  {
+    double pivot = lhs[j * size + j];
+    for (std::size_t p = 0; p < j; p++)
+    {
+      pivot -= lhs[j * size + p] * lhs[j * size + p];
+    }
+    pivot = std::sqrt (std::max (pivot, MIN_PIVOT));
+    lhs[j * size + j] = pivot;
+    for (std::size_t i = j + 1; i < size; i++)
+    {
+      double value = lhs[i * size + j];
+      for (std::size_t p = 0; p < j; p++)
+      {
+        value -= lhs[i * size + p] * lhs[j * size + p];
+      }
+      lhs[i * size + j] = value / pivot;
+    }
+  }
+  for (std::size_t i = 0; i < size; i++) // L y = rhs
+  {
+    for (std::size_t p = 0; p < i; p++)
+    {
+      rhs[i] -= lhs[i * size + p] * rhs[p];
+    }
+    rhs[i] /= lhs[i * size + i];
+  }
+  for (std::size_t i = size; i-- > 0;) // L^T x = y
+  {
+    for (std::size_t p = i + 1; p < size; p++)
+    {
+      rhs[i] -= lhs[p * size + i] * rhs[p];
+    }
+    rhs[i] /= lhs[i * size + i];
+  }
+}
+
+/**
+ * the ratings of one side of the matrix in compressed rows: row <i> is
+ * [offsets[i], offsets[i + 1]) of others and rates.
+ */
+struct rating_rows
+{
+  std::vector<std::size_t> offsets;
+  std::vector<std::uint32_t> others; // the movie (or user) of each rate
+  std::vector<double> rates; // centered by the mean
+};
+
+/**
+ * solves one row of the factors: the least squares fit of the rates of the
+ * row to the fixed rows on the other side, regularized by
+ * regularization * (number of rates).
+ * @param row the ratings of the row
+ * @param first offset of the row's first rating in row.others
+ * @param last offset past its last rating
+ * @param fixed the rows of the other side, fixed_size elements apart
+ * @param fixed_size std::size_t
+ * @param size number of leading elements solved
+ * @param target rates minus the part of the prediction not solved for
+ * @param regularization double
+ * @param scratch solve_scratch
+ * @param out the solved elements
+ */
+template <typename Target>
+static void solve_row (const rating_rows& row, std::size_t first,
+                       std::size_t last, const double *fixed,
+                       std::size_t fixed_size, std::size_t size,
+                       Target target, double regularization,
+                       solve_scratch& scratch, double *out)
+{
+  if (first == last)
+  {
+    std::fill (out, out + size, 0.0);
+    return;
+  }
+  scratch.lhs.assign (size * size, 0.0);
+  scratch.rhs.assign (size, 0.0);
+  double *lhs = scratch.lhs.data ();
+  double *rhs = scratch.rhs.data ();
+  for (std::size_t i = first; i < last; i++)
+  {
+    const double *other = fixed + row.others[i] * fixed_size;
+    double rate = target (i, other);
+    for (std::size_t a = 0; a < size; a++)
+    {
+      rhs[a] += rate * other[a];
+      for (std::size_t b = 0; b <= a; b++)
+      {
+        lhs[a * size + b] += other[a] * other[b];
+      }
+    }
+  }
+  double lambda = regularization * static_cast<double>(last - first);
+  for (std::size_t a = 0; a < size; a++)
+  {
+    lhs[a * size + a] += lambda;
+    for (std::size_t b = 0; b < a; b++)
+    {
+      lhs[b * size + a] = lhs[a * size + b];
+    }
+  }
+  solve_cholesky (lhs, rhs, size);
+  std::copy (rhs, rhs + size, out);
+}
+
+/**
+ * the held out ratings are picked by a hash of (seed, user, movie), so the
+ * split is the same for the same seed whatever the thread count. the
+ * movies are the ids below the catalog's size at training time.
+ */
+FactorModel::FactorModel (const std::vector<RSUser>& users,
+                          const MovieCatalog& catalog,
+                          const als_options& options, unsigned n_threads)
+    : _num_factors (options.num_factors),
+      _row_size (options.num_factors
+                 + (options.use_features ? catalog.get_num_features () : 0)),
+      _mean (0), _num_users (users.size ()),
+      _num_movies (catalog.get_num_movies ())
+{
+  std::size_t num_users = _num_users;
+  std::size_t num_features = _row_size - _num_factors;
+  // split the ratings, users first:
+  rating_rows by_user;
+  by_user.offsets.assign (1, 0);
+  std::vector<std::size_t> test_users;
+  std::vector<rating_entry> test;
+  double sum = 0;
+  _index.reserve (num_users);
+  for (std::size_t user = 0; user < num_users; user++)
+  {
+    _index.emplace (users[user].get_name (), user);
+    for (const auto& elem : users[user].get_ratings ())
+    {
+      if (elem.first >= _num_movies)
+      {
+        continue;
+      }
+      if (uniform (options.seed, user, elem.first) < options.holdout)
+      {
+        test_users.push_back (user);
+        test.push_back (elem);
+        continue;
+      }
+      by_user.others.push_back (elem.first);
+      by_user.rates.push_back (elem.second);
+      sum += elem.second;
+    }
+    by_user.offsets.push_back (by_user.others.size ());
+  }
+  std::size_t num_train = by_user.rates.size ();
+  _mean = num_train == 0 ? 0 : sum / static_cast<double>(num_train);
+  for (double& rate : by_user.rates)
+  {
+    rate -= _mean;
+  }
+  // and the same ratings by movie:
+  rating_rows by_movie;
+  by_movie.offsets.assign (_num_movies + 1, 0);
+  for (std::uint32_t movie : by_user.others)
+  {
+    by_movie.offsets[movie + 1]++;
+  }
+  for (std::size_t movie = 0; movie < _num_movies; movie++)
+  {
+    by_movie.offsets[movie + 1] += by_movie.offsets[movie];
+  }
+  by_movie.others.resize (num_train);
+  by_movie.rates.resize (num_train);
+  std::vector<std::size_t> fill (by_movie.offsets.begin (),
+                                 by_movie.offsets.end () - 1);
+  for (std::size_t user = 0; user < num_users; user++)
+  {
+    for (std::size_t i = by_user.offsets[user];
+         i < by_user.offsets[user + 1]; i++)
+    {
+      std::size_t pos = fill[by_user.others[i]]++;
+      by_movie.others[pos] = static_cast<std::uint32_t>(user);
+      by_movie.rates[pos] = by_user.rates[i];
+    }
+  }
+
+  _user_rows.assign (num_users * _row_size, 0.0);
+  _movie_rows.assign (_num_movies * _row_size, 0.0);
+  for (std::size_t movie = 0; movie < _num_movies; movie++)
+  {
+    double *row = _movie_rows.data () + movie * _row_size;
+    for (std::size_t f = 0; f < _num_factors; f++)
+    {
+      row[f] = INIT_SCALE * (uniform (~options.seed, movie, f) - 0.5);
+    }
+    if (num_features > 0)
+    {
+      auto id = static_cast<movie_id>(movie);
+      const double *features = catalog.get_features (id);
+      double norm = catalog.get_norm (id);
+      for (std::size_t f = 0; f < num_features; f++)
+      {
+        row[_num_factors + f] = norm > 0 ? features[f] / norm : 0.0;
+      }
+    }
+  }
+
+  std::vector<solve_scratch> scratch (resolve_num_threads (n_threads));
+  std::vector<double> errors (num_users);
+  auto solve_blocks = [&] (std::size_t num_rows, auto solve)
+  {
+    std::size_t num_blocks = (num_rows + SOLVE_BLOCK_ROWS - 1)
+                             / SOLVE_BLOCK_ROWS;
+    parallel_for_each (0, num_blocks, n_threads,
+                       [&] (std::size_t block, unsigned worker)
+                       {
+                         std::size_t last = std::min
+                             (num_rows, (block + 1) * SOLVE_BLOCK_ROWS);
+                         for (std::size_t i = block * SOLVE_BLOCK_ROWS;
+                              i < last; i++)
+                         {
+                           solve (i, scratch[worker]);
+                         }
+                       });
+  };
+  for (std::size_t it = 0; it < options.num_iterations; it++)
+  {
+    // every user row, movies fixed:
+    solve_blocks (num_users, [&] (std::size_t user, solve_scratch& cur)
+    {
+      solve_row (by_user, by_user.offsets[user], by_user.offsets[user + 1],
+                 _movie_rows.data (), _row_size, _row_size,
+                 [&] (std::size_t i, const double *)
+                 { return by_user.rates[i]; },
+                 options.regularization, cur,
+                 _user_rows.data () + user * _row_size);
+    });
+    // the learned part of every movie row, users fixed; the part of the
+    // prediction from the fixed features is taken off the rates:
+    solve_blocks (_num_movies, [&] (std::size_t movie, solve_scratch& cur)
+    {
+      const double *features = _movie_rows.data () + movie * _row_size
+                               + _num_factors;
+      solve_row (by_movie, by_movie.offsets[movie],
+                 by_movie.offsets[movie + 1], _user_rows.data (), _row_size,
+                 _num_factors,
+                 [&] (std::size_t i, const double *user_row)
+                 {
+                   return by_movie.rates[i] - SimilarityKernels::inner_product
+                       (user_row + _num_factors, features, num_features);
+                 },
+                 options.regularization, cur,
+                 _movie_rows.data () + movie * _row_size);
+    });
+    parallel_for (0, num_users, n_threads,
+                  [&] (std::size_t first, std::size_t last)
+                  {
+                    for (std::size_t user = first; user < last; user++)
+                    {
+                      errors[user] = 0;
+                      for (std::size_t i = by_user.offsets[user];
+                           i < by_user.offsets[user + 1]; i++)
+                      {
+                        double error = by_user.rates[i] + _mean
+                                       - predict (user, by_user.others[i]);
+                        errors[user] += error * error;
+                      }
+                    }
+                  });
+    double squared = 0;
+    for (double error : errors)
+    {
+      squared += error;
+    }
+    _report.train_rmse.push_back (num_train == 0 ? 0.0 : std::sqrt
+        (squared / static_cast<double>(num_train)));
+  }
+
+  double squared = 0;
+  for (std::size_t i = 0; i < test.size (); i++)
+  {
+    double error = test[i].second - predict (test_users[i], test[i].first);
+    squared += error * error;
+  }
+  _report.num_train = num_train;
+  _report.num_test = test.size ();
+  _report.test_rmse = test.empty ()
+                      ? std::numeric_limits<double>::quiet_NaN ()
+                      : std::sqrt (squared / static_cast<double>(test.size ()));
+}
+
+std::size_t FactorModel::find_user (const std::string& name) const
+{
+  auto it = _index.find (name);
+  return it == _index.end () ? INVALID_USER : it->second;
+}
+
+double FactorModel::predict (std::size_t user, movie_id movie) const
+{
+  return _mean + SimilarityKernels::inner_product
+      (_user_rows.data () + user * _row_size,
+       _movie_rows.data () + movie * _row_size, _row_size);
+}
+
+void FactorModel::predict_rows (std::size_t user, movie_id first,
+                                std::size_t num_rows, double *scores) const
+{
+  SimilarityKernels::dot_block (_user_rows.data () + user * _row_size,
+                                _movie_rows.data () + first * _row_size,
+                                num_rows, _row_size, scores);
+  for (std::size_t r = 0; r < num_rows; r++)
+  {
+    scores[r] += _mean;
+  }
+}
+
+std::size_t FactorModel::get_num_movies () const
+{
+  return _num_movies;
+}
+
+std::size_t FactorModel::get_num_users () const
+{
+  return _num_users;
+}
+
+std::size_t FactorModel::get_row_size () const
+{
+  return _row_size;
+}
+
+const als_report& FactorModel::get_report () const
+{
+  return _report;
+}
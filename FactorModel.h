@@ -0,0 +1,119 @@
+#ifndef FACTORMODEL_H
+#define FACTORMODEL_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Recommendation.h"
+
+class RSUser;
+
+/**
+ * how FactorModel is trained
+ */
+struct als_options
+{
+  std::size_t num_factors = 16; // latent factors learned per user and movie
+  std::size_t num_iterations = 10; // alternations of user and movie solves
+  double regularization = 0.05; // scaled by the ratings of each solved row
+  bool use_features = false; // append the movie features to the factors
+  double holdout = 0.1; // share of the ratings held out to measure rmse
+  std::uint64_t seed = 1; // picks the held out ratings and the first factors
+};
+
+/**
+ * how well a FactorModel fits
+ */
+struct als_report
+{
+  std::size_t num_train = 0; // ratings trained on
+  std::size_t num_test = 0; // ratings held out
+  std::vector<double> train_rmse; // after every iteration
+  double test_rmse = 0.0; // over the held out ratings, NaN if none
+};
+
+/**
+ * a latent factor model of the ratings, trained by alternating least
+ * squares: rate(user, movie) ~ mean + user_row . movie_row.
+ * each iteration solves every user's row with the movie rows fixed, then
+ * every movie's row with the user rows fixed; each row is a small
+ * regularized least squares problem solved by cholesky, and the rows are
+ * solved in parallel blocks.
+ * with use_features, every movie row ends with the movie's (normalized)
+ * features, which are fixed: the users learn a weight for each feature,
+ * so movies nobody rated are still scored by their features.
+ * the rows are stored in two contiguous row-major arrays, so a prediction
+ * is one inner product and scoring consecutive movies is a block kernel
+ * call. the model is a snapshot of the ratings and the catalog it was
+ * trained on; users are identified by name.
+ */
+class FactorModel
+{
+ private:
+  std::size_t _num_factors;
+  std::size_t _row_size; // num_factors plus the appended features
+  double _mean; // of the trained ratings
+  std::size_t _num_users;
+  std::unordered_map<std::string, std::size_t> _index; // name -> user
+  feature_buffer _user_rows;
+  feature_buffer _movie_rows;
+  std::size_t _num_movies;
+  als_report _report;
+
+ public:
+  /**
+   * trains the model
+   * @param users the users to train on
+   * @param catalog the catalog their ratings refer to
+   * @param options als_options
+   * @param n_threads number of threads, 0 for one per hardware thread
+   */
+  FactorModel (const std::vector<RSUser>& users, const MovieCatalog& catalog,
+               const als_options& options, unsigned n_threads);
+
+  /**
+   * @param name name of a user
+   * @return the user's index in the model, INVALID_USER if it has none
+   */
+  std::size_t find_user (const std::string& name) const;
+
+  /**
+   * @param user index of the user, see find_user
+   * @param movie movie_id of a movie the model covers
+   * @return the predicted rate
+   */
+  double predict (std::size_t user, movie_id movie) const;
+
+  /**
+   * predicts the rates of consecutive movies with one kernel call
+   * @param user index of the user, see find_user
+   * @param first movie_id of the first movie
+   * @param num_rows number of movies, all covered by the model
+   * @param scores output, scores[r] is the predicted rate of first + r
+   */
+  void predict_rows (std::size_t user, movie_id first, std::size_t num_rows,
+                     double *scores) const;
+
+  /**
+   * @return the number of movies the model covers: the ids below it
+   */
+  std::size_t get_num_movies () const;
+
+  /**
+   * @return the number of users in the model
+   */
+  std::size_t get_num_users () const;
+
+  /**
+   * @return the number of elements in every row
+   */
+  std::size_t get_row_size () const;
+
+  /**
+   * @return the training and held out errors
+   */
+  const als_report& get_report () const;
+};
+
+#endif //FACTORMODEL_H
@@ -0,0 +1,141 @@
+#include "ItemNeighbors.h"
+#include "ParallelFor.h"
+#include "SimilarityKernels.h"
+
+#define NEIGHBOR_BLOCK_ROWS 256 // candidate rows scored per kernel call
+
+ItemNeighbors::ItemNeighbors (std::size_t k) : _k (k), _num_movies (0)
+{
+}
+
+/**
+ * inserts a candidate into a movie's list if it is among the k most
+ * similar seen so far, keeping the list sorted by similarity (descending).
+ * only touches the row of <movie>, so threads working on different movies
+ * never share memory.
+ * @param movie movie_id whose list is updated
+ * @param neighbor movie_id of the candidate
+ * @param similarity float similarity of the two movies
+ */
+void ItemNeighbors::offer (movie_id movie, movie_id neighbor,
+                           float similarity)
+{
+  std::size_t count = _counts[movie];
+  movie_id *ids = _ids.data () + movie * _k;
+  float *similarities = _similarities.data () + movie * _k;
+  if (_k == 0 || (count == _k && similarity <= similarities[_k - 1]))
+  {
+    return;
+  }
+  std::size_t pos = count < _k ? count : _k - 1;
+  while (pos > 0 && similarities[pos - 1] < similarity)
+  {
+    ids[pos] = ids[pos - 1];
+    similarities[pos] = similarities[pos - 1];
+    pos--;
+  }
+  ids[pos] = neighbor;
+  similarities[pos] = similarity;
+  if (count < _k)
+  {
+    _counts[movie] = static_cast<std::uint32_t>(count + 1);
+  }
+}
+
+void ItemNeighbors::update (const MovieCatalog& catalog, unsigned n_threads)
+{
+  std::size_t num_movies = catalog.get_num_movies ();
+  std::size_t old_movies = _num_movies;
+  if (num_movies == old_movies)
+  {
+    return;
+  }
+  std::size_t num_features = catalog.get_num_features ();
+  _ids.resize (num_movies * _k);
+  _similarities.resize (num_movies * _k);
+  _counts.resize (num_movies, 0);
+  // scores movie <id> against the candidates [first, last) and offers them:
+  auto scan = [&] (movie_id id, std::size_t first, std::size_t last,
+                   double *scores)
+  {
+    for (std::size_t block = first; block < last;
+         block += NEIGHBOR_BLOCK_ROWS)
+    {
+      std::size_t num_rows = std::min<std::size_t> (last - block,
+                                                    NEIGHBOR_BLOCK_ROWS);
+      auto block_id = static_cast<movie_id>(block);
+      SimilarityKernels::score_block (catalog.get_features (id),
+                                      catalog.get_norm (id),
+                                      catalog.get_features (block_id),
+                                      catalog.get_norms (block_id),
+                                      num_rows, num_features, scores);
+      for (std::size_t r = 0; r < num_rows; r++)
+      {
+        if (block + r != id)
+        {
+          offer (id, static_cast<movie_id>(block + r),
+                 static_cast<float>(scores[r]));
+        }
+      }
+    }
+  };
+  std::size_t new_movies = num_movies - old_movies;
+  // new movies: a full list over the whole catalog
+  parallel_for (old_movies, num_movies,
+                threads_for_work (n_threads, new_movies * num_movies),
+                [&] (std::size_t first, std::size_t last)
+                {
+                    double scores[NEIGHBOR_BLOCK_ROWS];
+                    for (std::size_t id = first; id < last; id++)
+                    {
+                      scan (static_cast<movie_id>(id), 0, num_movies,
+                            scores);
+                    }
+                });
+  // old movies: only the new movies can enter their lists
+  parallel_for (0, old_movies,
+                threads_for_work (n_threads, old_movies * new_movies),
+                [&] (std::size_t first, std::size_t last)
+                {
+                    double scores[NEIGHBOR_BLOCK_ROWS];
+                    for (std::size_t id = first; id < last; id++)
+                    {
+                      scan (static_cast<movie_id>(id), old_movies,
+                            num_movies, scores);
+                    }
+                });
+  _num_movies = num_movies;
+}
+
+void ItemNeighbors::clear ()
+{
+  _ids.clear ();
+  _similarities.clear ();
+  _counts.clear ();
+  _num_movies = 0;
+}
+
+std::size_t ItemNeighbors::get_k () const
+{
+  return _k;
+}
+
+std::size_t ItemNeighbors::get_num_movies () const
+{
+  return _num_movies;
+}
+
+std::size_t ItemNeighbors::get_count (movie_id id) const
+{
+  return _counts[id];
+}
+
+const movie_id *ItemNeighbors::get_ids (movie_id id) const
+{
+  return _ids.data () + id * _k;
+}
+
+const float *ItemNeighbors::get_similarities (movie_id id) const
+{
+  return _similarities.data () + id * _k;
+}
@@ -0,0 +1,89 @@
+#ifndef ITEMNEIGHBORS_H
+#define ITEMNEIGHBORS_H
+
+#include <cstdint>
+#include <vector>
+#include "MovieCatalog.h"
+
+/**
+ * how cf predicts a movie. EXACT compares the movie with every movie the
+ * user rated, NEIGHBORS only looks at the movie's precomputed ItemNeighbors
+ * list. USERS is user-user cf instead: the rates other users gave the
+ * movie, weighted by their similarity to the user (see UserNeighbors).
+ */
+enum class cf_mode
+{
+  EXACT,
+  NEIGHBORS,
+  USERS
+};
+
+/**
+ * the k nearest neighbors of every movie in a catalog by cosine similarity
+ * of features, most similar first. lists are kept compactly as k ids and k
+ * float similarities per movie, in two flat arrays.
+ */
+class ItemNeighbors
+{
+ private:
+  std::size_t _k;
+  std::size_t _num_movies; // movies covered by the lists so far
+  std::vector<movie_id> _ids; // row <id> holds the neighbors of movie <id>
+  std::vector<float> _similarities; // parallel to _ids
+  std::vector<std::uint32_t> _counts; // valid entries in each row
+
+  void offer (movie_id movie, movie_id neighbor, float similarity);
+
+ public:
+  /**
+   * @param k the number of neighbors to keep per movie
+   */
+  explicit ItemNeighbors (std::size_t k);
+
+  /**
+   * brings the lists up to date with the catalog. movies added since the
+   * last call get a full list, and the lists of the older movies only
+   * consider the new movies as candidates, so adding m movies to a catalog
+   * of n costs O(n * m) similarities rather than O(n * n). a small update,
+   * e.g. of one movie, runs on the calling thread.
+   * @param catalog the catalog the lists are built from
+   * @param n_threads number of threads, 0 for one per hardware thread
+   */
+  void update (const MovieCatalog& catalog, unsigned n_threads);
+
+  /**
+   * forgets all lists, e.g. after features of a covered movie changed; the
+   * next update rebuilds everything.
+   */
+  void clear ();
+
+  /**
+   * @return the number of neighbors kept per movie
+   */
+  std::size_t get_k () const;
+
+  /**
+   * @return the number of movies the lists cover
+   */
+  std::size_t get_num_movies () const;
+
+  /**
+   * @param id id of a covered movie
+   * @return number of neighbors in the movie's list (at most get_k())
+   */
+  std::size_t get_count (movie_id id) const;
+
+  /**
+   * @param id id of a covered movie
+   * @return ids of the movie's neighbors, most similar first
+   */
+  const movie_id *get_ids (movie_id id) const;
+
+  /**
+   * @param id id of a covered movie
+   * @return similarities of the movie's neighbors, parallel to get_ids()
+   */
+  const float *get_similarities (movie_id id) const;
+};
+
+#endif //ITEMNEIGHBORS_H
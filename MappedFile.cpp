@@ -0,0 +1,59 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile (const std::string& path) : _data (nullptr),
+                                                   _size (0),
+                                                   _is_open (false)
+{
+  int fd = open (path.c_str (), O_RDONLY);
+  if (fd < 0)
+  {
+    return;
+  }
+  struct stat info{};
+  if (fstat (fd, &info) == 0 && S_ISREG (info.st_mode))
+  {
+    _size = static_cast<std::size_t>(info.st_size);
+    if (_size == 0)
+    {
+      _is_open = true;
+    }
+    else
+    {
+      void *data = mmap (nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED)
+      {
+        madvise (data, _size, MADV_SEQUENTIAL);
+        _data = static_cast<const char *>(data);
+        _is_open = true;
+      }
+    }
+  }
+  close (fd); // the mapping stays valid without the descriptor
+}
+
+MappedFile::~MappedFile ()
+{
+  if (_data != nullptr)
+  {
+    munmap (const_cast<char *>(_data), _size);
+  }
+}
+
+bool MappedFile::is_open () const
+{
+  return _is_open;
+}
+
+const char *MappedFile::get_data () const
+{
+  return _data;
+}
+
+std::size_t MappedFile::get_size () const
+{
+  return _size;
+}
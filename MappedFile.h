@@ -0,0 +1,46 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * a read-only memory mapping of a whole file, unmapped on destruction.
+ * the contents are read straight from the page cache, without copying
+ * them into a buffer first.
+ */
+class MappedFile
+{
+ private:
+  const char *_data;
+  std::size_t _size;
+  bool _is_open;
+
+ public:
+  /**
+   * maps the file; check is_open() for success
+   * @param path path of the file
+   */
+  explicit MappedFile (const std::string& path);
+  ~MappedFile ();
+  MappedFile (const MappedFile&) = delete;
+  MappedFile& operator= (const MappedFile&) = delete;
+
+  /**
+   * @return true if the file was opened and mapped (an empty file is open
+   * and has no data)
+   */
+  bool is_open () const;
+
+  /**
+   * @return first byte of the file
+   */
+  const char *get_data () const;
+
+  /**
+   * @return size of the file in bytes
+   */
+  std::size_t get_size () const;
+};
+
+#endif //MAPPEDFILE_H
@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Metrics.h"
+
+#define WRITE_ERROR "ERROR: could not write the metrics file."
+#define SOCKET_ERROR "ERROR: could not write the metrics to the socket."
+#define NUM_STAGES static_cast<std::size_t>(metric_stage::NUM_STAGES)
+#define NUM_COUNTERS static_cast<std::size_t>(metric_counter::NUM_COUNTERS)
+#define SUB_BUCKETS (1u << METRIC_SUB_BITS)
+
+static const char *const STAGE_NAMES[] = {
+    "load_movies", "load_users", "profile_build", "content_scan",
+    "content_ann_scan", "cf_scan", "factors_scan", "cf_predict", "k_select",
+    "movie_lookup"};
+static const char *const COUNTER_NAMES[] = {
+    "movies_loaded", "users_loaded", "ratings_loaded", "movies_scored",
+    "cf_predictions", "movie_lookups", "top_n_requests"};
+static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+/**
+ * what one thread recorded. only the owning thread writes it, with relaxed
+ * loads and stores rather than atomic additions; the atomics only let
+ * snapshot read it at the same time.
+ */
+struct thread_metrics
+{
+  std::atomic<std::uint64_t> buckets[NUM_STAGES][METRIC_NUM_BUCKETS];
+  std::atomic<std::uint64_t> sums[NUM_STAGES];
+  std::atomic<std::uint64_t> counters[NUM_COUNTERS];
+};
+
+/**
+ * every thread_metrics alive, and what exited threads recorded
+ */
+struct metrics_registry
+{
+  std::mutex mutex;
+  std::vector<thread_metrics *> threads;
+  metrics_snapshot retired;
+  metrics_snapshot baseline; // the totals at the last reset
+};
+
+/**
+ * the registry is never destroyed, so threads exiting after the static
+ * destructors ran can still fold into it
+ * @return the registry
+ */
+static metrics_registry& get_registry ()
+{
+  static auto *registry = new metrics_registry ();
+  return *registry;
+}
+
+/**
+ * adds a thread's records to a snapshot
+ * @param into metrics_snapshot
+ * @param metrics thread_metrics
+ */
+static void add_to (metrics_snapshot& into, const thread_metrics& metrics)
+{
+  for (std::size_t stage = 0; stage < NUM_STAGES; stage++)
+  {
+    stage_summary& summary = into.stages[stage];
+    for (std::size_t b = 0; b < METRIC_NUM_BUCKETS; b++)
+    {
+      std::uint64_t count = metrics.buckets[stage][b].load
+          (std::memory_order_relaxed);
+      summary.buckets[b] += count;
+      summary.count += count;
+    }
+    summary.sum_ns += metrics.sums[stage].load (std::memory_order_relaxed);
+  }
+  for (std::size_t counter = 0; counter < NUM_COUNTERS; counter++)
+  {
+    into.counters[counter] += metrics.counters[counter].load
+        (std::memory_order_relaxed);
+  }
+}
+
+/**
+ * owns the calling thread's thread_metrics and folds it into the registry
+ * when the thread exits
+ */
+struct thread_slot
+{
+  thread_metrics *metrics = nullptr;
+
+  ~thread_slot ()
+  {
+    if (metrics != nullptr)
+    {
+      metrics_registry& registry = get_registry ();
+      std::lock_guard<std::mutex> lock (registry.mutex);
+      add_to (registry.retired, *metrics);
+      registry.threads.erase (std::find (registry.threads.begin (),
+                                         registry.threads.end (), metrics));
+      delete metrics;
+    }
+  }
+};
+
+/**
+ * @return the calling thread's thread_metrics, registered on first use
+ */
+static thread_metrics& get_local ()
+{
+  thread_local thread_slot slot;
+  if (slot.metrics == nullptr)
+  {
+    slot.metrics = new thread_metrics (); // value-initialized: all zero
+    metrics_registry& registry = get_registry ();
+    std::lock_guard<std::mutex> lock (registry.mutex);
+    registry.threads.push_back (slot.metrics);
+  }
+  return *slot.metrics;
+}
+
+/**
+ * adds to a value only the calling thread writes
+ * @param value std::atomic<std::uint64_t>&
+ * @param amount std::uint64_t
+ */
+static void add_owned (std::atomic<std::uint64_t>& value,
+                       std::uint64_t amount)
+{
+  value.store (value.load (std::memory_order_relaxed) + amount,
+               std::memory_order_relaxed);
+}
+
+/**
+ * values below SUB_BUCKETS have a bucket each; above, every power of two
+ * [2^e, 2^(e+1)) is split into SUB_BUCKETS buckets by the METRIC_SUB_BITS
+ * bits after the leading one.
+ * @param ns std::uint64_t
+ * @return the bucket of ns
+ */
+static std::size_t bucket_of (std::uint64_t ns)
+{
+  if (ns < SUB_BUCKETS)
+  {
+    return static_cast<std::size_t>(ns);
+  }
+  unsigned exponent = 63u - static_cast<unsigned>(__builtin_clzll (ns));
+  std::uint64_t sub = (ns >> (exponent - METRIC_SUB_BITS)) & (SUB_BUCKETS - 1);
+  std::size_t bucket = (exponent - METRIC_SUB_BITS + 1) * SUB_BUCKETS + sub;
+  return std::min<std::size_t> (bucket, METRIC_NUM_BUCKETS - 1);
+}
+
+/**
+ * @param bucket std::size_t
+ * @return the smallest value of the bucket
+ */
+static std::uint64_t bucket_floor (std::size_t bucket)
+{
+  if (bucket < SUB_BUCKETS)
+  {
+    return bucket;
+  }
+  std::size_t exponent = bucket / SUB_BUCKETS + METRIC_SUB_BITS - 1;
+  return (SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - METRIC_SUB_BITS);
+}
+
+std::uint64_t stage_summary::percentile (double quantile) const
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  auto rank = static_cast<std::uint64_t>(std::ceil (quantile * count));
+  rank = std::max<std::uint64_t> (rank, 1);
+  std::uint64_t seen = 0;
+  for (std::size_t b = 0; b < METRIC_NUM_BUCKETS; b++)
+  {
+    seen += buckets[b];
+    if (seen >= rank)
+    {
+      return b + 1 < METRIC_NUM_BUCKETS ? bucket_floor (b + 1) - 1
+                                        : bucket_floor (b);
+    }
+  }
+  return bucket_floor (METRIC_NUM_BUCKETS - 1);
+}
+
+void Metrics::record (metric_stage stage, std::uint64_t ns)
+{
+  thread_metrics& local = get_local ();
+  auto index = static_cast<std::size_t>(stage);
+  add_owned (local.buckets[index][bucket_of (ns)], 1);
+  add_owned (local.sums[index], ns);
+}
+
+void Metrics::count (metric_counter counter, std::uint64_t amount)
+{
+  add_owned (get_local ().counters[static_cast<std::size_t>(counter)],
+             amount);
+}
+
+/**
+ * the totals of every thread, minus the baseline of the last reset
+ */
+metrics_snapshot Metrics::snapshot ()
+{
+  metrics_registry& registry = get_registry ();
+  std::lock_guard<std::mutex> lock (registry.mutex);
+  metrics_snapshot result = registry.retired;
+  for (const thread_metrics *metrics : registry.threads)
+  {
+    add_to (result, *metrics);
+  }
+  const metrics_snapshot& baseline = registry.baseline;
+  for (std::size_t stage = 0; stage < NUM_STAGES; stage++)
+  {
+    result.stages[stage].count -= baseline.stages[stage].count;
+    result.stages[stage].sum_ns -= baseline.stages[stage].sum_ns;
+    for (std::size_t b = 0; b < METRIC_NUM_BUCKETS; b++)
+    {
+      result.stages[stage].buckets[b] -= baseline.stages[stage].buckets[b];
+    }
+  }
+  for (std::size_t counter = 0; counter < NUM_COUNTERS; counter++)
+  {
+    result.counters[counter] -= baseline.counters[counter];
+  }
+  return result;
+}
+
+/**
+ * the threads own their records, so they are not zeroed; the current
+ * totals become the baseline snapshot subtracts.
+ */
+void Metrics::reset ()
+{
+  metrics_registry& registry = get_registry ();
+  std::lock_guard<std::mutex> lock (registry.mutex);
+  metrics_snapshot totals = registry.retired;
+  for (const thread_metrics *metrics : registry.threads)
+  {
+    add_to (totals, *metrics);
+  }
+  registry.baseline = totals;
+}
+
+std::string Metrics::to_prometheus ()
+{
+  metrics_snapshot current = snapshot ();
+  std::ostringstream out;
+  out.precision (9);
+  out << "# HELP rs_stage_latency_seconds latency of a recommender stage\n"
+      << "# TYPE rs_stage_latency_seconds summary\n";
+  for (std::size_t stage = 0; stage < NUM_STAGES; stage++)
+  {
+    const stage_summary& summary = current.stages[stage];
+    std::string label = std::string ("stage=\"") + STAGE_NAMES[stage] + "\"";
+    for (double quantile : QUANTILES)
+    {
+      out << "rs_stage_latency_seconds{" << label << ",quantile=\""
+          << quantile << "\"} " << summary.percentile (quantile) * 1e-9
+          << "\n";
+    }
+    out << "rs_stage_latency_seconds_sum{" << label << "} "
+        << summary.sum_ns * 1e-9 << "\n"
+        << "rs_stage_latency_seconds_count{" << label << "} "
+        << summary.count << "\n";
+  }
+  for (std::size_t counter = 0; counter < NUM_COUNTERS; counter++)
+  {
+    out << "# TYPE rs_" << COUNTER_NAMES[counter] << "_total counter\n"
+        << "rs_" << COUNTER_NAMES[counter] << "_total "
+        << current.counters[counter] << "\n";
+  }
+  return out.str ();
+}
+
+std::string Metrics::to_json ()
+{
+  metrics_snapshot current = snapshot ();
+  std::ostringstream out;
+  out.precision (9);
+  out << "{\n  \"stages\": {";
+  for (std::size_t stage = 0; stage < NUM_STAGES; stage++)
+  {
+    const stage_summary& summary = current.stages[stage];
+    out << (stage == 0 ? "\n" : ",\n") << "    \"" << STAGE_NAMES[stage]
+        << "\": {\"count\": " << summary.count
+        << ", \"sum_seconds\": " << summary.sum_ns * 1e-9
+        << ", \"p50_seconds\": " << summary.percentile (0.5) * 1e-9
+        << ", \"p90_seconds\": " << summary.percentile (0.9) * 1e-9
+        << ", \"p99_seconds\": " << summary.percentile (0.99) * 1e-9
+        << ", \"p999_seconds\": " << summary.percentile (0.999) * 1e-9
+        << ", \"max_seconds\": " << summary.percentile (1.0) * 1e-9 << "}";
+  }
+  out << "\n  },\n  \"counters\": {";
+  for (std::size_t counter = 0; counter < NUM_COUNTERS; counter++)
+  {
+    out << (counter == 0 ? "\n" : ",\n") << "    \""
+        << COUNTER_NAMES[counter] << "\": " << current.counters[counter];
+  }
+  out << "\n  }\n}\n";
+  return out.str ();
+}
+
+void Metrics::write_to_file (const std::string& path, bool json)
+{
+  std::ofstream out (path, std::ios::binary | std::ios::trunc);
+  out << (json ? to_json () : to_prometheus ());
+  out.close ();
+  if (!out)
+  {
+    throw std::runtime_error (WRITE_ERROR);
+  }
+}
+
+void Metrics::write_to_socket (const std::string& path, bool json)
+{
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size () >= sizeof (address.sun_path))
+  {
+    throw std::runtime_error (SOCKET_ERROR);
+  }
+  std::memcpy (address.sun_path, path.c_str (), path.size () + 1);
+  int fd = ::socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    throw std::runtime_error (SOCKET_ERROR);
+  }
+  std::string text = json ? to_json () : to_prometheus ();
+  bool ok = ::connect (fd, reinterpret_cast<const sockaddr *>(&address),
+                       sizeof (address)) == 0;
+  for (std::size_t written = 0; ok && written < text.size ();)
+  {
+    ssize_t n = ::send (fd, text.data () + written, text.size () - written,
+                        MSG_NOSIGNAL);
+    ok = n > 0;
+    written += ok ? static_cast<std::size_t>(n) : 0;
+  }
+  ::close (fd);
+  if (!ok)
+  {
+    throw std::runtime_error (SOCKET_ERROR);
+  }
+}
+
+const char *Metrics::get_name (metric_stage stage)
+{
+  return STAGE_NAMES[static_cast<std::size_t>(stage)];
+}
+
+const char *Metrics::get_name (metric_counter counter)
+{
+  return COUNTER_NAMES[static_cast<std::size_t>(counter)];
+}
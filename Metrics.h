@@ -0,0 +1,261 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * the stages of loading and recommending whose latency is measured
+ */
+enum class metric_stage
+{
+  LOAD_MOVIES, // RecommenderSystemLoader, a whole file
+  LOAD_USERS, // RSUsersLoader, a whole file
+  PROFILE_BUILD, // a user's mean and preference vector, from all ratings
+  CONTENT_SCAN, // a content top n over the catalog
+  CONTENT_ANN_SCAN, // a content top n over the probed ContentIndex lists
+  CF_SCAN, // a cf top n (item or user based) over the unrated movies
+  FACTORS_SCAN, // a FactorModel top n
+  CF_PREDICT, // one item cf prediction, sampled
+  K_SELECT, // get_k_most_similar of one prediction, sampled
+  MOVIE_LOOKUP, // name/year to movie id lookups of one call
+  NUM_STAGES
+};
+
+/**
+ * the events that are counted
+ */
+enum class metric_counter
+{
+  MOVIES_LOADED,
+  USERS_LOADED,
+  RATINGS_LOADED,
+  MOVIES_SCORED, // by the content, content ann and factors scans
+  CF_PREDICTIONS,
+  MOVIE_LOOKUPS,
+  TOP_N_REQUESTS,
+  NUM_COUNTERS
+};
+
+#define METRIC_SUB_BITS 3 // every power of two is split in 2^3 buckets
+#define METRIC_MAX_EXPONENT 40 // 2^40 ns, about 18 minutes
+#define METRIC_NUM_BUCKETS ((METRIC_MAX_EXPONENT - METRIC_SUB_BITS + 2) \
+                            << METRIC_SUB_BITS)
+#define METRIC_SAMPLE_EVERY 64 // sampled stages time 1 call in 64, a power
+                               // of two
+
+/**
+ * the merged latencies of one stage
+ */
+struct stage_summary
+{
+  std::uint64_t count = 0;
+  std::uint64_t sum_ns = 0;
+  std::array<std::uint64_t, METRIC_NUM_BUCKETS> buckets{};
+
+  /**
+   * @param quantile in [0, 1]
+   * @return the upper bound of the bucket holding the quantile, in ns;
+   * within 1 / 2^METRIC_SUB_BITS of the true value
+   */
+  std::uint64_t percentile (double quantile) const;
+};
+
+/**
+ * the merged metrics of every thread
+ */
+struct metrics_snapshot
+{
+  std::array<stage_summary, static_cast<std::size_t>
+      (metric_stage::NUM_STAGES)> stages;
+  std::array<std::uint64_t, static_cast<std::size_t>
+      (metric_counter::NUM_COUNTERS)> counters{};
+};
+
+/**
+ * latency histograms and counters of the hot paths.
+ * every thread records into its own histograms and counters, registered
+ * on its first record and folded into a shared total when it exits, so
+ * recording never locks and never writes a cache line another thread
+ * writes: a record is two clock reads and a few relaxed stores. the
+ * histograms are log-linear like HDR histograms, with 2^METRIC_SUB_BITS
+ * buckets per power of two nanoseconds, so every percentile is within
+ * 12.5% of the true value.
+ * recording goes through the RS_METRICS_* macros, which expand to nothing
+ * when RS_DISABLE_METRICS is defined, compiling the instrumentation out.
+ */
+class Metrics
+{
+ public:
+  Metrics () = delete;
+
+  /**
+   * adds a latency to the calling thread's histogram of a stage
+   * @param stage metric_stage
+   * @param ns the latency, in nanoseconds
+   */
+  static void record (metric_stage stage, std::uint64_t ns);
+
+  /**
+   * adds to the calling thread's counter
+   * @param counter metric_counter
+   * @param amount std::uint64_t
+   */
+  static void count (metric_counter counter, std::uint64_t amount);
+
+  /**
+   * decides whether the calling thread times this call of a sampled stage:
+   * stages that run thousands of times per request would spend more on
+   * the clock than on the work, so only 1 call in METRIC_SAMPLE_EVERY is
+   * timed, and their histogram counts are of the sampled calls.
+   * @param stage metric_stage
+   * @return true for the first call of every METRIC_SAMPLE_EVERY
+   */
+  static bool sample (metric_stage stage)
+  {
+    static thread_local std::array<std::uint32_t, static_cast<std::size_t>
+        (metric_stage::NUM_STAGES)> calls{};
+    return (calls[static_cast<std::size_t>(stage)]++
+            & (METRIC_SAMPLE_EVERY - 1)) == 0;
+  }
+
+  /**
+   * @return the metrics of every thread so far, merged; may run while
+   * other threads record
+   */
+  static metrics_snapshot snapshot ();
+
+  /**
+   * starts the metrics over: later snapshots only hold what is recorded
+   * after the call
+   */
+  static void reset ();
+
+  /**
+   * @return the snapshot in the prometheus text format: a summary of every
+   * stage's latency in seconds and a counter per metric_counter
+   */
+  static std::string to_prometheus ();
+
+  /**
+   * @return the snapshot as json: count, sum and percentiles of every
+   * stage, in seconds, and the counters
+   */
+  static std::string to_json ();
+
+  /**
+   * writes to_prometheus() or to_json() to a file, replacing it
+   * @param path path of the file
+   * @param json true for json, false for prometheus
+   */
+  static void write_to_file (const std::string& path, bool json)
+  noexcept (false);
+
+  /**
+   * writes to_prometheus() or to_json() to a listening unix domain socket
+   * @param path path of the socket
+   * @param json true for json, false for prometheus
+   */
+  static void write_to_socket (const std::string& path, bool json)
+  noexcept (false);
+
+  /**
+   * @param stage metric_stage
+   * @return the stage's name in the dumps, e.g. "cf_scan"
+   */
+  static const char *get_name (metric_stage stage);
+
+  /**
+   * @param counter metric_counter
+   * @return the counter's name in the dumps, e.g. "movies_loaded"
+   */
+  static const char *get_name (metric_counter counter);
+};
+
+/**
+ * records the time from its construction to its destruction into a stage
+ */
+class ScopedTimer
+{
+ private:
+  metric_stage _stage;
+  std::chrono::steady_clock::time_point _start;
+
+ public:
+  explicit ScopedTimer (metric_stage stage)
+      : _stage (stage), _start (std::chrono::steady_clock::now ()) {}
+  ~ScopedTimer ()
+  {
+    Metrics::record (_stage, static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds> (
+            std::chrono::steady_clock::now () - _start).count ()));
+  }
+  ScopedTimer (const ScopedTimer&) = delete;
+  ScopedTimer& operator= (const ScopedTimer&) = delete;
+};
+
+/**
+ * a ScopedTimer that only times the calls Metrics::sample picks
+ */
+class SampledTimer
+{
+ private:
+  metric_stage _stage;
+  bool _active;
+  std::chrono::steady_clock::time_point _start;
+
+ public:
+  explicit SampledTimer (metric_stage stage)
+      : _stage (stage), _active (Metrics::sample (stage))
+  {
+    if (_active)
+    {
+      _start = std::chrono::steady_clock::now ();
+    }
+  }
+  ~SampledTimer ()
+  {
+    if (_active)
+    {
+      Metrics::record (_stage, static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds> (
+              std::chrono::steady_clock::now () - _start).count ()));
+    }
+  }
+  SampledTimer (const SampledTimer&) = delete;
+  SampledTimer& operator= (const SampledTimer&) = delete;
+};
+
+#define RS_METRICS_CONCAT_(a, b) a##b
+#define RS_METRICS_CONCAT(a, b) RS_METRICS_CONCAT_(a, b)
+
+#ifdef RS_DISABLE_METRICS
+#define RS_METRICS_TIME(stage) ((void) 0)
+#define RS_METRICS_TIME_SAMPLED(stage) ((void) 0)
+#define RS_METRICS_COUNT(counter, amount) ((void) 0)
+#else
+/**
+ * times the rest of the enclosing scope as metric_stage::stage
+ */
+#define RS_METRICS_TIME(stage) \
+  ScopedTimer RS_METRICS_CONCAT(rs_metrics_timer_, __LINE__) \
+      (metric_stage::stage)
+/**
+ * times the rest of the enclosing scope as metric_stage::stage, for 1 call
+ * in METRIC_SAMPLE_EVERY
+ */
+#define RS_METRICS_TIME_SAMPLED(stage) \
+  SampledTimer RS_METRICS_CONCAT(rs_metrics_timer_, __LINE__) \
+      (metric_stage::stage)
+/**
+ * adds amount to metric_counter::counter
+ */
+#define RS_METRICS_COUNT(counter, amount) \
+  Metrics::count (metric_counter::counter, \
+                  static_cast<std::uint64_t>(amount))
+#endif
+
+#endif //METRICS_H
@@ -0,0 +1,104 @@
+#include "MonotonicArena.h"
+#include <algorithm>
+#include <cstring>
+
+MonotonicArena::MonotonicArena (std::size_t first_block)
+    : _cur (nullptr), _left (0),
+      _next_block (std::max<std::size_t> (first_block, 1)), _bytes_used (0)
+{
+}
+
+MonotonicArena::~MonotonicArena ()
+{
+  for (auto it = _created.rbegin (); it != _created.rend (); ++it)
+  {
+    it->destroy (it->object);
+  }
+}
+
+/**
+ * bumps the free space of the last block. a request that does not fit
+ * starts a new block; one too big for even an empty block of the next
+ * size gets a block of its own, and the last block keeps its free space.
+ * @param size std::size_t
+ * @param alignment std::size_t
+ * @return void *
+ */
+void *MonotonicArena::allocate_locked (std::size_t size,
+                                       std::size_t alignment)
+{
+  size = std::max<std::size_t> (size, 1);
+  void *ptr = _cur;
+  if (std::align (alignment, size, ptr, _left) == nullptr)
+  {
+    std::size_t needed = size + alignment;
+    if (needed > _next_block)
+    {
+      _blocks.emplace_back (new char[needed]);
+      ptr = _blocks.back ().get ();
+      std::size_t space = needed;
+      _bytes_used += size;
+      return std::align (alignment, size, ptr, space);
+    }
+    _blocks.emplace_back (new char[_next_block]);
+    _cur = _blocks.back ().get ();
+    _left = _next_block;
+    _next_block = std::min (_next_block * 2, ARENA_MAX_BLOCK);
+    ptr = _cur;
+    std::align (alignment, size, ptr, _left);
+  }
+  _cur = static_cast<char *>(ptr) + size;
+  _left -= size;
+  _bytes_used += size;
+  return ptr;
+}
+
+void *MonotonicArena::allocate (std::size_t size, std::size_t alignment)
+{
+  std::lock_guard<std::mutex> lock (_mutex);
+  return allocate_locked (size, alignment);
+}
+
+std::string_view MonotonicArena::intern (std::string_view str)
+{
+  if (str.empty ())
+  {
+    return {};
+  }
+  char *copy = allocate_array<char> (str.size ());
+  std::memcpy (copy, str.data (), str.size ());
+  return {copy, str.size ()};
+}
+
+/**
+ * starts a block big enough for all of the bytes if the last one is not,
+ * and makes room for the objects' destructors.
+ * @param bytes std::size_t
+ * @param objects std::size_t
+ */
+void MonotonicArena::reserve (std::size_t bytes, std::size_t objects)
+{
+  std::lock_guard<std::mutex> lock (_mutex);
+  _created.reserve (_created.size () + objects);
+  if (bytes <= _left)
+  {
+    return;
+  }
+  std::size_t block = std::max (_next_block, bytes);
+  _blocks.emplace_back (new char[block]);
+  _cur = _blocks.back ().get ();
+  _left = block;
+  _next_block = std::min (block * 2, ARENA_MAX_BLOCK);
+}
+
+std::size_t MonotonicArena::get_num_blocks () const
+{
+  std::lock_guard<std::mutex> lock (_mutex);
+  return _blocks.size ();
+}
+
+std::size_t MonotonicArena::get_bytes_used () const
+{
+  std::lock_guard<std::mutex> lock (_mutex);
+  return _bytes_used;
+}
@@ -0,0 +1,144 @@
+#ifndef MONOTONICARENA_H
+#define MONOTONICARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define ARENA_FIRST_BLOCK 4096 // bytes of the first block
+#define ARENA_MAX_BLOCK (std::size_t (1) << 24) // blocks double up to 16 MB
+
+/**
+ * a monotonic (bump) allocator: memory is carved out of a few large blocks
+ * and is only given back all at once, when the arena is destroyed. blocks
+ * double in size, so n allocations cost O(log n) calls to malloc, and
+ * destroying the arena costs one free per block instead of one per object.
+ * objects that need a destructor are destroyed with the arena, in reverse
+ * order of creation. allocating takes a mutex, so an arena may be shared,
+ * e.g. by the versions of a MovieCatalog.
+ */
+class MonotonicArena
+{
+ private:
+  struct created_object
+  {
+    void *object;
+    void (*destroy) (void *);
+  };
+
+  mutable std::mutex _mutex;
+  std::vector<std::unique_ptr<char[]>> _blocks;
+  char *_cur; // free space of the last block
+  std::size_t _left;
+  std::size_t _next_block; // size of the next block
+  std::size_t _bytes_used;
+  std::vector<created_object> _created;
+
+  void *allocate_locked (std::size_t size, std::size_t alignment);
+
+ public:
+  /**
+   * @param first_block size of the first block in bytes
+   */
+  explicit MonotonicArena (std::size_t first_block = ARENA_FIRST_BLOCK);
+  ~MonotonicArena ();
+  MonotonicArena (const MonotonicArena&) = delete;
+  MonotonicArena& operator= (const MonotonicArena&) = delete;
+
+  /**
+   * @param size bytes to allocate
+   * @param alignment power of two
+   * @return uninitialized memory that lives as long as the arena
+   */
+  void *allocate (std::size_t size, std::size_t alignment);
+
+  /**
+   * @tparam T a trivially destructible type
+   * @param n number of elements
+   * @return uninitialized room for n elements of T
+   */
+  template <typename T>
+  T *allocate_array (std::size_t n)
+  {
+    static_assert (std::is_trivially_destructible_v<T>,
+                   "the arena never destroys array elements");
+    return static_cast<T *>(allocate (n * sizeof (T), alignof (T)));
+  }
+
+  /**
+   * constructs an object in the arena, destroyed with the arena
+   * @param args arguments of T's constructor
+   * @return pointer to the object
+   */
+  template <typename T, typename... Args>
+  T *create (Args&&... args)
+  {
+    std::lock_guard<std::mutex> lock (_mutex);
+    T *object = new (allocate_locked (sizeof (T), alignof (T)))
+        T (std::forward<Args> (args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>)
+    {
+      try
+      {
+        _created.push_back ({object, [] (void *ptr)
+        {
+          static_cast<T *>(ptr)->~T ();
+        }});
+      }
+      catch (...)
+      { // the arena could not record it, so it must not outlive the call
+        object->~T ();
+        throw;
+      }
+    }
+    return object;
+  }
+
+  /**
+   * constructs an object in the arena that the arena never destroys. only
+   * for objects whose destructor has nothing to do in the state they are
+   * built in, e.g. a Movie with an interned name; they cost no destructor
+   * record.
+   * @param args arguments of T's constructor
+   * @return pointer to the object
+   */
+  template <typename T, typename... Args>
+  T *create_untracked (Args&&... args)
+  {
+    std::lock_guard<std::mutex> lock (_mutex);
+    return new (allocate_locked (sizeof (T), alignof (T)))
+        T (std::forward<Args> (args)...);
+  }
+
+  /**
+   * copies a string into the arena
+   * @param str the chars to copy
+   * @return a view of the copy, valid as long as the arena
+   */
+  std::string_view intern (std::string_view str);
+
+  /**
+   * makes sure the next allocations of up to bytes in total, and objects,
+   * come out of one block
+   * @param bytes bytes expected to be allocated
+   * @param objects objects with a destructor expected to be created
+   */
+  void reserve (std::size_t bytes, std::size_t objects = 0);
+
+  /**
+   * @return number of blocks allocated so far
+   */
+  std::size_t get_num_blocks () const;
+
+  /**
+   * @return bytes handed out so far, without alignment padding
+   */
+  std::size_t get_bytes_used () const;
+};
+
+#endif //MONOTONICARENA_H
@@ -8,9 +8,21 @@
  * @return an integer for the hash map
  */
 std::size_t sp_movie_hash(const sp_movie& movie){
+    return movie_hash(movie->get_name(), movie->get_year());
+}
+
+/**
+ * the hash behind sp_movie_hash, computed from a name and a year directly so
+ * a movie can be looked up without constructing one. std::hash gives the
+ * same value for a std::string and a std::string_view of the same chars.
+ * @param name name of the movie
+ * @param year year of the movie
+ * @return an integer for the hash map
+ */
+std::size_t movie_hash(std::string_view name, int year){
     std::size_t res = HASH_START;
-    res = res * RES_MULT + std::hash<std::string>()(movie->get_name());
-    res = res * RES_MULT + std::hash<int>()(movie->get_year());
+    res = res * RES_MULT + std::hash<std::string_view>()(name);
+    res = res * RES_MULT + std::hash<int>()(year);
     return res;
 }
 
@@ -25,16 +37,38 @@ bool sp_movie_equal(const sp_movie& m1,const sp_movie& m2){
 }
 
 Movie::Movie(const std::string& name, int year) // constructor
+    : _own_name(name), _name(_own_name), _year(year)
 {
-  _name = name;
-  _year = year;
+}
+
+Movie::Movie(interned_name name, int year) : _name(name.name), _year(year)
+{
+}
+
+Movie::Movie(const Movie& other) : _own_name(other._own_name),
+                                   _year(other._year)
+{
+  bool owned = other._name.data() == other._own_name.data();
+  _name = owned ? std::string_view(_own_name) : other._name;
+}
+
+Movie& Movie::operator=(const Movie& other)
+{
+  if (this != &other)
+  {
+    bool owned = other._name.data() == other._own_name.data();
+    _own_name = other._own_name;
+    _name = owned ? std::string_view(_own_name) : other._name;
+    _year = other._year;
+  }
+  return *this;
 }
 
 /**
  * returns the name of the movie.
- * @return std::string - name
+ * @return std::string_view - name
  */
-std::string Movie::get_name() const
+std::string_view Movie::get_name() const
 {
   return _name;
 }
@@ -81,4 +115,4 @@ std::ostream& operator<<(std::ostream& os, const Movie& movie)
   os << movie.get_name() << " (" << movie.get_year() << ") " << std::endl;
   os << movie.get_name() << " (" << movie.get_year() << ") " << std::endl;
   return os;
-}
\ No newline at end of file
+}
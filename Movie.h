@@ -5,6 +5,8 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <string>
+#include <string_view>
 
 #define HASH_START 17
 
@@ -18,12 +20,23 @@ typedef std::shared_ptr<Movie> sp_movie; // define your smart pointer
 typedef std::size_t (*hash_func)(const sp_movie& movie);
 typedef bool (*equal_func)(const sp_movie& m1,const sp_movie& m2);
 std::size_t sp_movie_hash(const sp_movie& movie);
+std::size_t movie_hash(std::string_view name, int year);
 bool sp_movie_equal(const sp_movie& m1,const sp_movie& m2);
 
+/**
+ * a movie name that lives in a string pool (see MonotonicArena::intern)
+ * rather than in the Movie. the pool must outlive every Movie built from it.
+ */
+struct interned_name
+{
+  std::string_view name;
+};
+
 class Movie
 {
  private:
-  std::string _name;
+  std::string _own_name; // the name, unless it is interned
+  std::string_view _name; // _own_name or the interned name
   int _year;
 
  public:
@@ -35,11 +48,26 @@ class Movie
      */
     Movie(const std::string& name, int year);
 
+    /**
+     * constructor for a movie whose name is not copied. such a movie owns
+     * nothing, so its destructor has nothing to free and may be skipped
+     * (see MonotonicArena::create_untracked)
+     * @param name: name of movie, in a string pool
+     * @param year: year it was made
+     */
+    Movie(interned_name name, int year);
+
+    /**
+     * copies own a copy of an owned name and share an interned one
+     */
+    Movie(const Movie& other);
+    Movie& operator=(const Movie& other);
+
     /**
      * returns the name of the movie
-     * @return const ref to name of movie
+     * @return view of the name of movie, valid as long as the movie
      */
-    std::string get_name() const;
+    std::string_view get_name() const;
 
     /**
      * returns the year the movie was made
@@ -0,0 +1,381 @@
+#include "MovieCatalog.h"
+#include "SimilarityKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#define DIMENSION_ERROR "ERROR: all movies must have the same number of " \
+                        "features."
+#define DUPLICATE_ERROR "ERROR: a movie appears more than once."
+#define MIN_INDEX_SLOTS 16
+#define MAX_LOAD_FACTOR_INV 2 // keep at least half of the slots empty
+#define UINT8_LEVELS 255.0
+#define RESERVED_NAME_BYTES 16 // expected name length of a reserved movie
+
+MovieCatalog::MovieCatalog () : _arena (std::make_shared<MonotonicArena> ()),
+                                _num_features (0), _rows_version (0),
+                                _slots (MIN_INDEX_SLOTS, INVALID_MOVIE_ID),
+                                _mapped_features (nullptr),
+                                _mapped_norms (nullptr),
+                                _precision (feature_precision::DOUBLE)
+{
+}
+
+/**
+ * probes the index for a movie. _slots.size() is a power of two and is
+ * never full, so the probe always ends on either the movie or an empty slot.
+ * @param name std::string_view
+ * @param year int
+ * @param hash movie_hash(name, year)
+ * @return the slot holding the movie, or the empty slot where it would go
+ */
+std::size_t MovieCatalog::find_slot (std::string_view name, int year,
+                                     std::size_t hash) const
+{
+  std::size_t mask = _slots.size () - 1;
+  std::size_t slot = hash & mask;
+  while (_slots[slot] != INVALID_MOVIE_ID)
+  {
+    movie_id id = _slots[slot];
+    if (_hashes[id] == hash && _movies[id]->get_year () == year
+        && _movies[id]->get_name () == name)
+    {
+      break;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+/**
+ * doubles the number of slots and re-inserts every movie by its cached hash.
+ */
+void MovieCatalog::grow_index ()
+{
+  std::vector<movie_id> slots (_slots.size () * 2, INVALID_MOVIE_ID);
+  std::size_t mask = slots.size () - 1;
+  for (movie_id id = 0; id < _hashes.size (); id++)
+  {
+    std::size_t slot = _hashes[id] & mask;
+    while (slots[slot] != INVALID_MOVIE_ID)
+    {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = id;
+  }
+  _slots.swap (slots);
+}
+
+/**
+ * copies borrowed rows and norms into the catalog's own buffers, so they
+ * can be changed. does nothing if the catalog already owns them.
+ */
+void MovieCatalog::own_rows ()
+{
+  if (_mapped_features == nullptr)
+  {
+    return;
+  }
+  _features.assign (_mapped_features,
+                    _mapped_features + _movies.size () * _num_features);
+  _norms.assign (_mapped_norms, _mapped_norms + _movies.size ());
+  _mapped_features = nullptr;
+  _mapped_norms = nullptr;
+  _owner.reset ();
+}
+
+/**
+ * builds a movie and interns its name in the arena. the movie owns nothing,
+ * so the arena keeps no destructor record for it.
+ * @param name std::string_view
+ * @param year int
+ * @return sp_movie sharing ownership of the arena
+ */
+sp_movie MovieCatalog::new_movie (std::string_view name, int year)
+{
+  Movie *movie = _arena->create_untracked<Movie>
+      (interned_name {_arena->intern (name)}, year);
+  return sp_movie (_arena, movie);
+}
+
+/**
+ * interns a movie: a new movie gets the next free id and its features are
+ * appended as a new row of the buffer. the first movie decides the number
+ * of features for the whole catalog.
+ * @param name const std::string reference
+ * @param year int
+ * @param features const std::vector<double> reference
+ * @return movie_id of the (new or existing) movie
+ */
+movie_id MovieCatalog::add_movie (const std::string& name, int year,
+                                  const std::vector<double>& features)
+noexcept (false)
+{
+  if (_movies.empty ())
+  {
+    _num_features = features.size ();
+  }
+  else if (features.size () != _num_features)
+  {
+    throw std::runtime_error (DIMENSION_ERROR);
+  }
+  own_rows ();
+  std::size_t hash = movie_hash (name, year);
+  std::size_t slot = find_slot (name, year, hash);
+  double norm = SimilarityKernels::calc_norm (features.data (),
+                                              features.size ());
+  if (_slots[slot] != INVALID_MOVIE_ID) // known movie - overwrite its row
+  {
+    auto row = _features.begin () + _slots[slot] * _num_features;
+    if (!std::equal (features.begin (), features.end (), row))
+    {
+      std::copy (features.begin (), features.end (), row);
+      _norms[_slots[slot]] = norm;
+      encode_row (_slots[slot]);
+      _rows_version++;
+    }
+    return _slots[slot];
+  }
+  auto id = static_cast<movie_id>(_movies.size ());
+  _movies.push_back (new_movie (name, year));
+  _features.insert (_features.end (), features.begin (), features.end ());
+  _norms.push_back (norm);
+  _years.push_back (year);
+  _hashes.push_back (hash);
+  _slots[slot] = id;
+  if (_movies.size () * MAX_LOAD_FACTOR_INV > _slots.size ())
+  {
+    grow_index ();
+  }
+  encode_row (id);
+  return id;
+}
+
+void MovieCatalog::reserve (std::size_t num_movies, std::size_t num_features)
+{
+  own_rows ();
+  _movies.reserve (num_movies);
+  std::size_t new_movies = num_movies - std::min (num_movies, _movies.size ());
+  _arena->reserve (new_movies * (sizeof (Movie) + alignof (Movie)
+                                 + RESERVED_NAME_BYTES));
+  _features.reserve (num_movies * num_features);
+  _norms.reserve (num_movies);
+  _years.reserve (num_movies);
+  _hashes.reserve (num_movies);
+  while (num_movies * MAX_LOAD_FACTOR_INV > _slots.size ())
+  {
+    grow_index ();
+  }
+}
+
+/**
+ * rebuilds the movies, years and index from the keys; the rows themselves
+ * are only pointed to.
+ */
+void MovieCatalog::assign_rows (const std::vector<movie_key>& movies,
+                                std::size_t num_features,
+                                const double *features, const double *norms,
+                                std::shared_ptr<const void> owner)
+{
+  _movies.clear ();
+  _features.clear ();
+  _norms.clear ();
+  _years.clear ();
+  _hashes.clear ();
+  _slots.assign (MIN_INDEX_SLOTS, INVALID_MOVIE_ID);
+  // the old movies may still be shared, so they keep the old arena:
+  _arena = std::make_shared<MonotonicArena> ();
+  std::size_t name_bytes = 0;
+  for (const auto& key : movies)
+  {
+    name_bytes += key.name.size ();
+  }
+  _arena->reserve (movies.size () * (sizeof (Movie) + alignof (Movie))
+                   + name_bytes);
+  _movies.reserve (movies.size ());
+  _years.reserve (movies.size ());
+  _hashes.reserve (movies.size ());
+  while (movies.size () * MAX_LOAD_FACTOR_INV > _slots.size ())
+  {
+    _slots.assign (_slots.size () * 2, INVALID_MOVIE_ID);
+  }
+  for (const auto& key : movies)
+  {
+    std::size_t hash = movie_hash (key.name, key.year);
+    std::size_t slot = find_slot (key.name, key.year, hash);
+    if (_slots[slot] != INVALID_MOVIE_ID)
+    {
+      throw std::runtime_error (DUPLICATE_ERROR);
+    }
+    _slots[slot] = static_cast<movie_id>(_movies.size ());
+    _movies.push_back (new_movie (key.name, key.year));
+    _years.push_back (key.year);
+    _hashes.push_back (hash);
+  }
+  _num_features = num_features;
+  _rows_version++;
+  _mapped_features = features;
+  _mapped_norms = norms;
+  _owner = std::move (owner);
+  set_precision (_precision);
+}
+
+/**
+ * writes row <id> at the catalog's precision, appending it if it is new.
+ * a quantized row maps its own minimum to 0 and its maximum to 255, so the
+ * error of every feature is at most half a step of (max - min) / 255.
+ * @param id movie_id
+ */
+void MovieCatalog::encode_row (movie_id id)
+{
+  if (_precision == feature_precision::DOUBLE)
+  {
+    return;
+  }
+  const double *row = get_features (id);
+  std::size_t begin = id * _num_features;
+  double norm_sqr = 0.0;
+  if (_reduced_norms.size () <= id)
+  {
+    _reduced_norms.resize (id + 1);
+  }
+  if (_precision == feature_precision::FLOAT)
+  {
+    _float_features.resize (std::max (_float_features.size (),
+                                      begin + _num_features));
+    for (std::size_t i = 0; i < _num_features; i++)
+    {
+      _float_features[begin + i] = static_cast<float>(row[i]);
+      double value = _float_features[begin + i];
+      norm_sqr += value * value;
+    }
+  }
+  else
+  {
+    _uint8_features.resize (std::max (_uint8_features.size (),
+                                      begin + _num_features));
+    _scales.resize (_reduced_norms.size ());
+    _offsets.resize (_reduced_norms.size ());
+    auto range = std::minmax_element (row, row + _num_features);
+    double offset = _num_features > 0 ? *range.first : 0.0;
+    double scale = _num_features > 0 ? (*range.second - offset)
+                                       / UINT8_LEVELS : 0.0;
+    for (std::size_t i = 0; i < _num_features; i++)
+    {
+      double level = scale > 0.0 ? std::round ((row[i] - offset) / scale)
+                                 : 0.0;
+      _uint8_features[begin + i] = static_cast<std::uint8_t>(level);
+      double value = offset + scale * level;
+      norm_sqr += value * value;
+    }
+    _scales[id] = scale;
+    _offsets[id] = offset;
+  }
+  _reduced_norms[id] = std::sqrt (norm_sqr);
+}
+
+void MovieCatalog::set_precision (feature_precision precision)
+{
+  _precision = precision;
+  _float_features.clear ();
+  _uint8_features.clear ();
+  _scales.clear ();
+  _offsets.clear ();
+  _reduced_norms.clear ();
+  for (movie_id id = 0; id < _movies.size (); id++)
+  {
+    encode_row (id);
+  }
+}
+
+feature_precision MovieCatalog::get_precision () const
+{
+  return _precision;
+}
+
+void MovieCatalog::score_rows (const double *query, double query_norm,
+                               movie_id first, std::size_t num_rows,
+                               double *scores, bool exact) const
+{
+  std::size_t begin = first * _num_features;
+  if (exact || _precision == feature_precision::DOUBLE)
+  {
+    SimilarityKernels::score_block (query, query_norm, get_features (first),
+                                    get_norms (first), num_rows,
+                                    _num_features, scores);
+  }
+  else if (_precision == feature_precision::FLOAT)
+  {
+    SimilarityKernels::score_block (query, query_norm,
+                                    _float_features.data () + begin,
+                                    _reduced_norms.data () + first, num_rows,
+                                    _num_features, scores);
+  }
+  else
+  {
+    SimilarityKernels::score_block (query, query_norm,
+                                    _uint8_features.data () + begin,
+                                    _scales.data () + first,
+                                    _offsets.data () + first,
+                                    _reduced_norms.data () + first, num_rows,
+                                    _num_features, scores);
+  }
+}
+
+movie_id MovieCatalog::get_id (std::string_view name, int year) const
+{
+  return _slots[find_slot (name, year, movie_hash (name, year))];
+}
+
+movie_id MovieCatalog::get_id (const sp_movie& movie) const
+{
+  return get_id (movie->get_name (), movie->get_year ());
+}
+
+const sp_movie& MovieCatalog::get_movie (movie_id id) const
+{
+  return _movies[id];
+}
+
+const double *MovieCatalog::get_features (movie_id id) const
+{
+  if (_mapped_features != nullptr)
+  {
+    return _mapped_features + id * _num_features;
+  }
+  return _features.data () + id * _num_features;
+}
+
+double MovieCatalog::get_norm (movie_id id) const
+{
+  return *get_norms (id);
+}
+
+int MovieCatalog::get_year (movie_id id) const
+{
+  return _years[id];
+}
+
+const double *MovieCatalog::get_norms (movie_id id) const
+{
+  if (_mapped_norms != nullptr)
+  {
+    return _mapped_norms + id;
+  }
+  return _norms.data () + id;
+}
+
+std::size_t MovieCatalog::get_num_movies () const
+{
+  return _movies.size ();
+}
+
+std::size_t MovieCatalog::get_num_features () const
+{
+  return _num_features;
+}
+
+std::uint64_t MovieCatalog::get_rows_version () const
+{
+  return _rows_version;
+}
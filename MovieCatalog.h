@@ -0,0 +1,243 @@
+#ifndef MOVIECATALOG_H
+#define MOVIECATALOG_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "AlignedAllocator.h"
+#include "MonotonicArena.h"
+#include "Movie.h"
+
+typedef std::uint32_t movie_id; // dense index of a movie inside the catalog
+typedef std::vector<double, AlignedAllocator<double>> feature_buffer;
+typedef std::vector<float, AlignedAllocator<float>> float_buffer;
+typedef std::vector<std::uint8_t, AlignedAllocator<std::uint8_t>>
+    quantized_buffer;
+
+#define INVALID_MOVIE_ID UINT32_MAX
+#define MIN_FEATURE 1.0
+#define MAX_FEATURE 10.0
+
+/**
+ * the one rule for a movie's feature, shared by the movies file and by
+ * snapshots
+ * @param feature double
+ * @return true if feature is from MIN_FEATURE to MAX_FEATURE (so not NaN)
+ */
+inline bool is_valid_feature (double feature)
+{
+  return feature >= MIN_FEATURE && feature <= MAX_FEATURE;
+}
+
+/**
+ * how the catalog keeps the copy of the feature rows the content scan reads
+ */
+enum class feature_precision
+{
+  DOUBLE, // the rows themselves, no copy
+  FLOAT, // rounded to float
+  UINT8 // one byte per feature, scaled and offset per row
+};
+
+/**
+ * a name/year pair used to look a movie up without allocating a Movie.
+ * the name is only borrowed and must outlive the lookup.
+ */
+struct movie_key
+{
+  std::string_view name;
+  int year;
+};
+
+/**
+ * the set of movies known to a RecommenderSystem.
+ * every movie is interned to a dense id on insertion, and the features of
+ * all movies are kept row-major in one contiguous aligned buffer, so row
+ * <id> starts at get_features(id) and is get_num_features() doubles long.
+ * the norm of every row is computed once on insertion and kept beside it.
+ * the rows and norms may also be borrowed from memory the catalog does not
+ * own (see assign_rows); they are then copied on the first change.
+ * the rows are always kept as double. with a reduced precision (see
+ * set_precision) the catalog also keeps a narrower copy of them, which
+ * score_rows reads instead, moving 2 (float) or 8 (uint8) times fewer bytes
+ * per scanned movie. the double rows are not dropped then: cf predictions,
+ * user profiles, the item neighbors, exact rescoring (score_rows with exact)
+ * and snapshots all read them, so a reduced precision saves bandwidth in
+ * the content scan and costs the memory of the narrower copy.
+ * the movies and their names are carved out of one MonotonicArena rather
+ * than allocated one by one: every sp_movie aliases the arena's shared
+ * pointer, so there is no control block per movie, and a movie handed out
+ * keeps the whole arena alive. copies of a catalog share the arena.
+ * the price is that every copy of any sp_movie of the catalog changes the
+ * same reference count, so threads copying movies at once contend on one
+ * cache line. the read paths of RecommenderSystem work on ids and on
+ * references to _movies, and only copy a sp_movie for each movie they
+ * return (see RecommenderSystem::recommend_top_n_ids for none at all).
+ */
+class MovieCatalog
+{
+ private:
+  std::vector<sp_movie> _movies; // id -> movie, in _arena
+  std::shared_ptr<MonotonicArena> _arena; // the movies and their names
+  feature_buffer _features; // _movies.size() rows of _num_features
+  std::vector<double> _norms; // _norms[id] is the norm of row <id>
+  std::vector<int> _years; // _years[id] is the year of movie <id>
+  std::size_t _num_features;
+  std::uint64_t _rows_version; // see get_rows_version
+  // name/year -> id index: open addressing with linear probing over
+  // _slots, keyed by movie_hash(). _hashes[id] caches the hash of every
+  // movie so growing the index never rehashes strings.
+  std::vector<movie_id> _slots;
+  std::vector<std::size_t> _hashes;
+  // borrowed rows and norms, used instead of _features and _norms while
+  // _mapped_features is set. _owner keeps their memory alive.
+  std::shared_ptr<const void> _owner;
+  const double *_mapped_features;
+  const double *_mapped_norms;
+  feature_precision _precision;
+  float_buffer _float_features; // the rows as float, with FLOAT
+  quantized_buffer _uint8_features; // the rows as bytes, with UINT8
+  std::vector<double> _scales; // UINT8: row <id> is _offsets[id] +
+  std::vector<double> _offsets; // _scales[id] * _uint8_features row <id>
+  std::vector<double> _reduced_norms; // norms of the narrower rows
+
+  std::size_t find_slot (std::string_view name, int year,
+                         std::size_t hash) const;
+  void grow_index ();
+  void own_rows ();
+  sp_movie new_movie (std::string_view name, int year);
+  void encode_row (movie_id id);
+
+ public:
+  MovieCatalog ();
+
+  /**
+   * adds a movie to the catalog, or overwrites the features of a movie with
+   * the same name and year.
+   * @param name name of movie
+   * @param year year it was made
+   * @param features features for movie, must match the catalog dimension
+   * @return the id of the movie
+   */
+  movie_id add_movie (const std::string& name, int year,
+                      const std::vector<double>& features) noexcept (false);
+
+  /**
+   * makes room for a number of movies, so adding them does not reallocate
+   * @param num_movies expected number of movies
+   * @param num_features expected number of features of each movie
+   */
+  void reserve (std::size_t num_movies, std::size_t num_features);
+
+  /**
+   * replaces the whole catalog with movies whose rows and norms live in
+   * memory owned by someone else (e.g. a mapped snapshot file), without
+   * copying the rows. the memory is read-only for the catalog; it is copied
+   * into the catalog's own buffers on the first add_movie or reserve.
+   * @param movies name and year of every movie, by id; the names are
+   * copied
+   * @param num_features number of features of each movie
+   * @param features movies.size() rows of num_features, aligned to
+   * CACHE_LINE_SIZE
+   * @param norms the norm of every row
+   * @param owner keeps features and norms alive while the catalog uses them
+   */
+  void assign_rows (const std::vector<movie_key>& movies,
+                    std::size_t num_features, const double *features,
+                    const double *norms, std::shared_ptr<const void> owner);
+
+  /**
+   * sets the precision of the rows the content scan reads, and encodes
+   * every row for it. later movies are encoded as they are added.
+   * @param precision feature_precision
+   */
+  void set_precision (feature_precision precision);
+
+  /**
+   * @return the precision score_rows reads the rows at
+   */
+  feature_precision get_precision () const;
+
+  /**
+   * scores a query against consecutive rows, see
+   * SimilarityKernels::score_block. the rows are read at the catalog's
+   * precision, unless exact is set.
+   * @param query first element of the query vector
+   * @param query_norm norm of the query vector
+   * @param first id of the first row
+   * @param num_rows number of rows
+   * @param scores output, scores[r] is the similarity of row first + r
+   * @param exact true to read the double rows whatever the precision is
+   */
+  void score_rows (const double *query, double query_norm, movie_id first,
+                   std::size_t num_rows, double *scores,
+                   bool exact = false) const;
+
+  /**
+   * looks up the id of a movie by its name and year, in constant time and
+   * without allocating
+   * @param name name of movie
+   * @param year year it was made
+   * @return the movie's id, or INVALID_MOVIE_ID if it is not in the catalog
+   */
+  movie_id get_id (std::string_view name, int year) const;
+
+  /**
+   * looks up the id of a movie by its name and year
+   * @param movie movie to look for (compared by value, not by pointer)
+   * @return the movie's id, or INVALID_MOVIE_ID if it is not in the catalog
+   */
+  movie_id get_id (const sp_movie& movie) const;
+
+  /**
+   * @param id id of a movie in the catalog
+   * @return shared pointer to the movie
+   */
+  const sp_movie& get_movie (movie_id id) const;
+
+  /**
+   * @param id id of a movie in the catalog
+   * @return pointer to the first feature of the movie's row
+   */
+  const double *get_features (movie_id id) const;
+
+  /**
+   * @param id id of a movie in the catalog
+   * @return the euclidean norm of the movie's features
+   */
+  double get_norm (movie_id id) const;
+
+  /**
+   * @param id id of a movie in the catalog
+   * @return the year the movie was made, without touching the Movie
+   */
+  int get_year (movie_id id) const;
+
+  /**
+   * @param id id of a movie in the catalog
+   * @return pointer to the norm of the movie; the norms of consecutive ids
+   * are consecutive
+   */
+  const double *get_norms (movie_id id) const;
+
+  /**
+   * @return number of movies in the catalog
+   */
+  std::size_t get_num_movies () const;
+
+  /**
+   * @return number of features of each movie
+   */
+  std::size_t get_num_features () const;
+
+  /**
+   * @return a number that changes whenever the row of a movie already in
+   * the catalog changes (adding movies leaves it as is), so anything
+   * computed from rows can tell it is stale
+   */
+  std::uint64_t get_rows_version () const;
+};
+
+#endif //MOVIECATALOG_H
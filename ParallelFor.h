@@ -0,0 +1,212 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#define PARALLEL_MIN_WORK 65536 // rows scored below which one thread is used
+
+/**
+ * @param n_threads requested number of threads, 0 for one per hardware
+ * thread
+ * @return the number of threads to actually run
+ */
+inline unsigned resolve_num_threads (unsigned n_threads)
+{
+  if (n_threads == 0)
+  {
+    n_threads = std::max (1u, std::thread::hardware_concurrency ());
+  }
+  return n_threads;
+}
+
+/**
+ * @param n_threads requested number of threads, 0 for one per hardware
+ * thread
+ * @param work rows a call will score
+ * @return n_threads, or 1 if the work is too small to pay for starting
+ * threads (e.g. adding a single movie)
+ */
+inline unsigned threads_for_work (unsigned n_threads, std::size_t work)
+{
+  return work < PARALLEL_MIN_WORK ? 1 : n_threads;
+}
+
+/**
+ * splits [begin, end) into one contiguous range per thread and runs
+ * func(first, last) on each range in parallel. the calling thread runs the
+ * first range. the first exception thrown by any range is rethrown here,
+ * after every thread has finished.
+ * @param begin first index
+ * @param end one past the last index
+ * @param n_threads number of threads, 0 for one per hardware thread
+ * @param func callable as func(std::size_t first, std::size_t last)
+ */
+template <typename Func>
+void parallel_for (std::size_t begin, std::size_t end, unsigned n_threads,
+                   Func func)
+{
+  if (begin >= end)
+  {
+    return;
+  }
+  std::size_t total = end - begin;
+  std::size_t n_ranges = std::min<std::size_t> (resolve_num_threads
+                                                    (n_threads), total);
+  std::vector<std::exception_ptr> errors (n_ranges);
+  auto run = [&] (std::size_t range)
+  {
+    std::size_t first = begin + total * range / n_ranges;
+    std::size_t last = begin + total * (range + 1) / n_ranges;
+    try
+    {
+      func (first, last);
+    }
+    catch (...)
+    {
+      errors[range] = std::current_exception ();
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve (n_ranges - 1);
+  for (std::size_t range = 1; range < n_ranges; range++)
+  {
+    threads.emplace_back (run, range);
+  }
+  run (0);
+  for (auto& thread : threads)
+  {
+    thread.join ();
+  }
+  for (const auto& error : errors)
+  {
+    if (error)
+    {
+      std::rethrow_exception (error);
+    }
+  }
+}
+
+/**
+ * runs func(index, worker) for every index in [begin, end) on n_threads
+ * workers, with work stealing: every worker starts with a contiguous share
+ * of the indices and takes them one by one from the front; a worker whose
+ * share runs out steals the back half of the largest remaining share. this
+ * keeps all threads busy when some indices cost much more than others.
+ * worker is in [0, number of workers) and is only ever used by one thread
+ * at a time, so it can index per-thread scratch buffers. the first
+ * exception thrown by any call is rethrown here, after every thread has
+ * finished.
+ * @param begin first index
+ * @param end one past the last index, at most begin + UINT32_MAX
+ * @param n_threads number of threads, 0 for one per hardware thread
+ * @param func callable as func(std::size_t index, unsigned worker)
+ */
+template <typename Func>
+void parallel_for_each (std::size_t begin, std::size_t end,
+                        unsigned n_threads, Func func)
+{
+  if (begin >= end)
+  {
+    return;
+  }
+  std::size_t total = end - begin;
+  auto n_workers = static_cast<unsigned>(std::min<std::size_t>
+      (resolve_num_threads (n_threads), total));
+  // the share of each worker, as (first << 32 | last) offsets from begin,
+  // so the owner and the thieves update both ends with one CAS
+  std::vector<std::atomic<std::uint64_t>> shares (n_workers);
+  auto pack = [] (std::uint64_t first, std::uint64_t last)
+  {
+    return first << 32 | last;
+  };
+  for (unsigned worker = 0; worker < n_workers; worker++)
+  {
+    shares[worker].store (pack (total * worker / n_workers,
+                                total * (worker + 1) / n_workers));
+  }
+  std::vector<std::exception_ptr> errors (n_workers);
+  auto steal = [&] (unsigned thief)
+  {
+    while (true)
+    {
+      unsigned victim = thief;
+      std::uint64_t largest = 0;
+      std::uint64_t seen = 0;
+      for (unsigned worker = 0; worker < n_workers; worker++)
+      {
+        std::uint64_t share = shares[worker].load ();
+        std::uint64_t size = (share & UINT32_MAX) - std::min (
+            share >> 32, share & UINT32_MAX);
+        if (worker != thief && size > largest)
+        {
+          largest = size;
+          victim = worker;
+          seen = share;
+        }
+      }
+      if (largest == 0)
+      {
+        return false; // no work left anywhere
+      }
+      std::uint64_t first = seen >> 32;
+      std::uint64_t last = seen & UINT32_MAX;
+      std::uint64_t middle = last - (last - first + 1) / 2;
+      if (shares[victim].compare_exchange_strong (seen, pack (first,
+                                                               middle)))
+      {
+        shares[thief].store (pack (middle, last));
+        return true;
+      }
+    }
+  };
+  auto run = [&] (unsigned worker)
+  {
+    try
+    {
+      do
+      {
+        std::uint64_t share = shares[worker].load ();
+        while ((share >> 32) < (share & UINT32_MAX))
+        {
+          if (shares[worker].compare_exchange_weak
+              (share, pack ((share >> 32) + 1, share & UINT32_MAX)))
+          {
+            func (begin + (share >> 32), worker);
+            share = shares[worker].load ();
+          }
+        }
+      }
+      while (steal (worker));
+    }
+    catch (...)
+    {
+      errors[worker] = std::current_exception ();
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve (n_workers - 1);
+  for (unsigned worker = 1; worker < n_workers; worker++)
+  {
+    threads.emplace_back (run, worker);
+  }
+  run (0);
+  for (auto& thread : threads)
+  {
+    thread.join ();
+  }
+  for (const auto& error : errors)
+  {
+    if (error)
+    {
+      std::rethrow_exception (error);
+    }
+  }
+}
+
+#endif //PARALLELFOR_H
@@ -0,0 +1,48 @@
+#ifndef PARSEUTILS_H
+#define PARSEUTILS_H
+
+#include <cstring>
+
+#define NEWLINE '\n'
+
+/**
+ * small helpers for tokenizing text files in place, shared by the loaders
+ */
+
+/**
+ * @param c char
+ * @return true for the characters that separate words in a line (the
+ * files may have windows line endings, so '\r' is one of them)
+ */
+inline bool is_blank (char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * @param pos first char to look at
+ * @param end end of the line
+ * @return the first non blank char in [pos, end), or end
+ */
+inline const char *skip_blanks (const char *pos, const char *end)
+{
+  while (pos < end && is_blank (*pos))
+  {
+    pos++;
+  }
+  return pos;
+}
+
+/**
+ * @param pos first char of a line
+ * @param end end of the text
+ * @return the newline that ends the line, or end for the last line
+ */
+inline const char *find_line_end (const char *pos, const char *end)
+{
+  auto line_end = static_cast<const char *>(std::memchr (pos, NEWLINE,
+                                                         end - pos));
+  return line_end == nullptr ? end : line_end;
+}
+
+#endif //PARSEUTILS_H
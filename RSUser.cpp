@@ -2,13 +2,67 @@
 // don't change those includes
 #include "RSUser.h"
 #include "RecommenderSystem.h"
+#include <atomic>
+
+#define UNKNOWN_MOVIE_ERROR "ERROR: a rated movie is not in the system."
+#define NO_RATINGS_ERROR "ERROR: every user must rate at least one movie."
+#define RATE_ERROR "ERROR: every rating must be NA or a whole number from 1 " \
+                   "to 10."
+
+/**
+ * @return a ratings version no user had before, see get_ratings_version
+ */
+static std::uint64_t next_ratings_version()
+{
+  static std::atomic<std::uint64_t> last(0);
+  return ++last;
+}
 
 RSUser::RSUser(std::string username, rank_map ranks,
                std::shared_ptr<RecommenderSystem> rs)
 {
   _username = username;
-  _ranks = ranks;
   _rs = rs;
+  std::vector<rating_entry> entries;
+  for (const auto& elem : ranks)
+  {
+    if (elem.second == 0) // 0 used to mean NA - keep rated movies only
+    {
+      continue;
+    }
+    if (!is_valid_rate(elem.second))
+    {
+      throw std::runtime_error(RATE_ERROR);
+    }
+    movie_id id = elem.first == nullptr ? INVALID_MOVIE_ID
+                                        : _rs->get_movie_id(elem.first);
+    if (id == INVALID_MOVIE_ID)
+    {
+      throw std::runtime_error(UNKNOWN_MOVIE_ERROR);
+    }
+    entries.emplace_back(id, elem.second);
+  }
+  if (entries.empty())
+  {
+    throw std::runtime_error(NO_RATINGS_ERROR);
+  }
+  _ratings = UserRatings(std::move(entries));
+  _profile = UserProfile(_ratings.get_view(), *_rs->get_catalog());
+  _ratings_version = next_ratings_version();
+}
+
+RSUser::RSUser(std::string username, UserRatings ratings,
+               std::shared_ptr<RecommenderSystem> rs, MonotonicArena *arena)
+    : _username(std::move(username)), _ratings(std::move(ratings)),
+      _profile(_ratings.get_view(), *rs->get_catalog(), arena),
+      _rs(std::move(rs)),
+      _ratings_version(next_ratings_version())
+{
+}
+
+std::uint64_t RSUser::get_ratings_version() const
+{
+  return _ratings_version;
 }
 
 std::string RSUser::get_name() const
@@ -20,8 +74,81 @@ void RSUser::add_movie_to_rs(const std::string &name, int year,
                      const std::vector<double> &features,
                      double rate)
 {
+  if (!is_valid_rate(rate))
+  {
+    throw std::runtime_error(RATE_ERROR);
+  }
+  // add_movie may throw, so the profile is only changed once it is done:
   std::shared_ptr<Movie> new_movie = _rs->add_movie(name, year, features);
-  _ranks[new_movie] = rate;
+  std::shared_ptr<const MovieCatalog> catalog = _rs->get_catalog();
+  set_rate(*catalog, catalog->get_id(new_movie), rate);
+}
+
+/**
+ * rates a movie of catalog and brings the profile up to date: in a single
+ * pass over the movie's features, or from scratch if a row of the catalog
+ * changed since the profile was built, since the sums then hold features
+ * the rated movies no longer have.
+ * @param catalog the current catalog
+ * @param id id of the movie in catalog
+ * @param rate the user rate for this movie
+ */
+void RSUser::set_rate(const MovieCatalog& catalog, movie_id id, double rate)
+{
+  const double *old_rate = _ratings.find_rate(id);
+  if (!_profile.is_current(catalog))
+  {
+    _ratings.set_rate(id, rate);
+    _profile = UserProfile(_ratings.get_view(), catalog);
+  }
+  else if (old_rate != nullptr)
+  {
+    _profile.change_rating(catalog.get_features(id),
+                           catalog.get_num_features(), *old_rate, rate);
+    _ratings.set_rate(id, rate);
+  }
+  else
+  {
+    _profile.add_rating(catalog.get_features(id), catalog.get_num_features(),
+                        rate);
+    _ratings.set_rate(id, rate);
+  }
+  _ratings_version = next_ratings_version();
+}
+
+bool RSUser::rate_movie(movie_id id, double rate)
+{
+  std::shared_ptr<const MovieCatalog> catalog = _rs->get_catalog();
+  if (id >= catalog->get_num_movies() || !is_valid_rate(rate))
+  {
+    return false;
+  }
+  set_rate(*catalog, id, rate);
+  return true;
+}
+
+bool RSUser::remove_rating(movie_id id)
+{
+  const double *old_rate = _ratings.find_rate(id);
+  // a user keeps at least one rating, so its mean is always defined:
+  if (old_rate == nullptr || _ratings.get_size() == 1)
+  {
+    return false;
+  }
+  std::shared_ptr<const MovieCatalog> catalog = _rs->get_catalog();
+  if (_profile.is_current(*catalog))
+  {
+    _profile.remove_rating(catalog->get_features(id),
+                           catalog->get_num_features(), *old_rate);
+    _ratings.remove_rate(id);
+  }
+  else // a row changed - see set_rate
+  {
+    _ratings.remove_rate(id);
+    _profile = UserProfile(_ratings.get_view(), *catalog);
+  }
+  _ratings_version = next_ratings_version();
+  return true;
 }
 
 sp_movie RSUser::get_recommendation_by_content () const
@@ -30,15 +157,46 @@ sp_movie RSUser::get_recommendation_by_content () const
 }
 
 double RSUser::get_prediction_score_for_movie(const std::string& name, int
-year, int k) const
+year, int k, cf_mode mode) const
 {
   sp_movie new_movie = _rs->get_movie(name, year);
-  return _rs->predict_movie_score(*this, new_movie, k);
+  return _rs->predict_movie_score(*this, new_movie, k, mode);
+}
+
+sp_movie RSUser::get_recommendation_by_cf(int k, cf_mode mode) const
+{
+  return this->_rs->recommend_by_cf(*this, k, mode);
 }
 
-sp_movie RSUser::get_recommendation_by_cf(int k) const
+std::vector<scored_movie> RSUser::get_top_n_by_content
+(std::size_t n, const movie_filter& filter) const
 {
-  return this->_rs->recommend_by_cf(*this, k);
+  return _rs->recommend_top_n(*this, n, recommend_mode::CONTENT, 0, filter);
+}
+
+std::vector<scored_movie> RSUser::get_top_n_by_cf
+(std::size_t n, int k, const movie_filter& filter, cf_mode mode) const
+{
+  return _rs->recommend_top_n(*this, n,
+                              RecommenderSystem::to_recommend_mode(mode), k,
+                              filter);
+}
+
+sp_movie RSUser::get_recommendation_by_factors() const
+{
+  return _rs->recommend_by_factors(*this);
+}
+
+std::vector<scored_movie> RSUser::get_top_n_by_factors
+(std::size_t n, const movie_filter& filter) const
+{
+  return _rs->recommend_top_n(*this, n, recommend_mode::FACTORS, 0, filter);
+}
+
+double RSUser::get_prediction_score_by_factors(const std::string& name,
+                                               int year) const
+{
+  return _rs->predict_factor_score(*this, _rs->get_movie(name, year));
 }
 
 std::ostream& operator<<(std::ostream& os, RSUser& user) // todo
@@ -50,5 +208,25 @@ std::ostream& operator<<(std::ostream& os, RSUser& user) // todo
 
 rank_map RSUser::get_ranks () const
 {
-  return _ranks;
-}
\ No newline at end of file
+  rank_map ranks(_ratings.get_size(), sp_movie_hash, sp_movie_equal);
+  for (const auto& elem : _ratings.get_view())
+  {
+    ranks[_rs->get_movie(elem.first)] = elem.second;
+  }
+  return ranks;
+}
+
+RatingsView RSUser::get_ratings () const
+{
+  return _ratings.get_view();
+}
+
+const UserProfile& RSUser::get_profile () const
+{
+  return _profile;
+}
+
+const std::shared_ptr<RecommenderSystem>& RSUser::get_system() const
+{
+  return _rs;
+}
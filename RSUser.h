@@ -5,7 +5,12 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <cstdint>
 #include "Movie.h"
+#include "UserRatings.h"
+#include "UserProfile.h"
+#include "ItemNeighbors.h"
+#include "Recommendation.h"
 
 class RecommenderSystem;
 typedef std::unordered_map<sp_movie, double, hash_func, equal_func> rank_map;
@@ -15,17 +20,36 @@ class RSUser
 
  private:
   std::string _username;
-  rank_map _ranks;
+  UserRatings _ratings; // only the movies the user rated
+  UserProfile _profile; // mean and preference vector of _ratings
   std::shared_ptr<RecommenderSystem> _rs;
+  std::uint64_t _ratings_version; // new for every change of _ratings
+
+  void set_rate(const MovieCatalog& catalog, movie_id id, double rate);
 
  public:
 	/**
-	 * Constructor for the class
+	 * Constructor for the class. throws if a rated movie is not in rs, if a
+	 * rank other than 0 (NA) is not a valid rate (see is_valid_rate), or if
+	 * no movie is rated
 	 */
 	// TODO RSUser() this constructor can be implemented however you want
     RSUser (std::string username, rank_map ranks,
             std::shared_ptr<RecommenderSystem> rs); // constructor
 
+	/**
+	 * Constructor from an already built sparse row of ratings, which must
+	 * hold at least one rating, of movies in rs (see RSUsersLoader)
+	 * @param username the user's name
+	 * @param ratings the movies the user rated, by their id in rs
+	 * @param rs the system the movie ids belong to
+	 * @param arena if not null, the user's profile is carved out of it; one
+	 * of rs's arenas (see RecommenderSystem::make_arena)
+	 */
+    RSUser (std::string username, UserRatings ratings,
+            std::shared_ptr<RecommenderSystem> rs,
+            MonotonicArena *arena = nullptr);
+
 	/**
 	 * a getter for the user's name
 	 * @return the username
@@ -37,19 +61,68 @@ class RSUser
 	 * @param name name of movie
      * @param year year it was made
 	 * @param features a vector of the movie's features
-	 * @param rate the user rate for this movie
+	 * @param rate the user rate for this movie; throws if it is not valid
+	 * (see is_valid_rate)
 	 */
 	void add_movie_to_rs(const std::string &name, int year,
                          const std::vector<double> &features,
                          double rate);
 
+	/**
+	 * rates a movie already in the system, or changes its rate if the user
+	 * already rated it. the profile is updated in a single pass over the
+	 * movie's features.
+	 * @param id id of the movie in the system
+	 * @param rate the user rate for this movie
+	 * @return false if the system has no movie with this id, or the rate is
+	 * not valid (see is_valid_rate)
+	 */
+	bool rate_movie(movie_id id, double rate);
+
+	/**
+	 * takes back the user's rating of a movie. the last rating of a user
+	 * is never taken back, so every user has a mean rate
+	 * @param id id of the movie in the system
+	 * @return false if the user did not rate the movie, or it is the user's
+	 * only rating
+	 */
+	bool remove_rating(movie_id id);
 
     /**
-     * a getter for the ranks map
+     * a getter for the ranks map, built from the rated movies only (unrated
+     * movies are not in the map). this builds a new hash map on every call -
+     * prefer get_ratings() on any hot path.
      * @return
      */
     rank_map get_ranks() const;
 
+    /**
+     * a read-only view of the user's ratings, without copying them
+     * @return the rated movies by id, valid until the user's ratings change
+     */
+    RatingsView get_ratings() const;
+
+    /**
+     * the user's mean rate and preference vector, kept up to date as
+     * ratings are added. its preference is stale once a rated movie's
+     * features change, until the user's next rating (see
+     * UserProfile::is_current)
+     * @return the user's profile
+     */
+    const UserProfile& get_profile() const;
+
+    /**
+     * @return a number that changes whenever the user's ratings change and
+     * is never shared by users with different ratings; it keys the
+     * RecommenderSystem result cache
+     */
+    std::uint64_t get_ratings_version() const;
+
+    /**
+     * @return the system the user's ratings refer to
+     */
+    const std::shared_ptr<RecommenderSystem>& get_system() const;
+
 	/**
 	 * returns a recommendation according to the movie's content
 	 * @return recommendation
@@ -60,9 +133,65 @@ class RSUser
 	 * returns a recommendation according to the similarity
 	 * recommendation method
 	 * @param k the number of the most similar movies to calculate by
+	 * @param mode how to find the most similar movies, see cf_mode
+	 * @return recommendation
+	 */
+	sp_movie get_recommendation_by_cf(int k,
+                                      cf_mode mode = cf_mode::EXACT) const;
+
+	/**
+	 * returns a recommendation according to the latent factor model
+	 * (see RecommenderSystem::train_factors)
 	 * @return recommendation
 	 */
-	sp_movie get_recommendation_by_cf(int k) const;
+	sp_movie get_recommendation_by_factors() const;
+
+	/**
+	 * returns the n best recommendations according to the latent factor
+	 * model
+	 * @param n number of recommendations
+	 * @param filter movies that may not be recommended
+	 * @return up to n (movie, score) pairs, best first
+	 */
+	std::vector<scored_movie> get_top_n_by_factors(std::size_t n,
+                                                   const movie_filter&
+                                                   filter = movie_filter())
+                                                   const;
+
+	/**
+	 * predicts the score for a given movie with the latent factor model
+	 * @param name the name of the movie
+	 * @param year the year the movie was created
+	 * @return predicted score for the given movie
+	 */
+	double get_prediction_score_by_factors(const std::string& name,
+                                           int year) const;
+
+	/**
+	 * returns the n best recommendations according to the movie's content
+	 * @param n number of recommendations
+	 * @param filter movies that may not be recommended
+	 * @return up to n (movie, score) pairs, best first
+	 */
+	std::vector<scored_movie> get_top_n_by_content(std::size_t n,
+                                                   const movie_filter&
+                                                   filter = movie_filter())
+                                                   const;
+
+	/**
+	 * returns the n best recommendations according to the similarity
+	 * recommendation method
+	 * @param n number of recommendations
+	 * @param k the number of the most similar movies to calculate by
+	 * @param filter movies that may not be recommended
+	 * @param mode how to find the most similar movies, see cf_mode
+	 * @return up to n (movie, score) pairs, best first
+	 */
+	std::vector<scored_movie> get_top_n_by_cf(std::size_t n, int k,
+                                              const movie_filter& filter =
+                                                  movie_filter(),
+                                              cf_mode mode = cf_mode::EXACT)
+                                              const;
 
 	/**
 	 * predicts the score for a given movie
@@ -70,10 +199,13 @@ class RSUser
 	 * @param year the year the movie was created
 	 * @param k the parameter which represents the number of the most similar
 	 * movies to predict the score by
+	 * @param mode how to find the most similar movies, see cf_mode
 	 * @return predicted score for the given movie
 	 */
 	double get_prediction_score_for_movie(const std::string& name,
-                                          int year, int k) const;
+                                          int year, int k,
+                                          cf_mode mode = cf_mode::EXACT)
+                                          const;
 
 	/**
 	 * output stream operator
@@ -1,78 +1,225 @@
 #include "RSUsersLoader.h"
 #include "RecommenderSystem.h"
 #include "RSUser.h"
-#include <fstream>
-#include <sstream>
+#include "MappedFile.h"
+#include "ParallelFor.h"
+#include "ParseUtils.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <charconv>
+#include <iterator>
 
 #define INVALID_PATH_ERROR "ERROR: given file is invalid."
+#define HEADER_ERROR "ERROR: expected <movie_name>-<year> in the header."
+#define UNKNOWN_MOVIE_ERROR "ERROR: a rated movie is not in the system."
+#define DUPLICATE_MOVIE_ERROR "ERROR: a movie appears more than once."
+#define ROW_LENGTH_ERROR "ERROR: every user must have one rating or NA per " \
+                         "movie."
+#define RATING_ERROR "ERROR: every rating must be NA or a whole number " \
+                     "from 1 to 10."
+#define NO_RATINGS_ERROR "ERROR: every user must rate at least one movie."
+#define DUPLICATE_USER_ERROR "ERROR: a user appears more than once."
 #define HYPHEN '-'
 #define NA "NA"
-#define ZERO 0.0
+#define CHUNKS_PER_THREAD 4
 
-void RSUsersLoader::get_users(const std::string& str,
-                              const std::vector<Movie>& movies_vector,
+/**
+ * parses every user line in [begin, end) and appends the users to
+ * users_vector in the order of the lines, and their names, as views of the
+ * line, to names. the rows of ratings and the profiles are carved out of
+ * one arena of the system, and every user is built in place. a line must
+ * have exactly one cell per movie of the header, and a user must rate at
+ * least one movie.
+ */
+void RSUsersLoader::get_users(const char *begin, const char *end,
+                              const std::vector<movie_id>& movies_vector,
                               std::vector<RSUser>& users_vector,
-                              std::shared_ptr<RecommenderSystem> rs)
+                              std::vector<std::string_view>& names,
+                              const std::shared_ptr<RecommenderSystem>& rs)
 {
-  int i = 0;
-  double cur_ranking;
- std::string cur_user, cur_word;
- rank_map user_rankings(0, sp_movie_hash, sp_movie_equal);
- sp_movie cur_movie_ptr;
- std::stringstream str_stream(str);
- str_stream >> cur_user;
- while (str_stream >> cur_word)
- {
-   if (cur_word != NA)
-   {
-     cur_ranking = std::stoi(cur_word);
-   }
-   else
-   {
-     cur_ranking = ZERO;
-   }
-   cur_movie_ptr = rs->get_movie(movies_vector[i].get_name(),
-                                 movies_vector[i].get_year());
-   user_rankings[cur_movie_ptr] = cur_ranking;
-   i++;
- }
- users_vector.push_back((RSUser) {cur_user, user_rankings, rs});
+  MonotonicArena& arena = rs->make_arena ();
+  std::vector<rating_entry> user_rankings; // rated movies only
+  const char *pos = begin;
+  while (pos < end)
+  {
+    const char *line_end = find_line_end (pos, end);
+    const char *cur = skip_blanks (pos, line_end);
+    pos = line_end + 1;
+    if (cur == line_end) // blank line
+    {
+      continue;
+    }
+    const char *word_end = std::find_if (cur, line_end, is_blank);
+    std::string cur_user (cur, word_end);
+    names.emplace_back (cur, word_end - cur);
+    user_rankings.clear ();
+    std::size_t i = 0;
+    cur = skip_blanks (word_end, line_end);
+    while (cur < line_end)
+    {
+      if (i == movies_vector.size ()) // a cell past the header
+      {
+        throw std::runtime_error (ROW_LENGTH_ERROR);
+      }
+      word_end = std::find_if (cur, line_end, is_blank);
+      if (std::string_view (cur, word_end - cur) != NA)
+      {
+        double cur_ranking;
+        auto res = std::from_chars (cur, word_end, cur_ranking);
+        if (res.ec != std::errc () || res.ptr != word_end
+            || !is_valid_rate (cur_ranking))
+        {
+          throw std::runtime_error (RATING_ERROR);
+        }
+        user_rankings.emplace_back (movies_vector[i], cur_ranking);
+      }
+      i++;
+      cur = skip_blanks (word_end, line_end);
+    }
+    if (i != movies_vector.size ())
+    {
+      throw std::runtime_error (ROW_LENGTH_ERROR);
+    }
+    if (user_rankings.empty ())
+    {
+      throw std::runtime_error (NO_RATINGS_ERROR);
+    }
+    RS_METRICS_COUNT (RATINGS_LOADED, user_rankings.size ());
+    users_vector.emplace_back (std::move (cur_user),
+                               UserRatings (user_rankings, arena), rs,
+                               &arena);
+  }
 }
 
-void RSUsersLoader::get_movies(std::string& str,
-                               std::vector<Movie>& movies_vector)
+std::vector<movie_key> RSUsersLoader::get_movies(const char *begin,
+                                                 const char *end)
 {
-  unsigned long long hyphen;
-  int cur_year;
-  sp_movie cur_movie_ptr;
-  std::stringstream str_stream(str);
-  std::string cur_movie_name, cur_word;
-  while (str_stream >> cur_word)
+  std::vector<movie_key> movies_vector;
+  const char *cur = skip_blanks (begin, end);
+  while (cur < end)
   {
-    hyphen = cur_word.find(HYPHEN);
-    cur_movie_name = cur_word.substr(0, hyphen);
-    cur_word.erase(0, hyphen + sizeof(HYPHEN));
-    cur_year = std::stoi(cur_word);
-    movies_vector.push_back((Movie){cur_movie_name, cur_year});
+    const char *word_end = std::find_if (cur, end, is_blank);
+    const char *hyphen = std::find (cur, word_end, HYPHEN);
+    int cur_year;
+    auto year_res = std::from_chars (hyphen + 1, word_end, cur_year);
+    if (hyphen == word_end || year_res.ec != std::errc ()
+        || year_res.ptr != word_end)
+    {
+      throw std::runtime_error (HEADER_ERROR);
+    }
+    movies_vector.push_back ({std::string_view (cur, hyphen - cur),
+                              cur_year});
+    cur = skip_blanks (word_end, end);
   }
+  return movies_vector;
 }
 
+/**
+ * checks that every movie of the header is in the catalog, once
+ * @param movie_ids ids of the header's movies
+ * @param num_movies number of movies in the catalog
+ */
+void RSUsersLoader::check_header(const std::vector<movie_id>& movie_ids,
+                                 std::size_t num_movies)
+{
+  std::vector<bool> seen (num_movies, false);
+  for (movie_id id : movie_ids)
+  {
+    if (id == INVALID_MOVIE_ID)
+    {
+      throw std::runtime_error (UNKNOWN_MOVIE_ERROR);
+    }
+    if (seen[id])
+    {
+      throw std::runtime_error (DUPLICATE_MOVIE_ERROR);
+    }
+    seen[id] = true;
+  }
+}
+
+/**
+ * maps the file, resolves the header to the system's movies once, and
+ * splits the rest of the file into chunks that end on a newline. the
+ * chunks are parsed in parallel, each into its own vector of users, and
+ * the vectors are then moved into the result in chunk order, so users keep
+ * the order of the file. there are a few chunks per thread, so a chunk of
+ * long lines does not leave the other threads idle. the header and every
+ * line are validated while they are parsed, so the users hold only ids of
+ * the catalog and rates in range.
+ */
 std::vector<RSUser> RSUsersLoader::create_users_from_file(const std::string&
-users_file_path, std::shared_ptr<RecommenderSystem> rs) noexcept(false)
+users_file_path, std::shared_ptr<RecommenderSystem> rs, unsigned n_threads)
+noexcept(false)
 {
-  std::ifstream user_file (users_file_path);
-  if (!user_file)
+  RS_METRICS_TIME (LOAD_USERS);
+  MappedFile user_file (users_file_path);
+  if (!user_file.is_open ())
   {
     throw std::runtime_error (INVALID_PATH_ERROR);
   }
-  std::string line;
-  std::getline (user_file, line);
-  std::vector<Movie> movies_vector;
   std::vector<RSUser> users_vector;
-  get_movies (line, movies_vector);
-  while (std::getline (user_file, line))
+  if (user_file.get_size () == 0)
+  {
+    return users_vector;
+  }
+  const char *pos = user_file.get_data ();
+  const char *end = pos + user_file.get_size ();
+  const char *header_end = find_line_end (pos, end);
+  std::vector<movie_id> movie_ids = rs->get_movie_ids (get_movies
+      (pos, header_end));
+  check_header (movie_ids, rs->get_catalog ()->get_num_movies ());
+  pos = std::min (header_end + 1, end);
+
+  n_threads = resolve_num_threads (n_threads);
+  std::size_t body_size = end - pos;
+  std::size_t num_chunks = std::max<std::size_t> (1, std::min<std::size_t>
+      (n_threads * CHUNKS_PER_THREAD, body_size));
+  // chunk c is [bounds[c], bounds[c + 1]), each bound right after a newline:
+  std::vector<const char *> bounds (num_chunks + 1, end);
+  bounds[0] = pos;
+  for (std::size_t c = 1; c < num_chunks; c++)
+  {
+    const char *bound = std::max (bounds[c - 1], pos + body_size * c
+                                                      / num_chunks);
+    if (bound > pos && bound < end && *(bound - 1) != NEWLINE)
+    {
+      bound = find_line_end (bound, end);
+      bound = std::min (bound + 1, end);
+    }
+    bounds[c] = bound;
+  }
+  std::vector<std::vector<RSUser>> chunk_users (num_chunks);
+  std::vector<std::vector<std::string_view>> chunk_names (num_chunks);
+  parallel_for_each (0, num_chunks, n_threads,
+                     [&] (std::size_t c, unsigned)
+                     {
+                       get_users (bounds[c], bounds[c + 1], movie_ids,
+                                  chunk_users[c], chunk_names[c], rs);
+                     });
+  std::size_t num_users = 0;
+  for (const auto& users : chunk_users)
+  {
+    num_users += users.size ();
+  }
+  // sorting views of the file finds a repeated name with no allocation
+  // per user:
+  std::vector<std::string_view> names;
+  names.reserve (num_users);
+  for (const auto& cur_names : chunk_names)
+  {
+    names.insert (names.end (), cur_names.begin (), cur_names.end ());
+  }
+  std::sort (names.begin (), names.end ());
+  if (std::adjacent_find (names.begin (), names.end ()) != names.end ())
+  {
+    throw std::runtime_error (DUPLICATE_USER_ERROR);
+  }
+  users_vector.reserve (num_users);
+  for (auto& users : chunk_users)
   {
-    get_users (line, movies_vector, users_vector, rs);
+    std::move (users.begin (), users.end (),
+               std::back_inserter (users_vector));
   }
+  RS_METRICS_COUNT (USERS_LOADED, num_users);
   return users_vector;
 }
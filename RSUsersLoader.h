@@ -7,25 +7,37 @@
 class RSUsersLoader
 {
 private:
-  static void get_users(const std::string& str,
-            const std::vector<Movie>& movies_vector,
+  static void get_users(const char *begin, const char *end,
+            const std::vector<movie_id>& movies_vector,
             std::vector<RSUser>& users_vector,
-            std::shared_ptr<RecommenderSystem> rs);
-  static void get_movies(std::string& str, std::vector<Movie>& movies_vector);
+            std::vector<std::string_view>& names,
+            const std::shared_ptr<RecommenderSystem>& rs);
+  static std::vector<movie_key> get_movies(const char *begin,
+                                           const char *end);
+  static void check_header(const std::vector<movie_id>& movie_ids,
+                           std::size_t num_movies);
 
 public:
     RSUsersLoader() = delete;
     /**
      *
-     * loads users by the given format with their movie's ranks
+     * loads users by the given format with their movie's ranks.
+     * throws if a movie of the header is not in rs or appears twice, if a
+     * line does not have exactly one rating or NA per movie, if a rating is
+     * not a whole number from 1 to 10 (see is_valid_rate), or if a user
+     * rates no movie or appears twice.
      * @param users_file_path a path to the file of the users and their movie
      * ranks
      * @param rs RecommendingSystem for the Users
-     * @return vector of the users created according to the file
+     * @param n_threads number of threads parsing the users, 0 for one per
+     * hardware thread
+     * @return vector of the users created according to the file, in file
+     * order
      */
     static std::vector<RSUser> create_users_from_file
     (const std::string& users_file_path,
-     std::shared_ptr<RecommenderSystem> rs) noexcept(false);
+     std::shared_ptr<RecommenderSystem> rs,
+     unsigned n_threads = 0) noexcept(false);
 };
 
 #endif //SCHOOL_SOLUTION_USERFACTORY_H
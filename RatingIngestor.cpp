@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include "RatingIngestor.h"
+#include "RecommenderSystem.h"
+#include "ParallelFor.h"
+
+/**
+ * the changed users are handed to their systems in one call per system,
+ * in the order of their groups.
+ */
+void RatingIngestor::update_models (const std::vector<RSUser>& users,
+                                    const rating_event *first,
+                                    const std::vector<std::size_t>& order,
+                                    const std::vector<std::size_t>& groups,
+                                    const std::vector<char>& changed)
+{
+  std::vector<std::pair<RecommenderSystem *, std::vector<const RSUser *>>>
+      systems;
+  for (std::size_t group = 0; group < changed.size (); group++)
+  {
+    if (!changed[group])
+    {
+      continue;
+    }
+    const RSUser& user = users[first[order[groups[group]]].user];
+    RecommenderSystem *rs = user.get_system ().get ();
+    auto it = std::find_if (systems.begin (), systems.end (),
+                            [rs] (const auto& elem)
+                            { return elem.first == rs; });
+    if (it == systems.end ())
+    {
+      systems.emplace_back (rs, std::vector<const RSUser *> ());
+      it = systems.end () - 1;
+    }
+    it->second.push_back (&user);
+  }
+  for (const auto& elem : systems)
+  {
+    elem.first->update_user_neighbors (elem.second);
+  }
+}
+
+ingest_stats RatingIngestor::apply (std::vector<RSUser>& users,
+                                    const rating_event *first,
+                                    const rating_event *last,
+                                    unsigned n_threads)
+{
+  auto num_events = static_cast<std::size_t>(last - first);
+  // group the events by user, keeping the arrival order within each user
+  std::vector<std::size_t> order (num_events);
+  std::iota (order.begin (), order.end (), 0);
+  std::stable_sort (order.begin (), order.end (),
+                    [first] (std::size_t a, std::size_t b)
+                    { return first[a].user < first[b].user; });
+  std::vector<std::size_t> groups; // start of every user's events in order
+  for (std::size_t i = 0; i < num_events; i++)
+  {
+    if (i == 0 || first[order[i]].user != first[order[i - 1]].user)
+    {
+      groups.push_back (i);
+    }
+  }
+  groups.push_back (num_events);
+
+  std::vector<ingest_stats> worker_stats (resolve_num_threads (n_threads));
+  std::vector<char> changed (groups.size () - 1, 0); // per group
+  parallel_for_each (0, groups.size () - 1, n_threads,
+                     [&] (std::size_t group, unsigned worker)
+  {
+    ingest_stats& stats = worker_stats[worker];
+    std::size_t user_index = first[order[groups[group]]].user;
+    if (user_index >= users.size ())
+    {
+      stats.rejected += groups[group + 1] - groups[group];
+      return;
+    }
+    RSUser& user = users[user_index];
+    for (std::size_t i = groups[group]; i < groups[group + 1]; i++)
+    {
+      const rating_event& event = first[order[i]];
+      bool applied;
+      if (event.action == rating_action::REMOVE)
+      {
+        applied = user.remove_rating (event.movie);
+      }
+      else
+      {
+        applied = user.rate_movie (event.movie, event.rate);
+      }
+      (applied ? stats.applied : stats.rejected)++;
+      changed[group] |= applied;
+    }
+  });
+  update_models (users, first, order, groups, changed);
+
+  ingest_stats total;
+  for (const ingest_stats& stats : worker_stats)
+  {
+    total.applied += stats.applied;
+    total.rejected += stats.rejected;
+  }
+  return total;
+}
+
+ingest_stats RatingIngestor::apply_batch (std::vector<RSUser>& users,
+                                          const std::vector<rating_event>&
+                                          events, unsigned n_threads)
+{
+  return apply (users, events.data (), events.data () + events.size (),
+                n_threads);
+}
+
+replay_report RatingIngestor::replay (std::vector<RSUser>& users,
+                                      const std::vector<rating_event>& events,
+                                      std::size_t batch_size,
+                                      unsigned n_threads)
+{
+  if (batch_size == 0)
+  {
+    batch_size = std::max<std::size_t> (events.size (), 1);
+  }
+  replay_report report;
+  auto start = std::chrono::steady_clock::now ();
+  for (std::size_t begin = 0; begin < events.size (); begin += batch_size)
+  {
+    std::size_t end = std::min (begin + batch_size, events.size ());
+    ingest_stats stats = apply (users, events.data () + begin,
+                                events.data () + end, n_threads);
+    report.stats.applied += stats.applied;
+    report.stats.rejected += stats.rejected;
+    report.num_batches++;
+  }
+  report.seconds = std::chrono::duration<double> (
+      std::chrono::steady_clock::now () - start).count ();
+  if (report.seconds > 0)
+  {
+    report.events_per_second = static_cast<double>(events.size ())
+                               / report.seconds;
+  }
+  return report;
+}
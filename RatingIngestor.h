@@ -0,0 +1,102 @@
+#ifndef RATINGINGESTOR_H
+#define RATINGINGESTOR_H
+
+#include <vector>
+#include "RSUser.h"
+
+/**
+ * what a rating event does to the user's rating of the movie
+ */
+enum class rating_action
+{
+  UPSERT, // rates the movie, or changes the rate if it was already rated
+  REMOVE  // takes back the rating, rate is ignored
+};
+
+/**
+ * one rating of a stream of ratings
+ */
+struct rating_event
+{
+  std::size_t user; // index of the user in the ingested users
+  movie_id movie;
+  double rate;
+  rating_action action;
+};
+
+/**
+ * what happened to the events of a batch
+ */
+struct ingest_stats
+{
+  std::size_t applied = 0;
+  std::size_t rejected = 0; // unknown user or movie, an invalid rate (see
+                            // is_valid_rate), or removing a rating that is
+                            // not there or is the user's last
+};
+
+/**
+ * the throughput of RatingIngestor::replay
+ */
+struct replay_report
+{
+  ingest_stats stats;
+  std::size_t num_batches = 0;
+  double seconds = 0.0;
+  double events_per_second = 0.0;
+};
+
+/**
+ * applies streams of rating events to users, keeping their ratings and
+ * profiles current without rebuilding them: every event costs one pass over
+ * the movie's features.
+ * the events of a batch are grouped by user and every user's events are
+ * applied in the order they appear in the batch, so a re-rating or a
+ * removal always sees the ratings before it. different users are updated
+ * in parallel. the users may not be used by other threads during a batch.
+ * after every batch, the user-user model of each system the changed users
+ * belong to is brought up to date with their ratings, in one new version
+ * per batch (see RecommenderSystem::update_user_neighbors).
+ */
+class RatingIngestor
+{
+ private:
+  static ingest_stats apply (std::vector<RSUser>& users,
+                             const rating_event *first,
+                             const rating_event *last, unsigned n_threads);
+  static void update_models (const std::vector<RSUser>& users,
+                             const rating_event *first,
+                             const std::vector<std::size_t>& order,
+                             const std::vector<std::size_t>& groups,
+                             const std::vector<char>& changed);
+
+ public:
+  RatingIngestor () = delete;
+
+  /**
+   * applies a batch of events
+   * @param users the users the events refer to by index
+   * @param events the batch, in arrival order
+   * @param n_threads number of threads, 0 for one per hardware thread
+   * @return how many events were applied and rejected
+   */
+  static ingest_stats apply_batch (std::vector<RSUser>& users,
+                                   const std::vector<rating_event>& events,
+                                   unsigned n_threads = 0);
+
+  /**
+   * applies a recorded stream of events in batches of batch_size and times
+   * it
+   * @param users the users the events refer to by index
+   * @param events the stream, in arrival order
+   * @param batch_size events per batch, 0 for a single batch
+   * @param n_threads number of threads, 0 for one per hardware thread
+   * @return the applied and rejected events and the events per second
+   */
+  static replay_report replay (std::vector<RSUser>& users,
+                               const std::vector<rating_event>& events,
+                               std::size_t batch_size,
+                               unsigned n_threads = 0);
+};
+
+#endif //RATINGINGESTOR_H
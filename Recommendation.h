@@ -0,0 +1,65 @@
+#ifndef RECOMMENDATION_H
+#define RECOMMENDATION_H
+
+#include <climits>
+#include <cstdint>
+#include <unordered_set>
+#include <utility>
+#include "MovieCatalog.h"
+
+typedef std::pair<sp_movie, double> scored_movie; // movie, score
+typedef std::pair<movie_id, double> scored_id; // movie, score
+
+#define INVALID_USER SIZE_MAX // index of a user a model does not know
+
+/**
+ * the algorithm a top-n recommendation scores movies with
+ */
+enum class recommend_mode
+{
+  CONTENT, // similarity to the user's preference vector
+  CONTENT_ANN, // same, over the lists a ContentIndex probes (approximate)
+  CF, // item cf prediction, exact
+  CF_NEIGHBORS, // item cf prediction over the precomputed neighbor lists
+  CF_USERS, // user-user cf prediction, see UserNeighbors
+  FACTORS // latent factor prediction, see FactorModel
+};
+
+/**
+ * restricts the movies a top-n recommendation may return. movies are
+ * filtered while scanning, before they are scored.
+ */
+struct movie_filter
+{
+  int min_year = INT_MIN; // inclusive
+  int max_year = INT_MAX; // inclusive
+  std::unordered_set<movie_id> excluded; // never recommended
+
+  /**
+   * @param id id of a movie
+   * @param year year the movie was made
+   * @return true if the movie may be recommended
+   */
+  bool accepts (movie_id id, int year) const
+  {
+    return year >= min_year && year <= max_year
+           && (excluded.empty () || excluded.count (id) == 0);
+  }
+};
+
+/**
+ * how far content recommendations at a reduced feature_precision are from
+ * the ones over the double rows, see RecommenderSystem::report_precision
+ */
+struct precision_report
+{
+  std::size_t num_users = 0; // users compared
+  double max_score_error = 0.0; // largest |reduced - exact| score of a
+                                // recommended movie
+  std::size_t max_rank_shift = 0; // largest move of a recommended movie
+                                  // between the two top n lists (n if it
+                                  // is missing from the exact one)
+  std::size_t changed_top_1 = 0; // users whose best movie changed
+};
+
+#endif //RECOMMENDATION_H
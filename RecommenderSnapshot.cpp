@@ -0,0 +1,466 @@
+#include "RecommenderSnapshot.h"
+#include "RecommenderSystemLoader.h"
+#include "RSUsersLoader.h"
+#include "MappedFile.h"
+#include "ParallelFor.h"
+#include "SimilarityKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#define INVALID_PATH_ERROR "ERROR: given file is invalid."
+#define WRITE_ERROR "ERROR: could not write the snapshot."
+#define SNAPSHOT_FORMAT_ERROR "ERROR: not a valid snapshot file."
+#define SNAPSHOT_VERSION_ERROR "ERROR: unsupported snapshot version."
+#define SNAPSHOT_CHECKSUM_ERROR "ERROR: snapshot checksum mismatch."
+#define SNAPSHOT_MAGIC "RSSNAP\0"
+#define SNAPSHOT_VERSION 1
+#define BYTE_ORDER_MARK 0x01020304u
+#define TMP_SUFFIX ".tmp"
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+#define NORM_TOLERANCE 1e-9 // relative; kernels may sum in another order
+
+namespace
+{
+/**
+ * the sections of a snapshot, in file order
+ */
+enum section
+{
+  MOVIE_NAME_OFFSETS, // uint64 * (movies + 1), into MOVIE_NAMES
+  MOVIE_NAMES, // the names, back to back
+  MOVIE_YEARS, // int32 * movies
+  FEATURES, // double * movies * features, row-major
+  NORMS, // double * movies
+  USER_NAME_OFFSETS, // uint64 * (users + 1), into USER_NAMES
+  USER_NAMES, // the names, back to back
+  RATING_OFFSETS, // uint64 * (users + 1), into RATING_IDS / RATING_RATES
+  RATING_IDS, // movie_id * ratings, sorted within a user
+  RATING_RATES, // double * ratings
+  NUM_SECTIONS
+};
+
+struct section_range
+{
+  std::uint64_t offset; // from the start of the file
+  std::uint64_t size; // in bytes
+};
+
+struct snapshot_header
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order; // BYTE_ORDER_MARK as written by the saver
+  std::uint64_t file_size;
+  std::uint64_t checksum; // of every byte after the header
+  std::uint64_t num_movies;
+  std::uint64_t num_features;
+  std::uint64_t num_users;
+  std::uint64_t num_ratings;
+  section_range sections[NUM_SECTIONS];
+};
+
+/**
+ * 64 bit FNV-1a, continued from hash
+ */
+std::uint64_t fnv1a (const char *data, std::size_t size, std::uint64_t hash)
+{
+  for (std::size_t i = 0; i < size; i++)
+  {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+std::uint64_t align_up (std::uint64_t offset)
+{
+  return (offset + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+/**
+ * writes sections one after the other, each padded to start on a cache
+ * line, and hashes everything it writes
+ */
+class section_writer
+{
+ private:
+  std::ofstream& _out;
+  std::uint64_t _offset;
+  std::uint64_t _checksum;
+
+  void write (const char *data, std::size_t size)
+  {
+    _out.write (data, static_cast<std::streamsize>(size));
+    _checksum = fnv1a (data, size, _checksum);
+    _offset += size;
+  }
+
+ public:
+  section_writer (std::ofstream& out, std::uint64_t offset)
+      : _out (out), _offset (offset), _checksum (FNV_OFFSET_BASIS)
+  {
+  }
+
+  section_range begin_section ()
+  {
+    static const char padding[CACHE_LINE_SIZE] = {};
+    write (padding, align_up (_offset) - _offset);
+    return {_offset, 0};
+  }
+
+  void append (section_range& range, const void *data, std::size_t size)
+  {
+    write (static_cast<const char *>(data), size);
+    range.size += size;
+  }
+
+  template <typename T>
+  section_range write_section (const std::vector<T>& values)
+  {
+    section_range range = begin_section ();
+    append (range, values.data (), values.size () * sizeof (T));
+    return range;
+  }
+
+  std::uint64_t get_offset () const
+  {
+    return _offset;
+  }
+
+  std::uint64_t get_checksum () const
+  {
+    return _checksum;
+  }
+};
+
+/**
+ * @return pointer to the first element of a section, after checking it is
+ * aligned, inside the file and holds count elements
+ */
+template <typename T>
+const T *get_section (const MappedFile& file, const snapshot_header& header,
+                      section index, std::uint64_t count)
+{
+  const section_range& range = header.sections[index];
+  if (range.offset % CACHE_LINE_SIZE != 0 || range.offset > file.get_size ()
+      || range.size > file.get_size () - range.offset
+      || range.size != count * sizeof (T))
+  {
+    throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+  }
+  return reinterpret_cast<const T *>(file.get_data () + range.offset);
+}
+
+/**
+ * @return the count + 1 offsets of a section, checked to be increasing and
+ * to end at limit
+ */
+const std::uint64_t *get_offsets (const MappedFile& file,
+                                  const snapshot_header& header,
+                                  section index, std::uint64_t count,
+                                  std::uint64_t limit)
+{
+  auto offsets = get_section<std::uint64_t> (file, header, index, count + 1);
+  for (std::uint64_t i = 0; i < count; i++)
+  {
+    if (offsets[i] > offsets[i + 1])
+    {
+      throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+    }
+  }
+  if (offsets[0] != 0 || offsets[count] != limit)
+  {
+    throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+  }
+  return offsets;
+}
+}
+
+/**
+ * the header is written last, over a placeholder, once the checksum and
+ * the sections are known.
+ */
+void RecommenderSnapshot::save_snapshot (const std::string& path,
+                                         const RecommenderSystem& rs,
+                                         const std::vector<RSUser>& users)
+noexcept (false)
+{
+  std::shared_ptr<const MovieCatalog> pinned = rs.get_catalog ();
+  const MovieCatalog& catalog = *pinned;
+  std::string tmp_path = path + TMP_SUFFIX;
+  std::ofstream out (tmp_path, std::ios::binary | std::ios::trunc);
+  if (!out)
+  {
+    throw std::runtime_error (INVALID_PATH_ERROR);
+  }
+  snapshot_header header{};
+  std::memcpy (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.num_movies = catalog.get_num_movies ();
+  header.num_features = catalog.get_num_features ();
+  header.num_users = users.size ();
+  out.write (reinterpret_cast<const char *>(&header), sizeof (header));
+  section_writer writer (out, sizeof (header));
+
+  std::vector<std::uint64_t> offsets (1, 0);
+  std::vector<std::int32_t> years;
+  years.reserve (header.num_movies);
+  for (movie_id id = 0; id < header.num_movies; id++)
+  {
+    offsets.push_back (offsets.back ()
+                       + catalog.get_movie (id)->get_name ().size ());
+    years.push_back (catalog.get_year (id));
+  }
+  header.sections[MOVIE_NAME_OFFSETS] = writer.write_section (offsets);
+  header.sections[MOVIE_NAMES] = writer.begin_section ();
+  for (movie_id id = 0; id < header.num_movies; id++)
+  {
+    std::string_view name = catalog.get_movie (id)->get_name ();
+    writer.append (header.sections[MOVIE_NAMES], name.data (), name.size ());
+  }
+  header.sections[MOVIE_YEARS] = writer.write_section (years);
+  // the rows, and the norms, of consecutive ids are contiguous:
+  header.sections[FEATURES] = writer.begin_section ();
+  writer.append (header.sections[FEATURES], catalog.get_features (0),
+                 header.num_movies * header.num_features * sizeof (double));
+  header.sections[NORMS] = writer.begin_section ();
+  writer.append (header.sections[NORMS], catalog.get_norms (0),
+                 header.num_movies * sizeof (double));
+
+  offsets.assign (1, 0);
+  std::vector<std::uint64_t> rating_offsets (1, 0);
+  for (const auto& user : users)
+  {
+    offsets.push_back (offsets.back () + user.get_name ().size ());
+    rating_offsets.push_back (rating_offsets.back ()
+                              + user.get_ratings ().get_size ());
+  }
+  header.num_ratings = rating_offsets.back ();
+  header.sections[USER_NAME_OFFSETS] = writer.write_section (offsets);
+  header.sections[USER_NAMES] = writer.begin_section ();
+  for (const auto& user : users)
+  {
+    std::string name = user.get_name ();
+    writer.append (header.sections[USER_NAMES], name.data (), name.size ());
+  }
+  header.sections[RATING_OFFSETS] = writer.write_section (rating_offsets);
+  header.sections[RATING_IDS] = writer.begin_section ();
+  for (const auto& user : users)
+  {
+    RatingsView ratings = user.get_ratings ();
+    writer.append (header.sections[RATING_IDS], ratings.get_ids (),
+                   ratings.get_size () * sizeof (movie_id));
+  }
+  header.sections[RATING_RATES] = writer.begin_section ();
+  for (const auto& user : users)
+  {
+    RatingsView ratings = user.get_ratings ();
+    writer.append (header.sections[RATING_RATES], ratings.get_rates (),
+                   ratings.get_size () * sizeof (double));
+  }
+
+  header.file_size = writer.get_offset ();
+  header.checksum = writer.get_checksum ();
+  out.seekp (0);
+  out.write (reinterpret_cast<const char *>(&header), sizeof (header));
+  out.close ();
+  if (!out || std::rename (tmp_path.c_str (), path.c_str ()) != 0)
+  {
+    std::remove (tmp_path.c_str ());
+    throw std::runtime_error (WRITE_ERROR);
+  }
+}
+
+/**
+ * validates the header and every section against the file before using
+ * it. the catalog borrows the feature rows and norms from the mapping,
+ * which stays mapped as long as the catalog uses it; the names and the
+ * users' ratings are copied. users are built on several threads, each
+ * range of users into its own vector, merged in order.
+ */
+std::shared_ptr<RecommenderSystem> RecommenderSnapshot::load_snapshot
+    (const std::string& path, std::vector<RSUser>& users,
+     bool verify_checksum, unsigned n_threads) noexcept (false)
+{
+  auto file = std::make_shared<const MappedFile> (path);
+  if (!file->is_open ())
+  {
+    throw std::runtime_error (INVALID_PATH_ERROR);
+  }
+  snapshot_header header{};
+  if (file->get_size () < sizeof (header))
+  {
+    throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+  }
+  std::memcpy (&header, file->get_data (), sizeof (header));
+  if (std::memcmp (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic)) != 0
+      || header.byte_order != BYTE_ORDER_MARK
+      || header.file_size != file->get_size ())
+  {
+    throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+  }
+  if (header.version != SNAPSHOT_VERSION)
+  {
+    throw std::runtime_error (SNAPSHOT_VERSION_ERROR);
+  }
+  if (verify_checksum
+      && fnv1a (file->get_data () + sizeof (header),
+                file->get_size () - sizeof (header), FNV_OFFSET_BASIS)
+         != header.checksum)
+  {
+    throw std::runtime_error (SNAPSHOT_CHECKSUM_ERROR);
+  }
+  // every count is bounded by the file size before it is multiplied:
+  if (header.num_movies > header.file_size
+      || header.num_users > header.file_size
+      || header.num_ratings > header.file_size
+      || (header.num_movies > 0 && header.num_features == 0)
+      || (header.num_features > 0
+          && header.num_movies > header.file_size / header.num_features))
+  {
+    throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+  }
+
+  const MappedFile& mapped = *file;
+  auto movie_name_offsets = get_offsets
+      (mapped, header, MOVIE_NAME_OFFSETS, header.num_movies,
+       header.sections[MOVIE_NAMES].size);
+  auto movie_names = get_section<char> (mapped, header, MOVIE_NAMES,
+                                        header.sections[MOVIE_NAMES].size);
+  auto years = get_section<std::int32_t> (mapped, header, MOVIE_YEARS,
+                                           header.num_movies);
+  auto features = get_section<double> (mapped, header, FEATURES,
+                                       header.num_movies
+                                       * header.num_features);
+  auto norms = get_section<double> (mapped, header, NORMS,
+                                    header.num_movies);
+  // what the movies loader guarantees of every row, whatever the checksum
+  // says, since scoring trusts the rows and their norms:
+  for (std::uint64_t id = 0; id < header.num_movies; id++)
+  {
+    const double *row = features + id * header.num_features;
+    double norm = SimilarityKernels::calc_norm (row, header.num_features);
+    if (!std::all_of (row, row + header.num_features, is_valid_feature)
+        || !(std::abs (norms[id] - norm) <= NORM_TOLERANCE * norm))
+    {
+      throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+    }
+  }
+  std::vector<movie_key> keys;
+  keys.reserve (header.num_movies);
+  for (std::uint64_t id = 0; id < header.num_movies; id++)
+  {
+    keys.push_back ({std::string_view (movie_names + movie_name_offsets[id],
+                                       movie_name_offsets[id + 1]
+                                       - movie_name_offsets[id]),
+                     years[id]});
+  }
+  MovieCatalog catalog;
+  catalog.assign_rows (keys, header.num_features, features, norms, file);
+  auto rs = std::make_shared<RecommenderSystem> (std::move (catalog));
+
+  auto user_name_offsets = get_offsets
+      (mapped, header, USER_NAME_OFFSETS, header.num_users,
+       header.sections[USER_NAMES].size);
+  auto user_names = get_section<char> (mapped, header, USER_NAMES,
+                                       header.sections[USER_NAMES].size);
+  auto rating_offsets = get_offsets (mapped, header, RATING_OFFSETS,
+                                     header.num_users, header.num_ratings);
+  auto rating_ids = get_section<movie_id> (mapped, header, RATING_IDS,
+                                           header.num_ratings);
+  auto rating_rates = get_section<double> (mapped, header, RATING_RATES,
+                                           header.num_ratings);
+  // what the loaders and RSUser guarantee of every user:
+  for (std::uint64_t i = 0; i < header.num_ratings; i++)
+  {
+    if (rating_ids[i] >= header.num_movies
+        || !is_valid_rate (rating_rates[i]))
+    {
+      throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+    }
+  }
+  std::vector<std::string_view> names;
+  names.reserve (header.num_users);
+  for (std::uint64_t user = 0; user < header.num_users; user++)
+  {
+    if (rating_offsets[user] == rating_offsets[user + 1])
+    {
+      throw std::runtime_error (SNAPSHOT_FORMAT_ERROR); // no ratings
+    }
+    names.emplace_back (user_names + user_name_offsets[user],
+                        user_name_offsets[user + 1]
+                        - user_name_offsets[user]);
+  }
+  std::sort (names.begin (), names.end ());
+  if (std::adjacent_find (names.begin (), names.end ()) != names.end ())
+  {
+    throw std::runtime_error (SNAPSHOT_FORMAT_ERROR);
+  }
+
+  std::size_t num_ranges = std::min<std::size_t> (resolve_num_threads
+                                                      (n_threads),
+                                                  header.num_users);
+  std::vector<std::vector<RSUser>> range_users (num_ranges);
+  parallel_for_each (0, num_ranges, n_threads,
+                     [&] (std::size_t range, unsigned)
+                     {
+                       std::size_t first = header.num_users * range
+                                           / num_ranges;
+                       std::size_t last = header.num_users * (range + 1)
+                                          / num_ranges;
+                       range_users[range].reserve (last - first);
+                       MonotonicArena& arena = rs->make_arena ();
+                       // the rows of ratings, and the profiles:
+                       arena.reserve ((rating_offsets[last]
+                                       - rating_offsets[first])
+                                      * (sizeof (movie_id) + sizeof (double))
+                                      + (last - first)
+                                        * (alignof (double) + PROFILE_ROWS
+                                           * header.num_features
+                                           * sizeof (double)));
+                       std::vector<rating_entry> entries;
+                       for (std::size_t user = first; user < last; user++)
+                       {
+                         entries.clear ();
+                         for (std::uint64_t i = rating_offsets[user];
+                              i < rating_offsets[user + 1]; i++)
+                         {
+                           entries.emplace_back (rating_ids[i],
+                                                 rating_rates[i]);
+                         }
+                         std::string name (user_names
+                                           + user_name_offsets[user],
+                                           user_name_offsets[user + 1]
+                                           - user_name_offsets[user]);
+                         range_users[range].emplace_back (
+                             std::move (name), UserRatings (entries, arena),
+                             rs, &arena);
+                       }
+                     });
+  users.reserve (users.size () + header.num_users);
+  for (auto& cur_users : range_users)
+  {
+    std::move (cur_users.begin (), cur_users.end (),
+               std::back_inserter (users));
+  }
+  return rs;
+}
+
+void RecommenderSnapshot::convert_text_files
+    (const std::string& movies_file_path, const std::string& users_file_path,
+     const std::string& snapshot_path) noexcept (false)
+{
+  std::shared_ptr<RecommenderSystem> rs
+      = RecommenderSystemLoader::create_rs_from_movies_file
+          (movies_file_path);
+  std::vector<RSUser> users = RSUsersLoader::create_users_from_file
+      (users_file_path, rs);
+  save_snapshot (snapshot_path, *rs, users);
+}
@@ -0,0 +1,66 @@
+#ifndef RECOMMENDERSNAPSHOT_H
+#define RECOMMENDERSNAPSHOT_H
+
+#include "RecommenderSystem.h"
+
+/**
+ * a binary snapshot of a RecommenderSystem and its users, loaded without
+ * parsing any text.
+ * the file holds the movie table, the feature rows, their norms and the
+ * sparse ratings of every user, each section aligned to CACHE_LINE_SIZE
+ * and stored as the process lays it out in memory (native byte order). the
+ * header has a version and an FNV-1a checksum of the sections. loading
+ * maps the file and the catalog reads the feature rows and norms straight
+ * from the mapping, so processes loading the same snapshot share the
+ * pages.
+ */
+class RecommenderSnapshot
+{
+ public:
+  RecommenderSnapshot () = delete;
+
+  /**
+   * writes a snapshot. the file is written beside path and renamed over it
+   * when complete, so a process mapping the old snapshot is not disturbed.
+   * @param path path of the snapshot file
+   * @param rs the system to save
+   * @param users users of rs; their ratings refer to the movie ids of rs
+   */
+  static void save_snapshot (const std::string& path,
+                             const RecommenderSystem& rs,
+                             const std::vector<RSUser>& users)
+  noexcept (false);
+
+  /**
+   * loads a snapshot written by save_snapshot. throws if the file does not
+   * hold a valid model: a movie twice, a feature that is not valid (see
+   * is_valid_feature), a norm that is not the norm of its row, a rating of
+   * a movie not in it or not a valid rate (see is_valid_rate), or a user
+   * with no ratings or twice. these are checked even if the checksum is not
+   * @param path path of the snapshot file
+   * @param users the users of the snapshot are appended to it, in the
+   * order they were saved
+   * @param verify_checksum false to skip hashing the whole file for the
+   * checksum
+   * @param n_threads number of threads building the users, 0 for one per
+   * hardware thread
+   * @return the system, its feature rows backed by the mapped file
+   */
+  static std::shared_ptr<RecommenderSystem> load_snapshot
+      (const std::string& path, std::vector<RSUser>& users,
+       bool verify_checksum = true, unsigned n_threads = 0) noexcept (false);
+
+  /**
+   * converts the text formats of RecommenderSystemLoader and RSUsersLoader
+   * to a snapshot
+   * @param movies_file_path path of the movies file
+   * @param users_file_path path of the users file
+   * @param snapshot_path path of the snapshot to write
+   */
+  static void convert_text_files (const std::string& movies_file_path,
+                                  const std::string& users_file_path,
+                                  const std::string& snapshot_path)
+  noexcept (false);
+};
+
+#endif //RECOMMENDERSNAPSHOT_H
@@ -1,283 +1,1365 @@
 #include "RecommenderSystem.h"
 #include "RSUser.h"
+#include "SimilarityKernels.h"
+#include "ParallelFor.h"
+#include "Metrics.h"
 #include <cstdlib>
-#include <set>
 #include <algorithm>
 #include <cmath>
+#include <numeric>
+#include <stdexcept>
 
 #define SIMILARITY_LIM -2.0
+#define SCORE_BLOCK_ROWS 256 // rows scored per call of the block kernel
+#define NEIGHBORS_ERROR "ERROR: item neighbors were not built."
+#define CONTENT_INDEX_ERROR "ERROR: content index was not built."
+#define USER_NEIGHBORS_ERROR "ERROR: user neighbors were not built."
+#define FACTORS_ERROR "ERROR: factor model was not trained."
+#define UPDATE_ERROR "ERROR: the update was already committed."
+#define MOVIE_ERROR "ERROR: the movie is not in the system."
+#define STATE_CACHE_SLOTS 4 // systems every thread keeps a version of
 
 /**
- * Calculates the normalized vector of the vector given as a parameter,
- * according to the requested algorithm (subtracts the mean from each index).
- * @param ranks rank_map
- * @return normalized ranks vector
+ * the version of one system a thread read last
  */
-double RecommenderSystem::calc_mean(rank_map ranks_vector) // todo const?
+struct cached_state
 {
-  double sum_ratings = 0;
-  int num_rated = 0;
-  for (auto& movie_data : ranks_vector) // calculate mean:
+  std::uint64_t system = 0; // RecommenderSystem::_id, 0 if unused
+  std::uint64_t version = 0;
+  std::shared_ptr<const system_state> state;
+};
+
+/**
+ * the versions a thread read last. pins nest (a read may start another
+ * read), so a version a pin still points to is never dropped: if it is
+ * replaced while any pin of the thread is alive, it waits in retired until
+ * the outermost one ends.
+ */
+struct state_cache
+{
+  cached_state slots[STATE_CACHE_SLOTS];
+  std::size_t next_slot = 0; // replaced when a system with no slot is read
+  std::size_t num_pins = 0;
+  std::vector<std::shared_ptr<const system_state>> retired;
+};
+
+/**
+ * @return the calling thread's state_cache
+ */
+static state_cache& get_state_cache()
+{
+  thread_local state_cache cache;
+  return cache;
+}
+
+/**
+ * @return a number no other RecommenderSystem of the process has
+ */
+static std::uint64_t next_system_id()
+{
+  static std::atomic<std::uint64_t> next_id(1);
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * pins the current version of a system for the calling thread: the version
+ * stays alive, and unchanged, until the pin is destroyed. the version it
+ * points to may be read by other threads meanwhile (e.g. by the workers of
+ * a batch), but the pin itself must be destroyed on the thread that made
+ * it.
+ */
+class RecommenderSystem::state_pin
+{
+ private:
+  const system_state *_state;
+
+ public:
+  explicit state_pin(const RecommenderSystem& rs)
+      : _state(rs.load_state().get())
+  {
+    get_state_cache().num_pins++;
+  }
+
+  ~state_pin()
   {
-    if (movie_data.second != 0) // if ratings is not NA (0)
+    state_cache& cache = get_state_cache();
+    if (--cache.num_pins == 0)
     {
-      sum_ratings += movie_data.second;
-      num_rated++;
+      cache.retired.clear();
     }
   }
-  double mean_ratings = sum_ratings / num_rated;
-  return mean_ratings;
+
+  state_pin(const state_pin&) = delete;
+  state_pin& operator=(const state_pin&) = delete;
+
+  const system_state& operator*() const
+  {
+    return *_state;
+  }
+
+  const system_state *operator->() const
+  {
+    return _state;
+  }
+};
+
+/**
+ * calculates the cosine similarity of two vectors whose norms are already
+ * known, e.g. a movie's features (norm kept by the catalog) and the user's
+ * preference vector (norm kept by the user's profile).
+ * @param vector_1 const double*
+ * @param norm_1 norm of vector_1
+ * @param vector_2 const double*
+ * @param norm_2 norm of vector_2
+ * @param size number of features
+ * @return double representing the similarity of the movie to the user's taste.
+ */
+double RecommenderSystem::calc_similarity(const double *vector_1,
+                                          double norm_1,
+                                          const double *vector_2,
+                                          double norm_2, std::size_t size)
+{
+  double numerator = SimilarityKernels::inner_product(vector_1, vector_2,
+                                                      size);
+  double res = numerator / (norm_1 * norm_2);
+  return res;
 }
 
 /**
- * Calculates scalar multiplication.
- * @param scalar - int
- * @param vector - std::vector<double> reference
- * @return new vector which is the product of the multiplication.
+ * better-than order of scan candidates: higher score first, and the lower
+ * id on equal scores, so ties resolve the same way as a plain linear scan.
+ * @param c1 const candidate&
+ * @param c2 const candidate&
+ * @return bool - True if c1 ranks before c2
  */
-std::vector<double> RecommenderSystem::scalar_multiplication
-(double scalar, std::vector<double>& vector)
+static bool is_better(const candidate& c1, const candidate& c2)
 {
-  std::vector<double> new_vector;
-  for (auto elem : vector)
+  return c1.first > c2.first || (c1.first == c2.first && c1.second < c2.second);
+}
+
+/**
+ * offers a scored movie to a bounded heap of the n best candidates. the
+ * heap is ordered by is_better, so its front is the worst kept candidate
+ * and each offer is O(log n). scores not above SIMILARITY_LIM (and NaN) are
+ * never recommended, like in the single result scans.
+ * @param heap std::vector<candidate>& holding at most n candidates
+ * @param n size of the result
+ * @param score double
+ * @param id movie_id
+ */
+static void offer(std::vector<candidate>& heap, std::size_t n, double score,
+                  movie_id id)
+{
+  if (!(score > SIMILARITY_LIM))
+  {
+    return;
+  }
+  candidate cur(score, id);
+  if (heap.size() < n)
   {
-    new_vector.push_back(scalar * elem);
+    heap.push_back(cur);
+    std::push_heap(heap.begin(), heap.end(), is_better);
+  }
+  else if (n > 0 && is_better(cur, heap.front()))
+  {
+    std::pop_heap(heap.begin(), heap.end(), is_better);
+    heap.back() = cur;
+    std::push_heap(heap.begin(), heap.end(), is_better);
   }
-  return new_vector;
 }
 
 /**
- * calculates the vector which is the sum of the two vectors given as
- * arguments and returns it by value.
- * @param first_vec std::vector<double> reference
- * @param second_vec std::vector<double> reference
- * @return std::vector<double> by value
+ * calls func(first, last) on every run [first, last) of consecutive ids
+ * the user did not rate. the rated ids are sorted, so the runs are the
+ * gaps between them.
+ * @param ratings const RatingsView&
+ * @param num_movies number of movies in the catalog
+ * @param func callable as func(movie_id first, movie_id last)
  */
-std::vector<double> RecommenderSystem::vector_addition
-(const std::vector<double>& first_vec, const std::vector<double>& second_vec)
+template <typename Func>
+static void for_each_unrated_run(const RatingsView& ratings,
+                                 movie_id num_movies, Func func)
 {
-  std::vector<double> sum_vector = first_vec; // copy
-  size_t size = first_vec.size();
-  for (size_t i = 0; i < size; i++)
+  const movie_id *rated = ratings.get_ids(); // sorted
+  movie_id id = 0;
+  for (std::size_t next_rated = 0; id < num_movies; next_rated++)
+  { // the unrated run [id, run_end) ends at the next rated movie:
+    movie_id run_end = next_rated < ratings.get_size() ? rated[next_rated]
+                                                       : num_movies;
+    if (id < run_end)
+    {
+      func(id, run_end);
+    }
+    id = run_end + 1; // skip the rated movie
+  }
+}
+
+/**
+ * calculates a recommendation of a movie to the user based on other movies
+ * the user rated high.
+ * @param user const RSUser&
+ * @return sp_movie movie recommendation
+ */
+sp_movie RecommenderSystem::recommend_by_content(const RSUser& user) const
+{
+  return best_cached(user, recommend_mode::CONTENT, 0);
+}
+
+/**
+ * the single best movie for the user, from the result cache if the user's
+ * ratings and the system did not change since it was computed.
+ * @param user const RSUser&
+ * @param mode recommend_mode
+ * @param k int - ignored by the modes that do not use it
+ * @return sp_movie, nullptr if there is none
+ */
+sp_movie RecommenderSystem::best_cached(const RSUser& user,
+                                        recommend_mode mode, int k) const
+{
+  state_pin current(*this);
+  check_mode(*current, mode);
+  cache_key key{user.get_ratings_version(), mode, k, INVALID_MOVIE_ID};
+  cache_value value;
+  if (!_cache.find(key, current->version, value))
   {
-    sum_vector[i] += second_vec[i];
+    scan_scratch scratch;
+    const std::vector<candidate>& best = top_n(*current, user, 1, mode, k,
+                                               movie_filter(), scratch);
+    value.best = best.empty() ? INVALID_MOVIE_ID : best[0].second;
+    _cache.insert(key, current->version, value);
   }
-  return sum_vector;
+  return value.best == INVALID_MOVIE_ID ? nullptr
+                                        : current->catalog.get_movie(value.best);
 }
 
 /**
- * Calculate the preference vector according to the requested algorithm:
- * run through all movies watched by user
- * for each movie, multiply it's features vector by the scalar of the rating
- * (after normalization)
- * sum all of the calculated results to one vector.
- * @param normalized_ranks - rank_map const reference
- * @return std::vector<double> vector which is the sum of all calculations
+ * the user's predicted score for a movie, from the result cache if the
+ * user's ratings and the system did not change since it was computed. the
+ * movie is checked once here; past this point every id is in the catalog.
+ * @param user const RSUser&
+ * @param movie const sp_movie&
+ * @param mode recommend_mode of the prediction (CF, CF_NEIGHBORS,
+ * CF_USERS or FACTORS)
+ * @param k int - ignored by FACTORS
+ * @return double - predicted score
  */
-std::vector<double> RecommenderSystem::calc_preference(const rank_map&
-ranks, double mean_ratings, rs_map& _movies, unsigned long long
-num_features)
+double RecommenderSystem::predict_cached(const RSUser& user,
+                                         const sp_movie& movie,
+                                         recommend_mode mode, int k) const
 {
-  std::vector<double> preference_vector (num_features, 0.0);
-  for (const auto& elem : ranks) // was normalized_ranks
+  state_pin current(*this);
+  const system_state& state = *current;
+  check_mode(state, mode);
+  movie_id id = movie == nullptr ? INVALID_MOVIE_ID
+                                 : state.catalog.get_id(movie);
+  if (id == INVALID_MOVIE_ID)
   {
-    if (elem.second != 0)
-    {
-      std::vector<double> features = _movies[elem.first];
-      std::vector<double> vec = scalar_multiplication(elem.second - mean_ratings,
-                                                      features);
-      preference_vector = vector_addition (preference_vector,vec);
-    }
+    throw std::runtime_error(MOVIE_ERROR);
+  }
+  cache_key key{user.get_ratings_version(), mode, k, id};
+  cache_value value;
+  if (_cache.find(key, state.version, value))
+  {
+    return value.score;
+  }
+  if (mode == recommend_mode::FACTORS)
+  {
+    value.score = predict_by_factors(state, user, state.factors->find_user
+        (user.get_name()), id);
+  }
+  else if (mode == recommend_mode::CF_USERS)
+  {
+    value.score = predict_by_users(state, user,
+                                   state.user_neighbors->find_user
+                                       (user.get_name()), id, k);
+  }
+  else
+  {
+    std::vector<data> pairs;
+    value.score = predict(state, user.get_ratings(), id, k,
+                          mode == recommend_mode::CF_NEIGHBORS
+                          ? cf_mode::NEIGHBORS : cf_mode::EXACT, pairs);
   }
-  return preference_vector;
+  _cache.insert(key, state.version, value);
+  return value.score;
+}
+
+std::vector<scored_movie> RecommenderSystem::recommend_top_n
+(const RSUser& user, std::size_t n, recommend_mode mode, int k,
+ const movie_filter& filter) const
+{
+  scan_scratch scratch;
+  return recommend_top_n(user, n, mode, k, filter, scratch);
 }
 
 /**
- * calculates the norm of a vector and returns a double value of it.
- * @param vector std::vector<double>
- * @return double
+ * pins the current version for the whole scan, so the result is
+ * consistent even if a new version is published meanwhile.
  */
-double RecommenderSystem::calc_norm(const std::vector<double>& vector)
+std::vector<scored_movie> RecommenderSystem::recommend_top_n
+(const RSUser& user, std::size_t n, recommend_mode mode, int k,
+ const movie_filter& filter, scan_scratch& scratch) const
 {
-  double powered_norm = 0;
-  for (size_t i = 0; i < vector.size(); i++)
+  state_pin current(*this);
+  check_mode(*current, mode);
+  std::vector<scored_movie> result;
+  for (const auto& elem : top_n(*current, user, n, mode, k, filter, scratch))
   {
-    powered_norm += vector[i] * vector[i];
+    result.emplace_back(current->catalog.get_movie(elem.second), elem.first);
   }
-  double norm = std::sqrt(powered_norm);
-  return norm;
+  return result;
+}
+
+std::vector<scored_id> RecommenderSystem::recommend_top_n_ids
+(const RSUser& user, std::size_t n, recommend_mode mode, int k,
+ const movie_filter& filter, scan_scratch& scratch) const
+{
+  state_pin current(*this);
+  check_mode(*current, mode);
+  std::vector<scored_id> result;
+  for (const auto& elem : top_n(*current, user, n, mode, k, filter, scratch))
+  {
+    result.emplace_back(elem.second, elem.first);
+  }
+  return result;
 }
 
 /**
- * calculates the inner product of two given vectors and returns a double
- * value of the result.
- * @param vector_1 const std::vector<double> reference
- * @param vector_2 const std::vector<double> reference
- * @return double - inner product result
+ * one pass over the movies the user did not rate, keeping the n best in a
+ * bounded heap.
+ * CONTENT: see scan_by_content.
+ * CONTENT_ANN: see scan_by_content_index.
+ * FACTORS: see scan_by_factors.
+ * CF / CF_NEIGHBORS / CF_USERS: every unrated movie that passes the
+ * filter gets a cf prediction; filtered movies are never predicted.
+ * @param state the version to scan, already checked for the mode
+ * @param user const RSUser&
+ * @param n number of results
+ * @param mode recommend_mode
+ * @param k int - number of similar movies for the cf modes
+ * @param filter const movie_filter&
+ * @param scratch buffers for the heap and the cf pairs
+ * @return scratch.heap, holding the n best movies with their scores, best
+ * first
  */
-double RecommenderSystem::inner_product
-(const std::vector<double>& vector_1, const std::vector<double>& vector_2)
+const std::vector<candidate>& RecommenderSystem::top_n
+(const system_state& state, const RSUser& user, std::size_t n,
+ recommend_mode mode, int k, const movie_filter& filter,
+ scan_scratch& scratch) const
 {
-  double res = 0.0;
-  for (size_t i = 0; i < vector_1.size(); i++)
+  cf_mode cf = mode == recommend_mode::CF_NEIGHBORS ? cf_mode::NEIGHBORS
+                                                    : cf_mode::EXACT;
+  RS_METRICS_COUNT(TOP_N_REQUESTS, 1);
+  RatingsView ratings = user.get_ratings();
+  std::vector<candidate>& heap = scratch.heap;
+  heap.clear();
+  auto num_movies = static_cast<movie_id>(state.catalog.get_num_movies());
+  if (mode == recommend_mode::CONTENT)
   {
-    res += vector_1[i] * vector_2[i];
+    scan_by_content(state, user, n, filter, heap, false);
   }
-  return res;
+  else if (mode == recommend_mode::CONTENT_ANN)
+  {
+    scan_by_content_index(state, user, n, filter, scratch);
+  }
+  else if (mode == recommend_mode::FACTORS)
+  {
+    scan_by_factors(state, user, n, filter, heap);
+  }
+  else if (mode == recommend_mode::CF_USERS)
+  { // the user is looked up once per scan, not once per movie
+    RS_METRICS_TIME(CF_SCAN);
+    std::size_t index = state.user_neighbors->find_user(user.get_name());
+    for_each_unrated_run(ratings, num_movies, [&](movie_id id, movie_id last)
+    {
+      for (; id < last; id++)
+      {
+        if (filter.accepts(id, state.catalog.get_year(id)))
+        {
+          offer(heap, n, predict_by_users(state, user, index, id, k), id);
+        }
+      }
+    });
+  }
+  else
+  {
+    RS_METRICS_TIME(CF_SCAN);
+    scratch.pairs.reserve(ratings.get_size());
+    for_each_unrated_run(ratings, num_movies, [&](movie_id id, movie_id last)
+    {
+      for (; id < last; id++)
+      {
+        if (filter.accepts(id, state.catalog.get_year(id)))
+        {
+          offer(heap, n, predict(state, ratings, id, k, cf, scratch.pairs),
+                id);
+        }
+      }
+    });
+  }
+  std::sort(heap.begin(), heap.end(), is_better);
+  return heap;
 }
 
 /**
- * calculates the similarity of a given movie to the features preferred by
- * the user.
- * @param preference_vector const std::vector<double>&
- * @param features_vector const std::vector<double>&
- * @return double representing the similarity of the movie to the user's taste.
+ * @param state the version the profile is used with
+ * @param user const RSUser&
+ * @param rebuilt holds the profile rebuilt from the user's ratings, if the
+ * cached one is stale
+ * @return the user's cached profile, if no row of state changed since it
+ * was built, otherwise rebuilt
  */
-double RecommenderSystem::calc_similarity(const std::vector<double>&
-    preference_vector, const std::vector<double>& features_vector)
+const UserProfile& RecommenderSystem::get_profile(const system_state& state,
+                                                  const RSUser& user,
+                                                  UserProfile& rebuilt)
 {
-  double numerator = inner_product(preference_vector,
-                                   features_vector);
-  double denominator = calc_norm(preference_vector) * calc_norm
-      (features_vector);
-  double res = numerator / denominator;
-  return res;
+  const UserProfile& profile = user.get_profile();
+  if (profile.is_current(state.catalog))
+  {
+    return profile;
+  }
+  rebuilt = UserProfile(user.get_ratings(), state.catalog);
+  return rebuilt;
 }
 
 /**
- * calculates a recommendation of a movie to the user based on other movies
- * the user rated high.
+ * the content part of recommend_top_n: the user's preference vector and
+ * its norm are cached in its profile, so every run of consecutive unrated
+ * ids is a block of consecutive rows, scored by the block kernel at the
+ * catalog's feature precision.
+ * @param state the version to scan
  * @param user const RSUser&
- * @return sp_movie movie recommendation
+ * @param n number of results
+ * @param filter const movie_filter&
+ * @param heap an empty bounded heap, see offer
+ * @param exact true to score the double rows whatever the precision is
+ */
+void RecommenderSystem::scan_by_content(const system_state& state,
+                                        const RSUser& user, std::size_t n,
+                                        const movie_filter& filter,
+                                        std::vector<candidate>& heap,
+                                        bool exact) const
+{
+  RS_METRICS_TIME(CONTENT_SCAN);
+  RS_METRICS_COUNT(MOVIES_SCORED, state.catalog.get_num_movies()
+                                  - user.get_ratings().get_size());
+  UserProfile rebuilt;
+  const UserProfile& profile = get_profile(state, user, rebuilt);
+  const double *preference_vector = profile.get_preference();
+  double preference_norm = profile.get_preference_norm();
+  auto num_movies = static_cast<movie_id>(state.catalog.get_num_movies());
+  double scores[SCORE_BLOCK_ROWS];
+  for_each_unrated_run(user.get_ratings(), num_movies,
+                       [&](movie_id id, movie_id last)
+  {
+    while (id < last)
+    {
+      std::size_t num_rows = std::min<std::size_t>(last - id,
+                                                   SCORE_BLOCK_ROWS);
+      state.catalog.score_rows(preference_vector, preference_norm, id, num_rows,
+                          scores, exact);
+      for (std::size_t r = 0; r < num_rows; r++)
+      {
+        auto cur = static_cast<movie_id>(id + r);
+        if (filter.accepts(cur, state.catalog.get_year(cur)))
+        {
+          offer(heap, n, scores[r], cur);
+        }
+      }
+      id += num_rows;
+    }
+  });
+}
+
+/**
+ * the FACTORS part of recommend_top_n: the movie rows are contiguous, so
+ * every run of consecutive unrated ids the model covers is scored by one
+ * block kernel call. the rest is predicted the user's mean, like in
+ * predict_by_factors.
+ * @param state the version to scan
+ * @param user const RSUser&
+ * @param n number of results
+ * @param filter const movie_filter&
+ * @param heap an empty bounded heap, see offer
  */
-sp_movie RecommenderSystem::recommend_by_content(const RSUser& user)
+void RecommenderSystem::scan_by_factors(const system_state& state,
+                                        const RSUser& user, std::size_t n,
+                                        const movie_filter& filter,
+                                        std::vector<candidate>& heap) const
 {
-  rank_map ranks_copy = user.get_ranks(); // calls copy constructor
-  double mean_ratings = calc_mean (ranks_copy);
-  std::vector<double> preference_vector;
-  double max = SIMILARITY_LIM; // similarity is a value between -1 and 1
-  sp_movie most_similar;
-  int count = 0;
-  std::vector<double> features;
-  for (auto& movie : user.get_ranks())
+  RS_METRICS_TIME(FACTORS_SCAN);
+  RS_METRICS_COUNT(MOVIES_SCORED, state.catalog.get_num_movies()
+                                  - user.get_ratings().get_size());
+  const FactorModel& model = *state.factors;
+  std::size_t index = model.find_user(user.get_name());
+  auto num_movies = static_cast<movie_id>(state.catalog.get_num_movies());
+  auto covered = static_cast<movie_id>(index == INVALID_USER ? 0 :
+                                       model.get_num_movies());
+  double mean = user.get_profile().get_mean();
+  double scores[SCORE_BLOCK_ROWS];
+  for_each_unrated_run(user.get_ratings(), num_movies,
+                       [&](movie_id id, movie_id last)
   {
-    if (movie.second == 0) // if the movie has no rating - NA
+    while (id < last)
     {
-      features = _movies[movie.first];
-      if (count == 0) // calc the preference vector only on the first iteration
-      {               // - then use it for the rest (it's the same vector)
-        preference_vector = calc_preference(user.get_ranks(), mean_ratings,
-                                            _movies, features.size());
+      std::size_t num_rows = std::min<std::size_t>(last - id,
+                                                   SCORE_BLOCK_ROWS);
+      if (id < covered)
+      {
+        num_rows = std::min<std::size_t>(num_rows, covered - id);
+        model.predict_rows(index, id, num_rows, scores);
       }
-      double similarity = calc_similarity(preference_vector, features);
-      if (similarity > max)
+      else
       {
-        max = similarity;
-        most_similar = movie.first;
+        std::fill(scores, scores + num_rows, mean);
       }
-      count++;
+      for (std::size_t r = 0; r < num_rows; r++)
+      {
+        auto cur = static_cast<movie_id>(id + r);
+        if (filter.accepts(cur, state.catalog.get_year(cur)))
+        {
+          offer(heap, n, scores[r], cur);
+        }
+      }
+      id += num_rows;
+    }
+  });
+}
+
+/**
+ * the CONTENT_ANN part of recommend_top_n: only the movies of the lists
+ * the index probes for the preference vector are scored. a list and the
+ * rated ids are both sorted, so the rated movies are skipped by walking
+ * the two together.
+ * @param state the version to scan
+ * @param user const RSUser&
+ * @param n number of results
+ * @param filter const movie_filter&
+ * @param scratch holds the empty bounded heap, see offer
+ */
+void RecommenderSystem::scan_by_content_index(const system_state& state,
+                                              const RSUser& user,
+                                              std::size_t n,
+                                              const movie_filter& filter,
+                                              scan_scratch& scratch) const
+{
+  RS_METRICS_TIME(CONTENT_ANN_SCAN);
+  UserProfile rebuilt;
+  const UserProfile& profile = get_profile(state, user, rebuilt);
+  const double *preference_vector = profile.get_preference();
+  double preference_norm = profile.get_preference_norm();
+  std::size_t num_features = state.catalog.get_num_features();
+  RatingsView ratings = user.get_ratings();
+  const movie_id *rated = ratings.get_ids();
+  const movie_id *rated_end = rated + ratings.get_size();
+  state.content_index->probe(preference_vector, preference_norm,
+                        scratch.list_scores, scratch.lists);
+  for (std::uint32_t list : scratch.lists)
+  {
+    RS_METRICS_COUNT(MOVIES_SCORED, state.content_index->get_list(list)
+                                        .size());
+    const movie_id *next_rated = rated;
+    for (movie_id id : state.content_index->get_list(list))
+    {
+      next_rated = std::lower_bound(next_rated, rated_end, id);
+      if ((next_rated != rated_end && *next_rated == id)
+          || !filter.accepts(id, state.catalog.get_year(id)))
+      {
+        continue;
+      }
+      offer(scratch.heap, n, calc_similarity(preference_vector,
+                                             preference_norm,
+                                             state.catalog.get_features(id),
+                                             state.catalog.get_norm(id),
+                                             num_features), id);
     }
   }
-  return most_similar;
 }
 
 /**
- * compares two movies by their rating and returns True if the first movie's
- * rating is higher or equals to the second movie.
+ * compares two movies by their similarity and returns True if the first
+ * movie is more similar than the second one. equally similar movies are
+ * ordered by their rate, higher first, so which of them are selected does
+ * not depend on the order of the ratings (see tools/CheckKSelection.cpp).
  * @param m1 const data& - whereas data is an std::pair of two doubles
  * @param m2 const data&
- * @return bool - True if the rating of the first movie is higher or equals
+ * @return bool - True if the similarity of the first movie is higher
  */
 bool RecommenderSystem::compare_by_rank(const data& m1, const data& m2)
 {
-  return m1.second < m2.second; // compare the rates of both movies
+  if (m1.second != m2.second) // compare the similarities of both movies
+  {
+    return m1.second > m2.second;
+  }
+  return m1.first > m2.first;
 }
 
 /**
- * calculates the k most similar movies to a given movie and returns them in
- * a vector that contains their data, organized as a pair object.
- * @param pairs std::vector<data> (whereas data is a pair of two doubles)
- * @param k int representing the amount of movies to fetch from the map
- * @return std::set<data> of the k most similar movies, as pair objects
+ * moves the k most similar movies to the front of the vector, in no
+ * particular order, with std::nth_element: O(n) on average, in place and
+ * without allocating. equal pairs are all kept, and k is clamped to the
+ * number of pairs.
+ * @param pairs std::vector<data>& (whereas data is a pair of two doubles),
+ * reordered in place
+ * @param k int representing the amount of movies to fetch
+ * @return the number of pairs selected: the k most similar are
+ * pairs[0 .. return value)
  */
-std::set<data> RecommenderSystem::get_k_most_similar
-(std::vector<data> pairs, int k)
+std::size_t RecommenderSystem::get_k_most_similar
+(std::vector<data>& pairs, int k)
 {
-  std::sort(pairs.begin(), pairs.end(), compare_by_rank);
-  std::set<data> k_most_similar;
-  unsigned long long n = pairs.size();
-  for (int i = 0; i <= k; i++)
+  RS_METRICS_TIME_SAMPLED(K_SELECT);
+  std::size_t count = std::min<std::size_t>(std::max(k, 0), pairs.size());
+  if (count < pairs.size())
   {
-    k_most_similar.insert(pairs[n-i]);
+    std::nth_element(pairs.begin(), pairs.begin() + count, pairs.end(),
+                     compare_by_rank);
   }
-  return k_most_similar;
+  return count;
 }
 
 double RecommenderSystem::predict_movie_score(const RSUser &user, const
-sp_movie &movie, int k)
-{
-  std::vector<data> pairs;
-  for (auto& elem : user.get_ranks())
-  {
-    if (elem.second != 0) // if the elem has a rating - not 0/NA
-    { // calc it's similarity to the cur movie and add to a pair vector:
-      std::vector<double> cur_features = _movies[elem.first];
-      std::vector<double> na_movie_features = _movies[movie];
-      double similarity = calc_similarity(na_movie_features, cur_features);
-      auto cur_data = std::make_pair(elem.second, similarity);
-      pairs.push_back(cur_data);
+sp_movie &movie, int k, cf_mode mode) const
+{
+  return predict_cached(user, movie, to_recommend_mode(mode), k);
+}
+
+/**
+ * makes sure the data a cf mode needs exists, once per public call rather
+ * than once per predicted movie.
+ * @param state the version that will be used
+ * @param mode cf_mode
+ */
+void RecommenderSystem::check_mode(const system_state& state,
+                                   cf_mode mode) const
+{
+  if (mode == cf_mode::NEIGHBORS
+      && (!state.neighbors || state.neighbors->get_num_movies()
+                              != state.catalog.get_num_movies()))
+  {
+    throw std::runtime_error(NEIGHBORS_ERROR);
+  }
+  if (mode == cf_mode::USERS && !state.user_neighbors)
+  {
+    throw std::runtime_error(USER_NEIGHBORS_ERROR);
+  }
+}
+
+/**
+ * makes sure the data a recommend mode needs exists.
+ * @param state the version that will be used
+ * @param mode recommend_mode
+ */
+void RecommenderSystem::check_mode(const system_state& state,
+                                   recommend_mode mode) const
+{
+  if (mode == recommend_mode::FACTORS)
+  {
+    if (!state.factors)
+    {
+      throw std::runtime_error(FACTORS_ERROR);
+    }
+  }
+  else if (mode == recommend_mode::CONTENT_ANN)
+  {
+    if (!state.content_index || state.content_index->get_num_movies()
+                           != state.catalog.get_num_movies())
+    {
+      throw std::runtime_error(CONTENT_INDEX_ERROR);
+    }
+  }
+  else if (mode != recommend_mode::CONTENT)
+  {
+    check_mode(state, mode == recommend_mode::CF_NEIGHBORS
+                      ? cf_mode::NEIGHBORS : mode == recommend_mode::CF_USERS
+                                             ? cf_mode::USERS
+                                             : cf_mode::EXACT);
+  }
+}
+
+/**
+ * predicts the user's score for a movie with the given cf mode.
+ * @param state the version to predict with
+ * @param ratings const RatingsView& of the user
+ * @param movie movie_id of the movie to predict
+ * @param k int
+ * @param mode cf_mode
+ * @param pairs scratch vector, see predict_by_id
+ * @return double - predicted score
+ */
+double RecommenderSystem::predict(const system_state& state,
+                                  const RatingsView& ratings, movie_id movie,
+                                  int k, cf_mode mode,
+                                  std::vector<data>& pairs) const
+{
+  RS_METRICS_TIME_SAMPLED(CF_PREDICT);
+  RS_METRICS_COUNT(CF_PREDICTIONS, 1);
+  if (mode == cf_mode::NEIGHBORS)
+  {
+    return predict_by_neighbors(state, ratings, movie, k, pairs);
+  }
+  return predict_by_id(state, ratings, movie, k, pairs);
+}
+
+/**
+ * the factor model prediction of a movie
+ * @param state the version to predict with
+ * @param user const RSUser&
+ * @param index the user's index in state.factors (INVALID_USER if it has
+ * none)
+ * @param movie movie_id of the movie to predict
+ * @return double - predicted score; the user's mean rate if the model
+ * does not know the user or the movie
+ */
+double RecommenderSystem::predict_by_factors(const system_state& state,
+                                             const RSUser& user,
+                                             std::size_t index,
+                                             movie_id movie) const
+{
+  if (index == INVALID_USER || movie >= state.factors->get_num_movies())
+  {
+    return user.get_profile().get_mean();
+  }
+  return state.factors->predict(index, movie);
+}
+
+/**
+ * the user-user cf prediction of a movie, see UserNeighbors::predict
+ * @param state the version to predict with
+ * @param user const RSUser&
+ * @param index the user's index in state.user_neighbors (INVALID_USER if
+ * it has none)
+ * @param movie movie_id of the movie to predict
+ * @param k int
+ * @return double - predicted score; the user's mean rate if the model
+ * does not know the user
+ */
+double RecommenderSystem::predict_by_users(const system_state& state,
+                                           const RSUser& user,
+                                           std::size_t index, movie_id movie,
+                                           int k) const
+{
+  if (index == INVALID_USER)
+  {
+    return user.get_profile().get_mean();
+  }
+  return state.user_neighbors->predict(index, movie, k,
+                                      user.get_profile().get_mean());
+}
+
+/**
+ * the item cf prediction over the movie's precomputed neighbor list: the
+ * list is sorted by similarity, so the first k neighbors the user rated are
+ * the k most similar rated movies the list knows of. only those are
+ * weighted, with the same formula as predict_by_id.
+ * @param state the version to predict with
+ * @param ratings const RatingsView& of the user
+ * @param movie movie_id of the movie to predict
+ * @param k int
+ * @param pairs scratch vector for the exact fallback
+ * @return double - predicted score
+ */
+double RecommenderSystem::predict_by_neighbors(const system_state& state,
+                                               const RatingsView& ratings,
+                                               movie_id movie, int k,
+                                               std::vector<data>& pairs) const
+{
+  std::size_t count = state.neighbors->get_count(movie);
+  const movie_id *ids = state.neighbors->get_ids(movie);
+  const float *similarities = state.neighbors->get_similarities(movie);
+  double numerator = 0;
+  double denominator = 0;
+  int found = 0;
+  for (std::size_t i = 0; i < count && found < k; i++)
+  {
+    const double *rate = ratings.find_rate(ids[i]);
+    if (rate != nullptr)
+    {
+      numerator += *rate * similarities[i];
+      denominator += similarities[i];
+      found++;
     }
   }
-  std::set<data> k_most_similar = get_k_most_similar(pairs, k);
+  if (found == 0) // the user rated none of the neighbors
+  {
+    return predict_by_id(state, ratings, movie, k, pairs);
+  }
+  return numerator / denominator;
+}
+
+/**
+ * the item cf prediction of predict_movie_score, over the user's sparse row
+ * and the movie's id.
+ * @param state the version to predict with
+ * @param ratings const RatingsView& of the user
+ * @param movie movie_id of the movie to predict
+ * @param k int
+ * @param pairs scratch vector for the (rate, similarity) pairs, reused
+ * across calls so a scan over many movies allocates it once
+ * @return double - predicted score
+ */
+double RecommenderSystem::predict_by_id(const system_state& state,
+                                        const RatingsView& ratings,
+                                        movie_id movie, int k,
+                                        std::vector<data>& pairs) const
+{
+  pairs.clear();
+  std::size_t num_features = state.catalog.get_num_features();
+  const double *na_movie_features = state.catalog.get_features(movie);
+  double na_movie_norm = state.catalog.get_norm(movie);
+  for (const auto& elem : ratings)
+  { // calc it's similarity to the cur movie and add to a pair vector:
+    double similarity = calc_similarity(na_movie_features, na_movie_norm,
+                                        state.catalog.get_features(elem.first),
+                                        state.catalog.get_norm(elem.first),
+                                        num_features);
+    auto cur_data = std::make_pair(elem.second, similarity);
+    pairs.push_back(cur_data);
+  }
+  std::size_t count = get_k_most_similar(pairs, k);
   double numerator = 0;
   double denominator = 0; // sum similarities
-  for (auto elem : k_most_similar)
+  for (std::size_t i = 0; i < count; i++)
   { // calcs (rate_m1 * similarity_m1) + ... + (rate_mk * similarity_mk)
-    numerator += elem.first * elem.second;
-    denominator += elem.second;
+    numerator += pairs[i].first * pairs[i].second;
+    denominator += pairs[i].second;
   }
   return (numerator / denominator);
 }
 
-sp_movie RecommenderSystem::recommend_by_cf(const RSUser& user, int k)
+/**
+ * the workers only write ids; the movies are copied out on the calling
+ * thread, so the workers never touch the catalog's shared reference count.
+ */
+std::vector<sp_movie> RecommenderSystem::recommend_batch
+(const std::vector<RSUser>& users, recommend_mode mode, int k,
+ unsigned n_threads) const
 {
-  sp_movie most_similar = nullptr;
-  double max = SIMILARITY_LIM;
-  // loop through all movies the user has not watched yet - NA movies:
-  for (auto& elem : user.get_ranks())
+  state_pin current(*this);
+  check_mode(*current, mode);
+  std::vector<movie_id> ids(users.size(), INVALID_MOVIE_ID);
+  std::vector<scan_scratch> scratch(resolve_num_threads(n_threads));
+  movie_filter filter;
+  parallel_for_each(0, users.size(), n_threads,
+                    [&](std::size_t i, unsigned worker)
+                    {
+                      const std::vector<candidate>& best = top_n
+                          (*current, users[i], 1, mode, k, filter,
+                           scratch[worker]);
+                      if (!best.empty())
+                      {
+                        ids[i] = best[0].second;
+                      }
+                    });
+  std::vector<sp_movie> results(users.size());
+  for (std::size_t i = 0; i < users.size(); i++)
   {
-    if (elem.second == 0)
+    if (ids[i] != INVALID_MOVIE_ID)
     {
-      double prediction_rate = predict_movie_score (user, elem.first, k);
-      if (prediction_rate > max)
-      {
-        max = prediction_rate;
-        most_similar = elem.first;
-      }
+      results[i] = current->catalog.get_movie(ids[i]);
     }
   }
-  return most_similar;
+  return results;
+}
+
+sp_movie RecommenderSystem::recommend_by_cf(const RSUser& user, int k,
+                                           cf_mode mode) const
+{
+  return best_cached(user, to_recommend_mode(mode), k);
+}
+
+sp_movie RecommenderSystem::recommend_by_factors(const RSUser& user) const
+{
+  return best_cached(user, recommend_mode::FACTORS, 0);
+}
+
+double RecommenderSystem::predict_factor_score(const RSUser& user,
+                                               const sp_movie& movie) const
+{
+  return predict_cached(user, movie, recommend_mode::FACTORS, 0);
 }
 
+void RecommenderSystem::set_cache_budget(std::size_t budget)
+{
+  _cache.set_budget(budget);
+}
+
+cache_stats RecommenderSystem::get_cache_stats() const
+{
+  return _cache.get_stats();
+}
+
+MonotonicArena& RecommenderSystem::make_arena()
+{
+  std::lock_guard<std::mutex> lock(_arenas_mutex);
+  _arenas.push_back(std::make_unique<MonotonicArena>());
+  return *_arenas.back();
+}
+
+/**
+ * trains on a pinned version without the writer lock, then publishes the
+ * model; the same instance is shared by every later version.
+ */
+als_report RecommenderSystem::train_factors(const std::vector<RSUser>& users,
+                                            const als_options& options,
+                                            unsigned n_threads)
+{
+  state_pin current(*this);
+  auto model = std::make_shared<const FactorModel>(users, current->catalog,
+                                                   options, n_threads);
+  CatalogUpdate update = begin_update();
+  update._state->factors = model;
+  update.commit();
+  return model->get_report();
+}
+
+recommend_mode RecommenderSystem::to_recommend_mode(cf_mode mode)
+{
+  switch (mode)
+  {
+    case cf_mode::NEIGHBORS:
+      return recommend_mode::CF_NEIGHBORS;
+    case cf_mode::USERS:
+      return recommend_mode::CF_USERS;
+    default:
+      return recommend_mode::CF;
+  }
+}
+
+/**
+ * a movie that is already in the system with the same features is returned
+ * as is, without copying the system into a new version.
+ */
 sp_movie RecommenderSystem::add_movie(const std::string& name, int year, const
 std::vector<double>& features)
 {
-  sp_movie new_movie = std::make_shared<Movie>(name, year);
-  _movies[new_movie] = features;
-  return new_movie;
+  state_pin current(*this);
+  const MovieCatalog& catalog = current->catalog;
+  movie_id id = catalog.get_id(name, year);
+  if (id != INVALID_MOVIE_ID && features.size() == catalog.get_num_features()
+      && std::equal(features.begin(), features.end(),
+                    catalog.get_features(id)))
+  {
+    return catalog.get_movie(id);
+  }
+  CatalogUpdate update = begin_update();
+  sp_movie movie = update.add_movie(name, year, features);
+  update.commit();
+  return movie;
+}
+
+void RecommenderSystem::reserve_movies(std::size_t num_movies,
+                                       std::size_t num_features)
+{
+  CatalogUpdate update = begin_update();
+  update.reserve_movies(num_movies, num_features);
+  update.commit();
+}
+
+void RecommenderSystem::build_content_index(std::size_t num_lists,
+                                            std::size_t num_probes,
+                                            unsigned n_threads)
+{
+  CatalogUpdate update = begin_update();
+  system_state& state = *update._state;
+  state.content_index.emplace(num_lists, num_probes);
+  state.content_index->update(state.catalog, n_threads);
+  update.commit();
+}
+
+void RecommenderSystem::set_content_probes(std::size_t num_probes)
+{
+  CatalogUpdate update = begin_update();
+  system_state& state = *update._state;
+  if (!state.content_index)
+  {
+    throw std::runtime_error(CONTENT_INDEX_ERROR);
+  }
+  state.content_index->set_num_probes(num_probes);
+  update.commit();
+}
+
+/**
+ * every user is scanned both ways on the batch threads, each with its own
+ * buffers; users whose exact top n is empty count as fully recalled.
+ */
+double RecommenderSystem::evaluate_content_recall
+(const std::vector<RSUser>& users, std::size_t n, unsigned n_threads) const
+{
+  state_pin current(*this);
+  check_mode(*current, recommend_mode::CONTENT_ANN);
+  if (users.empty())
+  {
+    return 1.0;
+  }
+  std::vector<double> recalls(users.size());
+  std::vector<scan_scratch> scratch(resolve_num_threads(n_threads));
+  movie_filter filter;
+  parallel_for_each(0, users.size(), n_threads,
+                    [&](std::size_t i, unsigned worker)
+                    {
+                      std::vector<candidate> exact = top_n
+                          (*current, users[i], n, recommend_mode::CONTENT, 0,
+                           filter, scratch[worker]); // a copy: approx
+                                                     // reuses the heap
+                      const std::vector<candidate>& approx = top_n
+                          (*current, users[i], n, recommend_mode::CONTENT_ANN,
+                           0, filter, scratch[worker]);
+                      std::size_t found = 0;
+                      for (const auto& elem : approx)
+                      {
+                        found += std::count_if
+                            (exact.begin(), exact.end(),
+                             [&elem](const candidate& m)
+                             { return m.second == elem.second; });
+                      }
+                      recalls[i] = exact.empty() ? 1.0
+                                   : static_cast<double>(found)
+                                     / exact.size();
+                    });
+  return std::accumulate(recalls.begin(), recalls.end(), 0.0)
+         / users.size();
+}
+
+void RecommenderSystem::set_feature_precision(feature_precision precision)
+{
+  CatalogUpdate update = begin_update();
+  update._state->catalog.set_precision(precision);
+  update.commit();
+}
+
+/**
+ * scans every user twice, at the catalog's precision and over the double
+ * rows. the reduced scores are checked against the exact similarity of the
+ * same movie, and every reduced result against its rank in the exact list.
+ */
+precision_report RecommenderSystem::report_precision
+(const std::vector<RSUser>& users, std::size_t n) const
+{
+  state_pin current(*this);
+  const system_state& state = *current;
+  precision_report report;
+  std::vector<candidate> exact, reduced;
+  movie_filter filter;
+  std::size_t num_features = state.catalog.get_num_features();
+  for (const auto& user : users)
+  {
+    exact.clear();
+    reduced.clear();
+    scan_by_content(state, user, n, filter, exact, true);
+    scan_by_content(state, user, n, filter, reduced, false);
+    std::sort(exact.begin(), exact.end(), is_better);
+    std::sort(reduced.begin(), reduced.end(), is_better);
+    UserProfile rebuilt;
+    const UserProfile& profile = get_profile(state, user, rebuilt);
+    for (std::size_t rank = 0; rank < reduced.size(); rank++)
+    {
+      movie_id id = reduced[rank].second;
+      double score = calc_similarity(profile.get_preference(),
+                                     profile.get_preference_norm(),
+                                     state.catalog.get_features(id),
+                                     state.catalog.get_norm(id), num_features);
+      report.max_score_error = std::max(report.max_score_error,
+                                        std::abs(reduced[rank].first
+                                                 - score));
+      auto it = std::find_if(exact.begin(), exact.end(),
+                             [id](const candidate& c)
+                             { return c.second == id; });
+      std::size_t exact_rank = it == exact.end()
+                               ? n : static_cast<std::size_t>
+                                     (it - exact.begin());
+      std::size_t shift = exact_rank > rank ? exact_rank - rank
+                                            : rank - exact_rank;
+      report.max_rank_shift = std::max(report.max_rank_shift, shift);
+    }
+    if (exact.empty() != reduced.empty() || (!exact.empty()
+        && exact[0].second != reduced[0].second))
+    {
+      report.changed_top_1++;
+    }
+    report.num_users++;
+  }
+  return report;
+}
+
+void RecommenderSystem::build_item_neighbors(std::size_t k,
+                                             unsigned n_threads)
+{
+  CatalogUpdate update = begin_update();
+  system_state& state = *update._state;
+  if (!state.neighbors || state.neighbors->get_k() != k)
+  {
+    state.neighbors.emplace(k);
+  }
+  state.neighbors->update(state.catalog, n_threads);
+  update.commit();
+}
+
+/**
+ * the model only depends on the users, so it is built without the lock and
+ * the same instance is shared by every later version.
+ */
+void RecommenderSystem::build_user_neighbors(const std::vector<RSUser>& users,
+                                             std::size_t k,
+                                             user_similarity similarity,
+                                             unsigned n_threads)
+{
+  auto model = std::make_shared<const UserNeighbors>(users, k, similarity,
+                                                     n_threads);
+  CatalogUpdate update = begin_update();
+  update._state->user_neighbors = std::move(model);
+  update.commit();
+}
+
+/**
+ * the new model is built under the writer lock, so two updates never drop
+ * each other's rows. it is cheap next to a build: one copy of the rows.
+ */
+void RecommenderSystem::update_user_neighbors
+(const std::vector<const RSUser *>& changed)
+{
+  if (changed.empty() || !state_pin(*this)->user_neighbors)
+  {
+    return; // nothing to update, and no version to copy
+  }
+  CatalogUpdate update = begin_update();
+  std::shared_ptr<const UserNeighbors>& model = update._state->user_neighbors;
+  if (model)
+  {
+    model = std::make_shared<const UserNeighbors>(*model, changed);
+    update.commit();
+  }
 }
 
 sp_movie RecommenderSystem::get_movie(const std::string &name, int year) const
 {
-  sp_movie cur_movie = std::make_shared<Movie>(name, year);
-  for (const auto& movie : _movies)
+  RS_METRICS_TIME(MOVIE_LOOKUP);
+  RS_METRICS_COUNT(MOVIE_LOOKUPS, 1);
+  state_pin current(*this);
+  const MovieCatalog& catalog = current->catalog;
+  movie_id id = catalog.get_id(name, year);
+  if (id == INVALID_MOVIE_ID)
+  {
+    return nullptr;
+  }
+  return catalog.get_movie(id); // return the smart pointer to the movie
+}
+
+std::vector<movie_id> RecommenderSystem::get_movie_ids
+(const std::vector<movie_key>& keys) const
+{
+  RS_METRICS_TIME(MOVIE_LOOKUP);
+  RS_METRICS_COUNT(MOVIE_LOOKUPS, keys.size());
+  state_pin current(*this);
+  const MovieCatalog& catalog = current->catalog;
+  std::vector<movie_id> ids;
+  ids.reserve(keys.size());
+  for (const auto& key : keys)
   {
-    if (sp_movie_equal (movie.first, cur_movie))
+    ids.push_back(catalog.get_id(key.name, key.year));
+  }
+  return ids;
+}
+
+movie_id RecommenderSystem::get_movie_id(const sp_movie& movie) const
+{
+  return state_pin(*this)->catalog.get_id(movie);
+}
+
+sp_movie RecommenderSystem::get_movie(movie_id id) const
+{
+  return state_pin(*this)->catalog.get_movie(id);
+}
+
+RecommenderSystem::RecommenderSystem()
+    : _id(next_system_id()), _state(std::make_shared<const system_state>()),
+      _version(0)
+{
+}
+
+RecommenderSystem::RecommenderSystem(MovieCatalog catalog)
+    : _id(next_system_id()), _version(0)
+{
+  auto state = std::make_shared<system_state>();
+  state->catalog = std::move(catalog);
+  _state = std::move(state);
+}
+
+/**
+ * the calling thread's cached version of the system, brought up to date
+ * first if a newer one was published. the version number is stored after
+ * the state it belongs to, so a thread that sees a new number always
+ * finds a state at least as new under the mutex.
+ * @return the thread's shared pointer to the current version, valid until
+ * the thread reads the system again
+ */
+const std::shared_ptr<const system_state>& RecommenderSystem::load_state()
+const
+{
+  state_cache& cache = get_state_cache();
+  std::uint64_t version = _version.load(std::memory_order_acquire);
+  cached_state *slot = nullptr;
+  for (cached_state& cur : cache.slots)
+  {
+    if (cur.system == _id)
     {
-      return movie.first; // return the smart pointer to the movie
+      slot = &cur;
+      break;
     }
   }
-  return nullptr;
+  if (slot != nullptr && slot->version == version)
+  {
+    return slot->state;
+  }
+  if (slot == nullptr)
+  {
+    slot = &cache.slots[cache.next_slot];
+    cache.next_slot = (cache.next_slot + 1) % STATE_CACHE_SLOTS;
+  }
+  std::shared_ptr<const system_state> current;
+  {
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    current = _state;
+  }
+  if (cache.num_pins > 0 && slot->state)
+  {
+    cache.retired.push_back(std::move(slot->state));
+  }
+  slot->system = _id;
+  slot->version = current->version;
+  slot->state = std::move(current);
+  return slot->state;
+}
+
+std::shared_ptr<const system_state> RecommenderSystem::get_state() const
+{
+  return load_state();
+}
+
+std::shared_ptr<const MovieCatalog> RecommenderSystem::get_catalog() const
+{
+  std::shared_ptr<const system_state> current = get_state();
+  return std::shared_ptr<const MovieCatalog>(current, &current->catalog);
+}
+
+std::uint64_t RecommenderSystem::get_version() const
+{
+  return _version.load(std::memory_order_acquire);
+}
+
+/**
+ * takes the writer lock and copies the current version; nothing is visible
+ * to readers until commit.
+ */
+CatalogUpdate RecommenderSystem::begin_update()
+{
+  std::unique_lock<std::mutex> lock(_write_mutex);
+  auto state = std::make_shared<system_state>(*get_state());
+  return CatalogUpdate(*this, std::move(lock), std::move(state));
+}
+
+CatalogUpdate::CatalogUpdate(RecommenderSystem& rs,
+                             std::unique_lock<std::mutex> lock,
+                             std::shared_ptr<system_state> state)
+    : _rs(rs), _lock(std::move(lock)), _state(std::move(state)),
+      _num_movies(_state->catalog.get_num_movies()),
+      _neighbors_stale(false)
+{
+}
+
+/**
+ * the derived structures are only brought up to date on commit, once for
+ * the whole batch.
+ */
+sp_movie CatalogUpdate::add_movie(const std::string& name, int year,
+                                  const std::vector<double>& features)
+{
+  check_open();
+  std::uint64_t rows_version = _state->catalog.get_rows_version();
+  movie_id id = _state->catalog.add_movie(name, year, features);
+  // features of an indexed movie changed:
+  if (id < _num_movies && _state->catalog.get_rows_version() != rows_version)
+  {
+    _neighbors_stale = true;
+    _changed.push_back(id);
+  }
+  return _state->catalog.get_movie(id);
+}
+
+void CatalogUpdate::reserve_movies(std::size_t num_movies,
+                                   std::size_t num_features)
+{
+  check_open();
+  _state->catalog.reserve(num_movies, num_features);
+}
+
+std::size_t CatalogUpdate::get_num_movies() const
+{
+  check_open();
+  return _state->catalog.get_num_movies();
+}
+
+/**
+ * brings the neighbor lists and the content index up to date with the
+ * batch, then swaps the new version in. readers that pinned the old one
+ * keep using it until they finish; it is freed with the last thread that
+ * still caches it.
+ */
+void CatalogUpdate::commit()
+{
+  check_open();
+  system_state& state = *_state;
+  if (state.neighbors)
+  {
+    if (_neighbors_stale)
+    {
+      state.neighbors->clear();
+    }
+    state.neighbors->update(state.catalog, 0);
+  }
+  if (state.content_index)
+  {
+    for (movie_id id : _changed)
+    {
+      state.content_index->reassign(state.catalog, id);
+    }
+    state.content_index->update(state.catalog, 0);
+  }
+  std::uint64_t version = ++state.version;
+  std::shared_ptr<const system_state> old; // freed outside the mutex
+  {
+    std::lock_guard<std::mutex> lock(_rs._state_mutex);
+    old = std::move(_rs._state);
+    _rs._state = std::move(_state);
+  }
+  _rs._version.store(version, std::memory_order_release);
+  _lock.unlock();
+}
+
+void CatalogUpdate::check_open() const
+{
+  if (!_state)
+  {
+    throw std::runtime_error(UPDATE_ERROR);
+  }
+}
+
+std::vector<sp_movie> RecommenderSystem::get_movies
+(const std::vector<movie_key>& keys) const
+{
+  RS_METRICS_TIME(MOVIE_LOOKUP);
+  RS_METRICS_COUNT(MOVIE_LOOKUPS, keys.size());
+  state_pin current(*this);
+  const MovieCatalog& catalog = current->catalog;
+  std::vector<sp_movie> movies;
+  movies.reserve(keys.size());
+  for (const auto& key : keys)
+  {
+    movie_id id = catalog.get_id(key.name, key.year);
+    movies.push_back(id == INVALID_MOVIE_ID ? nullptr :
+                     catalog.get_movie(id));
+  }
+  return movies;
 }
 
 std::ostream& operator<<(std::ostream& os, const
@@ -287,14 +1369,17 @@ RecommenderSystem& rs)
   {
     return os;
   }
-  for (const auto& movies : rs._movies)
+  std::shared_ptr<const system_state> current = rs.get_state();
+  // ids follow insertion order - print by (year, name) like before:
+  std::vector<movie_id> ids(current->catalog.get_num_movies());
+  std::iota(ids.begin(), ids.end(), 0);
+  std::sort(ids.begin(), ids.end(), [&current](movie_id m1, movie_id m2)
+  {
+    return *current->catalog.get_movie(m1) < *current->catalog.get_movie(m2);
+  });
+  for (movie_id id : ids)
   {
-    os << *(movies.first);
+    os << *(current->catalog.get_movie(id));
   }
   return os;
 }
-
-bool RecommenderSystem::comp_map(const sp_movie& m1, const sp_movie& m2)
-{
-  return *m1 < *m2;
-}
\ No newline at end of file
@@ -2,47 +2,218 @@
 #define SCHOOL_SOLUTION_RECOMMENDERSYSTEM_H
 
 #include "RSUser.h"
-#include <map>
-#include <set>
 #include "Movie.h"
+#include "MovieCatalog.h"
+#include "ItemNeighbors.h"
+#include "ContentIndex.h"
+#include "UserNeighbors.h"
+#include "FactorModel.h"
+#include "ResultCache.h"
+#include "Recommendation.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
 
 typedef std::pair<double, double> data; // movie rate, similarity res
-typedef bool (*comp_func)(const sp_movie& m1, const sp_movie& m2);
-typedef std::map<sp_movie, std::vector<double>, comp_func> rs_map;
+typedef std::pair<double, movie_id> candidate; // score, movie
 
+/**
+ * buffers a recommendation scan reuses instead of allocating per call
+ */
+struct scan_scratch
+{
+  std::vector<candidate> heap; // the n best candidates so far
+  std::vector<data> pairs; // (rate, similarity) pairs of one cf prediction
+  std::vector<double> list_scores; // similarity to each ContentIndex list
+  std::vector<std::uint32_t> lists; // the ContentIndex lists probed
+};
+
+/**
+ * one version of everything a RecommenderSystem reads: the catalog and the
+ * structures derived from it. a published version is never changed.
+ */
+struct system_state
+{
+  MovieCatalog catalog;
+  std::optional<ItemNeighbors> neighbors; // set by build_item_neighbors
+  std::optional<ContentIndex> content_index; // set by build_content_index
+  // set by build_user_neighbors, and shared by the versions after it:
+  std::shared_ptr<const UserNeighbors> user_neighbors;
+  // set by train_factors, and shared by the versions after it:
+  std::shared_ptr<const FactorModel> factors;
+  std::uint64_t version = 0; // incremented by every commit
+};
+
+class RecommenderSystem;
+
+/**
+ * a batch of changes to a RecommenderSystem, made on a private copy of its
+ * current version and published at once by commit(). readers keep seeing
+ * the old version until then. the copy costs O(catalog) whatever the size
+ * of the batch, so this is the way to add or change more than one movie.
+ * holds the system's writer lock from
+ * RecommenderSystem::begin_update until it is committed or destroyed, so
+ * the thread holding it must not change the system in another way
+ * meanwhile (e.g. RecommenderSystem::add_movie). destroying it without
+ * committing drops the changes.
+ */
+class CatalogUpdate
+{
+ private:
+  RecommenderSystem& _rs;
+  std::unique_lock<std::mutex> _lock;
+  std::shared_ptr<system_state> _state; // the new version, until commit
+  std::size_t _num_movies; // movies in the version the copy was made of
+  bool _neighbors_stale; // an already listed movie changed
+  std::vector<movie_id> _changed; // already indexed movies that changed
+
+  CatalogUpdate(RecommenderSystem& rs, std::unique_lock<std::mutex> lock,
+                std::shared_ptr<system_state> state);
+  void check_open() const;
+
+  friend class RecommenderSystem;
+
+ public:
+  /**
+   * adds a new movie, or changes the features of an existing one
+   * @param name name of movie
+   * @param year year it was made
+   * @param features features for movie
+   * @return shared pointer for movie in the new version
+   */
+  sp_movie add_movie(const std::string& name, int year,
+                     const std::vector<double>& features);
+
+  /**
+   * makes room for a number of movies in the new version
+   * @param num_movies expected number of movies
+   * @param num_features expected number of features of each movie
+   */
+  void reserve_movies(std::size_t num_movies, std::size_t num_features);
+
+  /**
+   * @return number of movies in the new version so far
+   */
+  std::size_t get_num_movies() const;
+
+  /**
+   * brings the item neighbors and the content index up to date, publishes
+   * the new version atomically and releases the writer lock
+   */
+  void commit();
+};
+
+/**
+ * every read pins the current version and works on it alone, while writers
+ * build the next version on a copy and publish it (see CatalogUpdate).
+ * reads may run on any number of threads at the same time as writes.
+ * every thread keeps the last version it read of a system, checked against
+ * an atomic version number: pinning an unchanged system takes no lock and
+ * writes nothing shared. only the first read of each new version on a
+ * thread takes _state_mutex, for as long as it takes to copy a shared
+ * pointer. the price is that every thread keeps the last version it read
+ * of up to a few systems alive until it reads a newer one or exits (see
+ * RecommenderSystem.cpp).
+ */
 class RecommenderSystem
 {
  private:
-  rs_map _movies;
+  class state_pin; // the calling thread's pin of the current version
+
+  const std::uint64_t _id; // tells systems apart in the threads' caches
+  std::shared_ptr<const system_state> _state; // guarded by _state_mutex
+  mutable std::mutex _state_mutex;
+  std::atomic<std::uint64_t> _version; // _state->version, set after it
+  std::mutex _write_mutex; // one CatalogUpdate at a time
+  mutable ResultCache _cache; // single results of the public calls
+  std::mutex _arenas_mutex; // guards _arenas
+  std::vector<std::unique_ptr<MonotonicArena>> _arenas; // see make_arena
+
+  friend class CatalogUpdate;
 
   // helper functions:
-  static double calc_mean(rank_map ranks_vector);
-  static std::vector<double> scalar_multiplication(double scalar,
-                                                 std::vector<double>& vector);
-  static std::vector<double> vector_addition
-  (const std::vector<double>& first_vec,
-   const std::vector<double>& second_vec);
-  static std::vector<double> calc_preference(const rank_map& ranks_vector,
-                                             double mean_ratings,
-                                             rs_map& _movies,
-                                             unsigned long long num_features);
-  static double inner_product(const std::vector<double>& vector_1, const
-  std::vector<double>& vector_2);
-  static double calc_similarity(const std::vector<double>&
-  preference_vector, const std::vector<double>& features_vector);
-  static std::set<data> get_k_most_similar(std::vector<data> pairs, int k);
+  const std::shared_ptr<const system_state>& load_state() const;
+  static double calc_similarity(const double *vector_1, double norm_1,
+                                const double *vector_2, double norm_2,
+                                std::size_t size);
+  static std::size_t get_k_most_similar(std::vector<data>& pairs, int k);
   static bool compare_by_rank(const data& m1, const data& m2);
-  static double calc_norm(const std::vector<double>& vector);
-
+  double predict_by_id(const system_state& state,
+                       const RatingsView& ratings, movie_id movie, int k,
+                       std::vector<data>& pairs) const;
+  double predict_by_neighbors(const system_state& state,
+                              const RatingsView& ratings, movie_id movie,
+                              int k, std::vector<data>& pairs) const;
+  double predict(const system_state& state, const RatingsView& ratings,
+                 movie_id movie, int k, cf_mode mode,
+                 std::vector<data>& pairs) const;
+  double predict_by_users(const system_state& state, const RSUser& user,
+                          std::size_t index, movie_id movie, int k) const;
+  double predict_by_factors(const system_state& state, const RSUser& user,
+                            std::size_t index, movie_id movie) const;
+  void scan_by_factors(const system_state& state, const RSUser& user,
+                       std::size_t n, const movie_filter& filter,
+                       std::vector<candidate>& heap) const;
+  void check_mode(const system_state& state, cf_mode mode) const;
+  void check_mode(const system_state& state, recommend_mode mode) const;
+  static const UserProfile& get_profile(const system_state& state,
+                                        const RSUser& user,
+                                        UserProfile& rebuilt);
+  void scan_by_content(const system_state& state, const RSUser& user,
+                       std::size_t n, const movie_filter& filter,
+                       std::vector<candidate>& heap, bool exact) const;
+  void scan_by_content_index(const system_state& state, const RSUser& user,
+                             std::size_t n, const movie_filter& filter,
+                             scan_scratch& scratch) const;
+  sp_movie best_cached(const RSUser& user, recommend_mode mode, int k) const;
+  double predict_cached(const RSUser& user, const sp_movie& movie,
+                        recommend_mode mode, int k) const;
+  const std::vector<candidate>& top_n(const system_state& state,
+                                      const RSUser& user, std::size_t n,
+                                      recommend_mode mode, int k,
+                                      const movie_filter& filter,
+                                      scan_scratch& scratch) const;
 
-  // comparator func:
-  static bool comp_map(const sp_movie& m1, const sp_movie& m2);
  public:
 
-	explicit RecommenderSystem(): _movies(comp_map){}
+	explicit RecommenderSystem();
+
+	/**
+	 * a system over an already built catalog of movies
+	 * @param catalog the movies of the system
+	 */
+	explicit RecommenderSystem(MovieCatalog catalog);
+
+	/**
+	 * @return the current version of the system, kept alive (and unchanged)
+	 * as long as the pointer is held
+	 */
+	std::shared_ptr<const system_state> get_state() const;
+
+	/**
+	 * @return the movies in the current version, with their features, kept
+	 * alive as long as the pointer is held
+	 */
+	std::shared_ptr<const MovieCatalog> get_catalog() const;
+
+	/**
+	 * @return the number of versions published so far
+	 */
+	std::uint64_t get_version() const;
+
+	/**
+	 * starts a batch of changes; blocks while another batch is open
+	 * @return the batch, see CatalogUpdate
+	 */
+	CatalogUpdate begin_update();
 
     /**
-     * adds a new movie to the system
+     * adds a new movie to the system, as a batch of one (see begin_update).
+     * a movie already in the system with the same features is returned
+     * without publishing a new version. any other call copies the whole
+     * catalog, so more than one movie should be added through
+     * begin_update instead
      * @param name name of movie
      * @param year year it was made
      * @param features features for movie
@@ -57,27 +228,251 @@ class RecommenderSystem
      * @param ranks user ranking to use for algorithm
      * @return shared pointer to movie in system
      */
-	sp_movie recommend_by_content(const RSUser& user);
+	sp_movie recommend_by_content(const RSUser& user) const;
 
     /**
      * a function that calculates the movie with highest predicted score
      * based on ranking of other movies
      * @param ranks user ranking to use for algorithm
      * @param k
+     * @param mode NEIGHBORS to only use the precomputed neighbor lists (see
+     * build_item_neighbors), USERS for user-user cf (see
+     * build_user_neighbors)
      * @return shared pointer to movie in system
      */
-	sp_movie recommend_by_cf(const RSUser& user, int k);
+	sp_movie recommend_by_cf(const RSUser& user, int k,
+                             cf_mode mode = cf_mode::EXACT) const;
+
+    /**
+     * the movie with the highest rate predicted by the factor model (see
+     * train_factors)
+     * @param user the user to recommend to
+     * @return shared pointer to movie in system
+     */
+	sp_movie recommend_by_factors(const RSUser& user) const;
+
+    /**
+     * the n best movies for the user, from one pass over the movies the user
+     * did not rate
+     * @param user the user to recommend to
+     * @param n number of movies to return
+     * @param mode the algorithm to score movies with
+     * @param k number of most similar movies for the cf modes (ignored by
+     * CONTENT)
+     * @param filter movies that may not be returned, skipped while scanning
+     * @return up to n (movie, score) pairs, best first
+     */
+	std::vector<scored_movie> recommend_top_n(const RSUser& user,
+                                              std::size_t n,
+                                              recommend_mode mode, int k,
+                                              const movie_filter& filter =
+                                                  movie_filter()) const;
+
+    /**
+     * same as above, reusing the given buffers
+     * @param scratch buffers owned by the caller, e.g. one per thread
+     */
+	std::vector<scored_movie> recommend_top_n(const RSUser& user,
+                                              std::size_t n,
+                                              recommend_mode mode, int k,
+                                              const movie_filter& filter,
+                                              scan_scratch& scratch) const;
+
+    /**
+     * same as above, returning ids rather than movies (see get_movie(id)).
+     * every sp_movie copy changes the reference count of the catalog's
+     * arena, which all threads share (see MovieCatalog), so this is the
+     * call for many threads serving requests at once.
+     * @return up to n (movie id, score) pairs, best first
+     */
+	std::vector<scored_id> recommend_top_n_ids(const RSUser& user,
+                                               std::size_t n,
+                                               recommend_mode mode, int k,
+                                               const movie_filter& filter,
+                                               scan_scratch& scratch) const;
+
+    /**
+     * the single best recommendation for every user, computed in parallel.
+     * users are spread over the threads by work stealing, every thread has
+     * its own scan buffers, and nothing shared is written while scoring, so
+     * the result is the same as calling recommend_by_content /
+     * recommend_by_cf for each user in turn. the system and the users must
+     * not change during the call.
+     * @param users the users to recommend to
+     * @param mode the algorithm to score movies with
+     * @param k number of most similar movies for the cf modes (ignored by
+     * CONTENT)
+     * @param n_threads number of threads, 0 for one per hardware thread
+     * @return result[i] is the recommendation for users[i] (nullptr if
+     * there is none)
+     */
+	std::vector<sp_movie> recommend_batch(const std::vector<RSUser>& users,
+                                          recommend_mode mode, int k,
+                                          unsigned n_threads = 0) const;
 
     /**
      * Predict a user rating for a movie given argument using item cf
      * procedure with k most similar movies.
      * @param user_rankings: ranking to use
-     * @param movie: movie to predict
+     * @param movie: movie to predict, which must be in the system
      * @param k:
+     * @param mode: EXACT compares the movie with every rated movie;
+     * NEIGHBORS only with the rated movies in its neighbor list, falling
+     * back to EXACT if the list has none of them; USERS uses the k most
+     * similar users that rated it (see build_user_neighbors)
      * @return score based on algorithm as described in pdf
      */
 	double predict_movie_score(const RSUser &user, const sp_movie &movie,
-                               int k);
+                               int k, cf_mode mode = cf_mode::EXACT) const;
+
+	/**
+	 * predicts a user rating for a movie with the factor model: one inner
+	 * product of the user's and the movie's rows
+	 * @param user the user
+	 * @param movie the movie to predict, which must be in the system
+	 * @return the predicted rate; the user's mean rate if the model does
+	 * not know the user or the movie
+	 */
+	double predict_factor_score(const RSUser& user,
+                                const sp_movie& movie) const;
+
+	/**
+	 * trains the latent factor model of recommend_mode::FACTORS by
+	 * alternating least squares over the current ratings of the users and
+	 * the current catalog. like build_user_neighbors, the model is a
+	 * snapshot trained before the writer lock is taken; users and movies
+	 * added later are predicted the user's mean rate until it is trained
+	 * again.
+	 * @param users the users to train on
+	 * @param options als_options
+	 * @param n_threads number of threads, 0 for one per hardware thread
+	 * @return the training and held out rmse
+	 */
+	als_report train_factors(const std::vector<RSUser>& users,
+                             const als_options& options = als_options(),
+                             unsigned n_threads = 0);
+
+	/**
+	 * recommend_by_content, recommend_by_cf, recommend_by_factors,
+	 * predict_movie_score and predict_factor_score keep their results in a
+	 * sharded LRU cache (see ResultCache) keyed by the user's ratings
+	 * version (see RSUser::get_ratings_version), the mode and k. a result is
+	 * reused until the user's ratings change or a new version of the
+	 * system is published (e.g. by add_movie).
+	 * @param budget the most memory the cache may take, in bytes; 0
+	 * disables it
+	 */
+	void set_cache_budget(std::size_t budget);
+
+	/**
+	 * @return the hit and miss counters and the size of the result cache
+	 */
+	cache_stats get_cache_stats() const;
+
+	/**
+	 * the rating rows of users loaded for the system are carved out of
+	 * arenas the system owns, so they take no allocation of their own and
+	 * are freed with the system, which every RSUser keeps alive. every
+	 * call returns a new arena, e.g. one per loading thread, so loaders do
+	 * not contend on one arena's lock.
+	 * @return an arena that lives as long as the system
+	 */
+	MonotonicArena& make_arena();
+
+	/**
+	 * makes room for a number of movies, e.g. before loading a file
+	 * @param num_movies expected number of movies
+	 * @param num_features expected number of features of each movie
+	 */
+	void reserve_movies(std::size_t num_movies, std::size_t num_features);
+
+	/**
+	 * sets the precision the content scans read the movie features at
+	 * (see MovieCatalog::set_precision). cf predictions and user profiles
+	 * always use the double features, which are kept beside the narrower
+	 * copy. tools/ReportPrecision.cpp reports the accuracy of each
+	 * precision on a dataset.
+	 * @param precision feature_precision
+	 */
+	void set_feature_precision(feature_precision precision);
+
+	/**
+	 * compares the content top n of every user at the current feature
+	 * precision with the top n over the double features
+	 * @param users the users to compare on
+	 * @param n number of movies per user
+	 * @return the largest deviations found
+	 */
+	precision_report report_precision(const std::vector<RSUser>& users,
+                                      std::size_t n) const;
+
+	/**
+	 * precomputes (or brings up to date) the k nearest neighbors of every
+	 * movie, for cf_mode::NEIGHBORS. once built, the lists are extended
+	 * incrementally by add_movie.
+	 * @param k number of neighbors to keep per movie
+	 * @param n_threads number of threads, 0 for one per hardware thread
+	 */
+	void build_item_neighbors(std::size_t k, unsigned n_threads = 0);
+
+	/**
+	 * builds (or rebuilds) the user-user model of cf_mode::USERS from the
+	 * current ratings of the users. the neighbor lists are a snapshot:
+	 * users added later are only seen after building it again, and users it
+	 * does not know are predicted their mean rate. ratings ingested later
+	 * update the rows it predicts from (see update_user_neighbors); ratings
+	 * changed in another way only change the user's own mean until the
+	 * next ingested batch or build. the build runs before the writer lock
+	 * is taken, so readers and writers are not held up by it.
+	 * @param users the users to compare
+	 * @param k number of neighbors to keep per user
+	 * @param similarity user_similarity
+	 * @param n_threads number of threads, 0 for one per hardware thread
+	 */
+	void build_user_neighbors(const std::vector<RSUser>& users, std::size_t k,
+                              user_similarity similarity =
+                                  user_similarity::PEARSON,
+                              unsigned n_threads = 0);
+
+	/**
+	 * publishes the user-user model with the rows and means of some users
+	 * rebuilt from their current ratings (see UserNeighbors); the neighbor
+	 * lists stay as built. RatingIngestor calls it after every batch.
+	 * does nothing if the model was not built.
+	 * @param changed users whose ratings changed
+	 */
+	void update_user_neighbors(const std::vector<const RSUser *>& changed);
+
+	/**
+	 * builds (or rebuilds) the ContentIndex for recommend_mode::CONTENT_ANN.
+	 * once built, it is kept up to date by add_movie.
+	 * @param num_lists number of lists to split the movies into, e.g. about
+	 * the square root of the number of movies
+	 * @param num_probes number of lists a query scores
+	 * @param n_threads number of threads, 0 for one per hardware thread
+	 */
+	void build_content_index(std::size_t num_lists, std::size_t num_probes,
+                             unsigned n_threads = 0);
+
+	/**
+	 * tunes recall against latency of recommend_mode::CONTENT_ANN
+	 * @param num_probes number of lists a query scores; more lists find
+	 * more of the exact results and take longer
+	 */
+	void set_content_probes(std::size_t num_probes);
+
+	/**
+	 * measures recall@n of recommend_mode::CONTENT_ANN: the share of every
+	 * user's exact content top n that the approximate top n also returns,
+	 * averaged over the users
+	 * @param users the users to measure on
+	 * @param n number of movies per user
+	 * @param n_threads number of threads, 0 for one per hardware thread
+	 * @return the mean recall, between 0 and 1
+	 */
+	double evaluate_content_recall(const std::vector<RSUser>& users,
+                                   std::size_t n,
+                                   unsigned n_threads = 0) const;
 
 	/**
 	 * gets a shared pointer to movie in system
@@ -87,6 +482,41 @@ class RecommenderSystem
 	 */
 	sp_movie get_movie(const std::string &name, int year) const;
 
+	/**
+	 * gets shared pointers to many movies at once, e.g. a whole header row
+	 * @param keys name/year of each movie to look up
+	 * @return shared pointer to each movie in system (nullptr if missing),
+	 * in the order of keys
+	 */
+	std::vector<sp_movie> get_movies(const std::vector<movie_key>& keys) const;
+
+	/**
+	 * gets the dense ids of many movies at once, e.g. a whole header row
+	 * @param keys name/year of each movie to look up
+	 * @return id of each movie (INVALID_MOVIE_ID if missing), in the order of
+	 * keys
+	 */
+	std::vector<movie_id> get_movie_ids(const std::vector<movie_key>& keys)
+	const;
+
+	/**
+	 * @param movie a movie in the system
+	 * @return the movie's dense id, or INVALID_MOVIE_ID if it is missing
+	 */
+	movie_id get_movie_id(const sp_movie& movie) const;
+
+	/**
+	 * @param id dense id of a movie in the system
+	 * @return shared pointer to the movie
+	 */
+	sp_movie get_movie(movie_id id) const;
+
+	/**
+	 * @param mode cf_mode
+	 * @return the recommend_mode that scores movies with mode
+	 */
+	static recommend_mode to_recommend_mode(cf_mode mode);
+
 	friend std::ostream& operator<<(std::ostream& os, const
     RecommenderSystem& rs);
 };
@@ -1,48 +1,106 @@
 #include "RecommenderSystemLoader.h"
+#include "MappedFile.h"
+#include "ParseUtils.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <charconv>
 #include <string>
-#include <sstream>
-#include <fstream>
 
 #define INVALID_PATH_ERROR "ERROR: given file is invalid."
 #define RANGE_ERROR "ERROR: data out of range (1.0 - 10.0)."
+#define FORMAT_ERROR "ERROR: expected <movie_name>-<year> at line start."
+#define FEATURE_ERROR "ERROR: every feature must be a number."
+#define NO_FEATURES_ERROR "ERROR: a movie must have at least one feature."
+#define DUPLICATE_ERROR "ERROR: a movie appears more than once."
 #define HYPHEN '-'
-#define MAX_LIMIT 10.0
-#define MIN_LIMIT 1.0
 
+/**
+ * reads the file through a memory mapping and tokenizes it in place: every
+ * line is split by pointer arithmetic and numbers are parsed with
+ * std::from_chars, with no stream and no string per word. features are
+ * collected in one vector reused for every line, and the system is built
+ * in place, as one CatalogUpdate, and returned, never copied. the update
+ * is only committed once the whole file is valid, so a bad file never
+ * publishes a version.
+ * the file is validated as it is read: every movie has the same, non zero,
+ * number of features (checked by the catalog), every feature is a number in
+ * range, and no movie appears twice, so nothing built from the system has to
+ * check them again.
+ */
 std::unique_ptr<RecommenderSystem>
     RecommenderSystemLoader::create_rs_from_movies_file
     (const std::string &movies_file_path) noexcept (false)
 {
-  std::ifstream input_file(movies_file_path);
+  RS_METRICS_TIME(LOAD_MOVIES);
+  MappedFile input_file(movies_file_path);
   if (!(input_file.is_open()))
   {
     throw std::runtime_error((INVALID_PATH_ERROR));
   }
-  RecommenderSystem rs; // create a new RecommenderSystem
-  std::string line;
-  while (std::getline(input_file, line)) // start reading lines from file
+  auto rs = std::make_unique<RecommenderSystem>(); // create a new system
+  // one batch for the whole file, published once it is all read:
+  CatalogUpdate update = rs->begin_update();
+  const char *pos = input_file.get_data();
+  const char *end = pos + input_file.get_size();
+  std::size_t num_lines = std::count(pos, end, NEWLINE) + 1;
+  std::vector<double> features_vector; // a vector to put the features in
+  bool reserved = false;
+  std::size_t num_movies = 0; // movies read from the file
+  while (pos < end) // start reading lines from file
   {
-    std::string cur_word; // current word read from file
-    std::vector<double> features_vector; // a vector to put the features in
-    std::string movie_name; // movie name read from file
+    const char *line_end = find_line_end(pos, end);
+    const char *cur = skip_blanks(pos, line_end);
+    pos = line_end + 1;
+    if (cur == line_end) // blank line
+    {
+      continue;
+    }
+    // separate data by hyphen <movie_name-year>:
+    const char *word_end = std::find_if(cur, line_end, is_blank);
+    const char *hyphen = std::find(cur, word_end, HYPHEN);
     int year; // release year for the current movie
-    double cur_feature; // feature element for the current movie
-    unsigned long long hyphen; // separate data by hyphen <movie_name-year>
-    std::stringstream str_stream(line);
-    str_stream >> cur_word;
-    hyphen = cur_word.find(HYPHEN);
-    movie_name = cur_word.substr(0, hyphen); // cut from beg to hyphen
-    cur_word.erase(0, hyphen + sizeof(HYPHEN)); // todo
-    year = std::stoi(cur_word); // todo
-    while (str_stream >> cur_feature)
-    { // check data is valid:
-      if (cur_feature < MIN_LIMIT || cur_feature > MAX_LIMIT)
+    auto year_res = std::from_chars(hyphen + 1, word_end, year);
+    if (hyphen == word_end || year_res.ec != std::errc()
+        || year_res.ptr != word_end)
+    {
+      throw std::runtime_error(FORMAT_ERROR);
+    }
+    std::string movie_name(cur, hyphen); // movie name read from file
+    features_vector.clear();
+    cur = skip_blanks(word_end, line_end);
+    while (cur < line_end)
+    {
+      double cur_feature; // feature element for the current movie
+      auto res = std::from_chars(cur, line_end, cur_feature);
+      if (res.ec != std::errc())
+      {
+        throw std::runtime_error(FEATURE_ERROR);
+      }
+      if (!is_valid_feature(cur_feature)) // check data is valid
       {
         throw std::runtime_error(RANGE_ERROR);
       }
       features_vector.push_back(cur_feature); // add data into features vector
-    } // add movie to system:
-    rs.add_movie (movie_name, year, features_vector);
-  };
-  return std::make_unique<RecommenderSystem>(rs);
-}
\ No newline at end of file
+      cur = skip_blanks(res.ptr, line_end);
+    }
+    if (features_vector.empty())
+    {
+      throw std::runtime_error(NO_FEATURES_ERROR);
+    }
+    if (!reserved) // the first movie tells the size of a row
+    {
+      update.reserve_movies(num_lines, features_vector.size());
+      reserved = true;
+    }
+    update.add_movie (movie_name, year, features_vector); // add movie to system
+    num_movies++;
+    // add_movie overwrites a known movie, which a file must not repeat:
+    if (update.get_num_movies() != num_movies)
+    {
+      throw std::runtime_error(DUPLICATE_ERROR);
+    }
+  }
+  update.commit();
+  RS_METRICS_COUNT(MOVIES_LOADED, num_movies);
+  return rs;
+}
@@ -10,7 +10,10 @@ class RecommenderSystemLoader {
  public:
   RecommenderSystemLoader () = delete;
   /**
-   * loads movies by the given format for movies with their feature's score
+   * loads movies by the given format for movies with their feature's score.
+   * throws if a line is not <movie_name>-<year> followed by numbers in
+   * range, if a movie has no features or another number of features than
+   * the others, or if a movie appears twice.
    * @param movies_file_path a path to the file of the movies
    * @return smart pointer to a RecommenderSystem which was created with
    * those movies
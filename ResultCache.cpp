@@ -0,0 +1,198 @@
+#include "ResultCache.h"
+#include <algorithm>
+
+/**
+ * mixes the bits of a number, so consecutive ones spread over the range
+ * (the murmur3 finalizer)
+ * @param x std::uint64_t
+ * @return std::uint64_t
+ */
+static std::uint64_t mix (std::uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return x;
+}
+
+std::size_t ResultCache::key_hash::operator() (const cache_key& key) const
+{
+  std::uint64_t x = key.ratings_version;
+  x = x * 31 + static_cast<std::uint64_t>(key.mode);
+  x = x * 31 + static_cast<std::uint32_t>(key.k);
+  x = x * 31 + key.movie;
+  return static_cast<std::size_t>(mix (x));
+}
+
+ResultCache::ResultCache (std::size_t budget) : _shards (CACHE_SHARDS),
+                                                _num_shards (1),
+                                                _system_version (0)
+{
+  set_budget (budget);
+}
+
+/**
+ * drops everything if version is newer than the entries.
+ * @param version std::uint64_t
+ * @return false if version is older than the entries
+ */
+bool ResultCache::shard::check_version (std::uint64_t version)
+{
+  if (version > system_version)
+  {
+    stats.invalidations += entries.size ();
+    entries.clear ();
+    index.clear ();
+    system_version = version;
+  }
+  return version == system_version;
+}
+
+/**
+ * drops the least recently used entries until at most max_entries are left
+ */
+void ResultCache::shard::evict ()
+{
+  while (entries.size () > max_entries)
+  {
+    index.erase (entries.back ().first);
+    entries.pop_back ();
+    stats.evictions++;
+  }
+}
+
+/**
+ * @param key cache_key
+ * @return the shard of the key's ratings version
+ */
+ResultCache::shard& ResultCache::get_shard (const cache_key& key)
+{
+  return _shards[mix (key.ratings_version)
+                 % _num_shards.load (std::memory_order_relaxed)];
+}
+
+/**
+ * remembers the newest system version, so get_stats can tell which shards
+ * hold entries of an older one. only a newer version is written.
+ * @param system_version std::uint64_t
+ */
+void ResultCache::see_version (std::uint64_t system_version)
+{
+  std::uint64_t seen = _system_version.load (std::memory_order_relaxed);
+  while (system_version > seen
+         && !_system_version.compare_exchange_weak
+             (seen, system_version, std::memory_order_relaxed))
+  {
+  }
+}
+
+bool ResultCache::find (const cache_key& key, std::uint64_t system_version,
+                        cache_value& value)
+{
+  see_version (system_version);
+  shard& cur = get_shard (key);
+  std::lock_guard<std::mutex> lock (cur.mutex);
+  if (cur.check_version (system_version))
+  {
+    auto it = cur.index.find (key);
+    if (it != cur.index.end ())
+    {
+      cur.entries.splice (cur.entries.begin (), cur.entries, it->second);
+      value = it->second->second;
+      cur.stats.hits++;
+      return true;
+    }
+  }
+  cur.stats.misses++;
+  return false;
+}
+
+void ResultCache::insert (const cache_key& key, std::uint64_t system_version,
+                          const cache_value& value)
+{
+  see_version (system_version);
+  shard& cur = get_shard (key);
+  std::lock_guard<std::mutex> lock (cur.mutex);
+  if (cur.max_entries == 0 || !cur.check_version (system_version))
+  {
+    return;
+  }
+  auto it = cur.index.find (key);
+  if (it != cur.index.end ()) // computed by two threads at once
+  {
+    it->second->second = value;
+    cur.entries.splice (cur.entries.begin (), cur.entries, it->second);
+    return;
+  }
+  cur.entries.emplace_front (key, value);
+  cur.index.emplace (key, cur.entries.begin ());
+  cur.evict ();
+}
+
+/**
+ * splits the entries the budget allows over the shards in use. if the
+ * number of shards in use changes, keys move to other shards, so every
+ * entry is dropped.
+ */
+void ResultCache::set_budget (std::size_t budget)
+{
+  std::lock_guard<std::mutex> budget_lock (_budget_mutex);
+  std::size_t max_entries = budget / get_entry_size ();
+  std::size_t num_shards = std::clamp<std::size_t> (max_entries, 1,
+                                                    CACHE_SHARDS);
+  bool moved = num_shards != _num_shards.load (std::memory_order_relaxed);
+  _num_shards.store (num_shards, std::memory_order_relaxed);
+  for (std::size_t i = 0; i < _shards.size (); i++)
+  {
+    shard& cur = _shards[i];
+    std::lock_guard<std::mutex> lock (cur.mutex);
+    if (moved)
+    {
+      cur.max_entries = 0;
+      cur.evict ();
+    }
+    cur.max_entries = i >= num_shards ? 0 : max_entries / num_shards
+                                            + (i < max_entries % num_shards);
+    cur.evict ();
+  }
+}
+
+/**
+ * sums the shards. entries of a shard that has not seen the newest system
+ * version yet are counted as invalidated, as they will be on its next use.
+ */
+cache_stats ResultCache::get_stats () const
+{
+  std::uint64_t newest = _system_version.load (std::memory_order_relaxed);
+  cache_stats stats;
+  for (const shard& cur : _shards)
+  {
+    std::lock_guard<std::mutex> lock (cur.mutex);
+    stats.hits += cur.stats.hits;
+    stats.misses += cur.stats.misses;
+    stats.evictions += cur.stats.evictions;
+    stats.invalidations += cur.stats.invalidations;
+    if (cur.system_version < newest)
+    {
+      stats.invalidations += cur.entries.size ();
+    }
+    else
+    {
+      stats.entries += cur.entries.size ();
+    }
+  }
+  stats.bytes = stats.entries * get_entry_size ();
+  return stats;
+}
+
+/**
+ * a list node holds the entry and two links; an index node holds the key,
+ * the list iterator, a link and the cached hash, plus one bucket pointer
+ * per entry at the default load factor.
+ */
+std::size_t ResultCache::get_entry_size ()
+{
+  return sizeof (std::pair<cache_key, cache_value>) + 2 * sizeof (void *)
+         + sizeof (cache_key) + sizeof (entry_list::iterator)
+         + 2 * sizeof (void *) + sizeof (std::size_t);
+}
@@ -0,0 +1,152 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "AlignedAllocator.h"
+#include "Recommendation.h"
+
+#define DEFAULT_CACHE_BUDGET (16u << 20) // bytes
+#define CACHE_SHARDS 64 // independently locked parts of a ResultCache
+
+/**
+ * what a cached result was computed for
+ */
+struct cache_key
+{
+  std::uint64_t ratings_version; // RSUser::get_ratings_version of the user
+  recommend_mode mode;
+  int k;
+  movie_id movie; // the predicted movie, INVALID_MOVIE_ID for the best one
+
+  bool operator== (const cache_key& other) const
+  {
+    return ratings_version == other.ratings_version && mode == other.mode
+           && k == other.k && movie == other.movie;
+  }
+};
+
+/**
+ * a cached result: the best movie, or the predicted score of cache_key's
+ * movie
+ */
+struct cache_value
+{
+  movie_id best = INVALID_MOVIE_ID;
+  double score = 0.0;
+};
+
+/**
+ * the counters of a ResultCache
+ */
+struct cache_stats
+{
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+  std::size_t evictions = 0; // entries dropped to stay in the budget
+  std::size_t invalidations = 0; // entries dropped because the system
+                                 // version changed
+  std::size_t entries = 0;
+  std::size_t bytes = 0;
+};
+
+/**
+ * a thread safe cache of recommendations and predictions, bounded by a
+ * memory budget.
+ * results are keyed by the version of the user's ratings, which changes
+ * with every change to the ratings and is unique across users, so a user
+ * whose ratings changed can never hit an older result; those entries are
+ * no longer reachable and age out. every entry is also tagged with the
+ * version of the system it was computed on, and is dropped once a newer
+ * system version is seen.
+ * rather than one LRU inside every user, which would need a budget per
+ * user and would be copied with the RSUser, the cache is split into
+ * CACHE_SHARDS LRUs by a hash of the ratings version, so all of a user's
+ * results are in one shard. every shard has its own mutex and its share of
+ * the budget, so threads serving different users rarely meet on a lock,
+ * and one user's results take at most one share.
+ */
+class ResultCache
+{
+ private:
+  struct key_hash
+  {
+    std::size_t operator() (const cache_key& key) const;
+  };
+  typedef std::list<std::pair<cache_key, cache_value>> entry_list;
+
+  /**
+   * an LRU of the users whose ratings versions hash to it
+   */
+  struct alignas (CACHE_LINE_SIZE) shard
+  {
+    mutable std::mutex mutex;
+    std::size_t max_entries = 0;
+    std::uint64_t system_version = 0; // the version the entries belong to
+    entry_list entries; // most recently used first
+    std::unordered_map<cache_key, entry_list::iterator, key_hash> index;
+    cache_stats stats;
+
+    bool check_version (std::uint64_t version);
+    void evict ();
+  };
+
+  std::vector<shard> _shards; // CACHE_SHARDS of them
+  std::atomic<std::size_t> _num_shards; // in use, fewer for small budgets
+  std::atomic<std::uint64_t> _system_version; // the newest version seen
+  std::mutex _budget_mutex; // one set_budget at a time
+
+  shard& get_shard (const cache_key& key);
+  void see_version (std::uint64_t system_version);
+
+ public:
+  /**
+   * @param budget the most memory the entries may take, in bytes; 0
+   * disables the cache
+   */
+  explicit ResultCache (std::size_t budget = DEFAULT_CACHE_BUDGET);
+
+  /**
+   * @param key cache_key
+   * @param system_version version of the system the caller reads
+   * @param value set to the cached result on a hit
+   * @return true on a hit
+   */
+  bool find (const cache_key& key, std::uint64_t system_version,
+             cache_value& value);
+
+  /**
+   * caches a result, dropping the least recently used ones if the budget
+   * is exceeded. results computed on an older system version than the
+   * cache holds are not kept.
+   * @param key cache_key
+   * @param system_version version of the system the result was computed on
+   * @param value cache_value
+   */
+  void insert (const cache_key& key, std::uint64_t system_version,
+               const cache_value& value);
+
+  /**
+   * changes the budget, dropping entries if it shrank. a budget of fewer
+   * entries than CACHE_SHARDS uses one shard per entry.
+   * @param budget bytes, 0 disables the cache
+   */
+  void set_budget (std::size_t budget);
+
+  /**
+   * @return the counters and the current size
+   */
+  cache_stats get_stats () const;
+
+  /**
+   * @return the memory one entry takes, in bytes, with the list and index
+   * nodes around it
+   */
+  static std::size_t get_entry_size ();
+};
+
+#endif //RESULTCACHE_H
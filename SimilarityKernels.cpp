@@ -0,0 +1,481 @@
+#include "SimilarityKernels.h"
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_KERNELS
+#include <immintrin.h>
+#endif
+
+#define ISA_PORTABLE "portable"
+#define ISA_AVX2 "avx2"
+#define ISA_AVX512 "avx512"
+
+typedef double (*inner_product_func) (const double *, const double *,
+                                      std::size_t);
+// dots[r] = the inner product of query and row r, for rows stored as T:
+template <typename T>
+using dot_block_func = void (*) (const double *, const T *, std::size_t,
+                                 std::size_t, double *);
+
+// the sizes the kernels are also compiled for, with the size a constant:
+static constexpr std::size_t FIXED_DIMENSIONS[] = {4, 8, 16, 32, 64, 128};
+#define NUM_FIXED_DIMENSIONS (sizeof (FIXED_DIMENSIONS) \
+                              / sizeof (FIXED_DIMENSIONS[0]))
+#define MAX_FIXED_DIMENSION 128
+
+/**
+ * one implementation of every kernel, for one instruction set and either
+ * one size or any size.
+ */
+struct dimension_kernels
+{
+  inner_product_func inner_product;
+  dot_block_func<double> dot_block;
+  dot_block_func<float> dot_block_float;
+  dot_block_func<std::uint8_t> dot_block_uint8;
+};
+
+/**
+ * the kernels of one instruction set: kernels[0] are the generic ones,
+ * which take the size at run time, and kernels[i + 1] are the ones
+ * compiled for FIXED_DIMENSIONS[i].
+ */
+struct kernel_table
+{
+  const char *isa;
+  dimension_kernels kernels[NUM_FIXED_DIMENSIONS + 1];
+};
+
+/**
+ * @return for every size up to MAX_FIXED_DIMENSION, the index in
+ * kernel_table::kernels of the kernels that size runs
+ */
+static constexpr std::array<std::uint8_t, MAX_FIXED_DIMENSION + 1>
+index_by_size ()
+{
+  std::array<std::uint8_t, MAX_FIXED_DIMENSION + 1> index {};
+  for (std::size_t i = 0; i < NUM_FIXED_DIMENSIONS; i++)
+  {
+    index[FIXED_DIMENSIONS[i]] = static_cast<std::uint8_t>(i + 1);
+  }
+  return index;
+}
+
+static constexpr auto KERNELS_BY_SIZE = index_by_size ();
+
+/**
+ * builds the table of one instruction set from its kernels.
+ * @tparam Kernels Kernels<N>::get () returns the kernels for size N, or
+ * for any size if N is 0
+ */
+template <template <std::size_t> class Kernels, std::size_t... I>
+static kernel_table build_table (const char *isa, std::index_sequence<I...>)
+{
+  return {isa, {Kernels<0>::get (), Kernels<FIXED_DIMENSIONS[I]>::get ()...}};
+}
+
+template <typename T>
+static double inner_product_portable (const double *vector_1,
+                                      const T *vector_2, std::size_t size)
+{
+  double res = 0.0;
+  for (std::size_t i = 0; i < size; i++)
+  {
+    res += vector_1[i] * static_cast<double>(vector_2[i]);
+  }
+  return res;
+}
+
+/**
+ * the block kernels of every instruction set take this shape. with N = 0
+ * the size is read at run time; otherwise it is the constant N, so the
+ * compiler unrolls the inner product into straight-line code, and the
+ * query is copied to the stack first: the stores to dots cannot alias the
+ * copy, so it stays in registers from one row to the next.
+ */
+template <std::size_t N, typename T>
+static void dot_block_portable (const double *query, const T *rows,
+                                std::size_t num_rows, std::size_t size,
+                                double *dots)
+{
+  if constexpr (N == 0)
+  {
+    for (std::size_t r = 0; r < num_rows; r++)
+    {
+      dots[r] = inner_product_portable (query, rows + r * size, size);
+    }
+  }
+  else
+  {
+    double local[N];
+    std::memcpy (local, query, sizeof (local));
+    for (std::size_t r = 0; r < num_rows; r++)
+    {
+      dots[r] = inner_product_portable (local, rows + r * N, N);
+    }
+  }
+}
+
+template <std::size_t N>
+static double inner_product_portable_sized (const double *vector_1,
+                                            const double *vector_2,
+                                            std::size_t size)
+{
+  return inner_product_portable (vector_1, vector_2, N == 0 ? size : N);
+}
+
+template <std::size_t N>
+struct portable_kernels
+{
+  static dimension_kernels get ()
+  {
+    return {inner_product_portable_sized<N>, dot_block_portable<N, double>,
+            dot_block_portable<N, float>, dot_block_portable<N, std::uint8_t>};
+  }
+};
+
+#ifdef SIMD_KERNELS
+/**
+ * 4 elements of a row, widened to doubles
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256d load_4 (const double *row)
+{
+  return _mm256_loadu_pd (row);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d load_4 (const float *row)
+{
+  return _mm256_cvtps_pd (_mm_loadu_ps (row));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d load_4 (const std::uint8_t *row)
+{
+  std::int32_t bytes;
+  std::memcpy (&bytes, row, sizeof (bytes));
+  return _mm256_cvtepi32_pd (_mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (bytes)));
+}
+
+/**
+ * 4 doubles per register, two independent accumulators to hide the fma
+ * latency, and a scalar loop for the last size % 4 elements.
+ */
+template <typename T>
+__attribute__((target("avx2,fma")))
+static inline double inner_product_avx2_inline (const double *vector_1,
+                                                const T *vector_2,
+                                                std::size_t size)
+{
+  __m256d acc_1 = _mm256_setzero_pd ();
+  __m256d acc_2 = _mm256_setzero_pd ();
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    acc_1 = _mm256_fmadd_pd (_mm256_loadu_pd (vector_1 + i),
+                             load_4 (vector_2 + i), acc_1);
+    acc_2 = _mm256_fmadd_pd (_mm256_loadu_pd (vector_1 + i + 4),
+                             load_4 (vector_2 + i + 4), acc_2);
+  }
+  if (i + 4 <= size)
+  {
+    acc_1 = _mm256_fmadd_pd (_mm256_loadu_pd (vector_1 + i),
+                             load_4 (vector_2 + i), acc_1);
+    i += 4;
+  }
+  acc_1 = _mm256_add_pd (acc_1, acc_2);
+  __m128d half = _mm_add_pd (_mm256_castpd256_pd128 (acc_1),
+                             _mm256_extractf128_pd (acc_1, 1));
+  double res = _mm_cvtsd_f64 (_mm_add_sd (half, _mm_unpackhi_pd (half,
+                                                                 half)));
+  for (; i < size; i++)
+  {
+    res += vector_1[i] * static_cast<double>(vector_2[i]);
+  }
+  return res;
+}
+
+template <std::size_t N>
+__attribute__((target("avx2,fma")))
+static double inner_product_avx2 (const double *vector_1,
+                                  const double *vector_2, std::size_t size)
+{
+  return inner_product_avx2_inline (vector_1, vector_2, N == 0 ? size : N);
+}
+
+template <std::size_t N, typename T>
+__attribute__((target("avx2,fma")))
+static void dot_block_avx2 (const double *query, const T *rows,
+                            std::size_t num_rows, std::size_t size,
+                            double *dots)
+{
+  if constexpr (N == 0)
+  {
+    for (std::size_t r = 0; r < num_rows; r++)
+    {
+      dots[r] = inner_product_avx2_inline (query, rows + r * size, size);
+    }
+  }
+  else
+  {
+    double local[N];
+    std::memcpy (local, query, sizeof (local));
+    for (std::size_t r = 0; r < num_rows; r++)
+    {
+      dots[r] = inner_product_avx2_inline (local, rows + r * N, N);
+    }
+  }
+}
+
+template <std::size_t N>
+struct avx2_kernels
+{
+  static dimension_kernels get ()
+  {
+    return {inner_product_avx2<N>, dot_block_avx2<N, double>,
+            dot_block_avx2<N, float>, dot_block_avx2<N, std::uint8_t>};
+  }
+};
+
+/**
+ * 8 elements of a row, widened to doubles
+ */
+__attribute__((target("avx512f")))
+static inline __m512d load_8 (const double *row)
+{
+  return _mm512_loadu_pd (row);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d load_8 (const float *row)
+{
+  // the maskz forms, unlike the plain ones, do not start from an undefined
+  // register, which gcc warns about
+  return _mm512_maskz_cvtps_pd (0xff, _mm256_loadu_ps (row));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d load_8 (const std::uint8_t *row)
+{
+  return _mm512_maskz_cvtepi32_pd (0xff, _mm256_cvtepu8_epi32
+      (_mm_loadl_epi64 (reinterpret_cast<const __m128i *>(row))));
+}
+
+/**
+ * 8 doubles per register. the tail of a double row is read with a masked
+ * load, so any size runs without a scalar loop; narrower rows finish with
+ * a scalar loop instead.
+ */
+template <typename T>
+__attribute__((target("avx512f")))
+static inline double inner_product_avx512_inline (const double *vector_1,
+                                                  const T *vector_2,
+                                                  std::size_t size)
+{
+  __m512d acc = _mm512_setzero_pd ();
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    acc = _mm512_fmadd_pd (_mm512_loadu_pd (vector_1 + i),
+                           load_8 (vector_2 + i), acc);
+  }
+  double tail = 0.0;
+  if constexpr (std::is_same_v<T, double>)
+  {
+    if (i < size)
+    {
+      auto mask = static_cast<__mmask8>((1u << (size - i)) - 1);
+      acc = _mm512_fmadd_pd (_mm512_maskz_loadu_pd (mask, vector_1 + i),
+                             _mm512_maskz_loadu_pd (mask, vector_2 + i), acc);
+    }
+  }
+  else
+  {
+    // i is size rounded down to 8; counting the tail from size itself lets
+    // the loop vanish when size is a constant multiple of 8
+    for (std::size_t j = size - size % 8; j < size; j++)
+    {
+      tail += vector_1[j] * static_cast<double>(vector_2[j]);
+    }
+  }
+  alignas(64) double lanes[8];
+  _mm512_store_pd (lanes, acc);
+  return ((lanes[0] + lanes[4]) + (lanes[1] + lanes[5]))
+         + ((lanes[2] + lanes[6]) + (lanes[3] + lanes[7])) + tail;
+}
+
+template <std::size_t N>
+__attribute__((target("avx512f")))
+static double inner_product_avx512 (const double *vector_1,
+                                    const double *vector_2, std::size_t size)
+{
+  return inner_product_avx512_inline (vector_1, vector_2,
+                                      N == 0 ? size : N);
+}
+
+template <std::size_t N, typename T>
+__attribute__((target("avx512f")))
+static void dot_block_avx512 (const double *query, const T *rows,
+                              std::size_t num_rows, std::size_t size,
+                              double *dots)
+{
+  if constexpr (N == 0)
+  {
+    for (std::size_t r = 0; r < num_rows; r++)
+    {
+      dots[r] = inner_product_avx512_inline (query, rows + r * size, size);
+    }
+  }
+  else
+  {
+    double local[N];
+    std::memcpy (local, query, sizeof (local));
+    for (std::size_t r = 0; r < num_rows; r++)
+    {
+      dots[r] = inner_product_avx512_inline (local, rows + r * N, N);
+    }
+  }
+}
+
+/**
+ * a row shorter than 8 fits in one avx2 register, and reducing that costs
+ * half as much as reducing a masked avx-512 one, so those sizes run the
+ * avx2 kernels (every avx-512 cpu has avx2).
+ */
+template <std::size_t N>
+struct avx512_kernels
+{
+  static dimension_kernels get ()
+  {
+    if constexpr (N != 0 && N < 8)
+    {
+      return avx2_kernels<N>::get ();
+    }
+    else
+    {
+      return {inner_product_avx512<N>, dot_block_avx512<N, double>,
+              dot_block_avx512<N, float>, dot_block_avx512<N, std::uint8_t>};
+    }
+  }
+};
+#endif
+
+/**
+ * picks the widest implementation the cpu supports.
+ * @return the kernel table to use for the rest of the run
+ */
+static kernel_table select_kernels ()
+{
+  auto dimensions = std::make_index_sequence<NUM_FIXED_DIMENSIONS> ();
+#ifdef SIMD_KERNELS
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx512f"))
+  {
+    return build_table<avx512_kernels> (ISA_AVX512, dimensions);
+  }
+  if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+  {
+    return build_table<avx2_kernels> (ISA_AVX2, dimensions);
+  }
+#endif
+  return build_table<portable_kernels> (ISA_PORTABLE, dimensions);
+}
+
+/**
+ * @return the kernels of this cpu, detected on the first call
+ */
+static const kernel_table& get_kernels ()
+{
+  static const kernel_table kernels = select_kernels ();
+  return kernels;
+}
+
+/**
+ * @param size number of elements of the vectors
+ * @return the kernels for vectors of size elements: ones compiled for
+ * exactly that size if it is one of FIXED_DIMENSIONS, else the generic ones
+ */
+static const dimension_kernels& get_kernels (std::size_t size)
+{
+  return get_kernels ().kernels[size <= MAX_FIXED_DIMENSION
+                                ? KERNELS_BY_SIZE[size] : 0];
+}
+
+double SimilarityKernels::inner_product (const double *vector_1,
+                                         const double *vector_2,
+                                         std::size_t size)
+{
+  return get_kernels (size).inner_product (vector_1, vector_2, size);
+}
+
+double SimilarityKernels::calc_norm (const double *vector, std::size_t size)
+{
+  return std::sqrt (inner_product (vector, vector, size));
+}
+
+void SimilarityKernels::dot_block (const double *query, const double *rows,
+                                   std::size_t num_rows, std::size_t size,
+                                   double *products)
+{
+  get_kernels (size).dot_block (query, rows, num_rows, size, products);
+}
+
+void SimilarityKernels::score_block (const double *query, double query_norm,
+                                     const double *rows, const double *norms,
+                                     std::size_t num_rows, std::size_t size,
+                                     double *scores)
+{
+  get_kernels (size).dot_block (query, rows, num_rows, size, scores);
+  for (std::size_t r = 0; r < num_rows; r++)
+  {
+    scores[r] /= query_norm * norms[r];
+  }
+}
+
+void SimilarityKernels::score_block (const double *query, double query_norm,
+                                     const float *rows, const double *norms,
+                                     std::size_t num_rows, std::size_t size,
+                                     double *scores)
+{
+  get_kernels (size).dot_block_float (query, rows, num_rows, size, scores);
+  for (std::size_t r = 0; r < num_rows; r++)
+  {
+    scores[r] /= query_norm * norms[r];
+  }
+}
+
+/**
+ * row r is offsets[r] + scales[r] * rows[r], so its inner product with the
+ * query is offsets[r] * sum(query) + scales[r] * (query . rows[r]); the
+ * kernels only see the raw bytes.
+ */
+void SimilarityKernels::score_block (const double *query, double query_norm,
+                                     const std::uint8_t *rows,
+                                     const double *scales,
+                                     const double *offsets,
+                                     const double *norms,
+                                     std::size_t num_rows, std::size_t size,
+                                     double *scores)
+{
+  get_kernels (size).dot_block_uint8 (query, rows, num_rows, size, scores);
+  double query_sum = 0.0;
+  for (std::size_t i = 0; i < size; i++)
+  {
+    query_sum += query[i];
+  }
+  for (std::size_t r = 0; r < num_rows; r++)
+  {
+    scores[r] = (offsets[r] * query_sum + scales[r] * scores[r])
+                / (query_norm * norms[r]);
+  }
+}
+
+const char *SimilarityKernels::get_isa ()
+{
+  return get_kernels ().isa;
+}
@@ -0,0 +1,103 @@
+#ifndef SIMILARITYKERNELS_H
+#define SIMILARITYKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * the innermost vector loops of the scoring code, shared by the catalog,
+ * the user profiles and the RecommenderSystem.
+ * every kernel has a portable implementation and, on x86-64, AVX2 and
+ * AVX-512 ones. the best one the cpu supports is picked once, on first use.
+ * the block kernels are templated on how the rows are stored (double,
+ * float or uint8); the query is always double, and narrower rows are
+ * widened to double as they are loaded.
+ * every kernel is also compiled for sizes 4, 8, 16, 32, 64 and 128, with
+ * the size a constant, so its loops unroll into straight-line code with
+ * no tail. a call on one of those sizes runs the matching kernels and any
+ * other size runs the generic ones; the choice is a table lookup built
+ * with the rest of the kernels.
+ */
+class SimilarityKernels
+{
+ public:
+  SimilarityKernels () = delete;
+
+  /**
+   * calculates the inner product of two vectors
+   * @param vector_1 first element of the first vector
+   * @param vector_2 first element of the second vector
+   * @param size number of elements in each vector
+   * @return inner product result
+   */
+  static double inner_product (const double *vector_1,
+                               const double *vector_2, std::size_t size);
+
+  /**
+   * calculates the euclidean norm of a vector
+   * @param vector first element of the vector
+   * @param size number of elements
+   * @return the norm
+   */
+  static double calc_norm (const double *vector, std::size_t size);
+
+  /**
+   * the inner products of one query vector and a block of consecutive rows
+   * of a row-major matrix, in one pass
+   * @param query first element of the query vector
+   * @param rows first element of the first row
+   * @param num_rows number of rows in the block
+   * @param size number of elements in the query and in each row
+   * @param products output, products[r] is the inner product of the query
+   * and row r
+   */
+  static void dot_block (const double *query, const double *rows,
+                         std::size_t num_rows, std::size_t size,
+                         double *products);
+
+  /**
+   * scores one query vector against a block of consecutive rows of a
+   * row-major matrix in one pass: the cosine similarity of the query and
+   * each row, using norms computed in advance.
+   * @param query first element of the query vector
+   * @param query_norm norm of the query vector
+   * @param rows first element of the first row
+   * @param norms norm of each row
+   * @param num_rows number of rows in the block
+   * @param size number of elements in the query and in each row
+   * @param scores output, scores[r] is the similarity of the query and row r
+   */
+  static void score_block (const double *query, double query_norm,
+                           const double *rows, const double *norms,
+                           std::size_t num_rows, std::size_t size,
+                           double *scores);
+
+  /**
+   * score_block over rows stored as float
+   */
+  static void score_block (const double *query, double query_norm,
+                           const float *rows, const double *norms,
+                           std::size_t num_rows, std::size_t size,
+                           double *scores);
+
+  /**
+   * score_block over rows quantized to bytes: element i of row r stands for
+   * offsets[r] + scales[r] * rows[r * size + i].
+   * @param scales scale of each row
+   * @param offsets offset of each row
+   * @param norms norm of each row, as dequantized
+   */
+  static void score_block (const double *query, double query_norm,
+                           const std::uint8_t *rows, const double *scales,
+                           const double *offsets, const double *norms,
+                           std::size_t num_rows, std::size_t size,
+                           double *scores);
+
+  /**
+   * @return name of the instruction set the kernels were picked for:
+   * "avx512", "avx2" or "portable"
+   */
+  static const char *get_isa ();
+};
+
+#endif //SIMILARITYKERNELS_H
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cmath>
+#include "UserNeighbors.h"
+#include "RSUser.h"
+#include "ParallelFor.h"
+
+#define MIN_CO_RATED 2 // fewer co-rated movies make any pearson +-1
+
+/**
+ * the sums of one pair of users over their co-rated movies, kept together
+ * so every rater the build visits costs one cache line
+ */
+struct pair_sums
+{
+  double dot = 0; // sum of x_u * x_v
+  double sum_u = 0; // sum of x_u * x_u
+  double sum_v = 0; // sum of x_v * x_v
+  std::uint32_t co_rated = 0;
+};
+
+/**
+ * buffers one build thread reuses for every user it compares: dense
+ * accumulators indexed by user, reset through the list of touched users.
+ */
+struct compare_scratch
+{
+  std::vector<pair_sums> sums;
+  std::vector<std::uint32_t> touched; // users with co_rated > 0
+  std::vector<std::pair<float, std::uint32_t>> candidates;
+};
+
+/**
+ * the rows are copied first; every user's value of a movie is the
+ * centered rate for PEARSON and the raw rate for COSINE. the inverted
+ * index lists the raters of each movie by ascending user, with their
+ * values, and is only kept during the build.
+ */
+UserNeighbors::UserNeighbors (const std::vector<RSUser>& users,
+                              std::size_t k, user_similarity similarity,
+                              unsigned n_threads)
+    : _k (k), _similarity (similarity)
+{
+  std::size_t num_users = users.size ();
+  _offsets.assign (1, 0);
+  _offsets.reserve (num_users + 1);
+  _means.reserve (num_users);
+  _index.reserve (num_users);
+  movie_id num_movies = 0;
+  for (std::size_t user = 0; user < num_users; user++)
+  {
+    _index.emplace (users[user].get_name (), user);
+    RatingsView ratings = users[user].get_ratings ();
+    double sum = 0;
+    for (const auto& elem : ratings)
+    {
+      sum += elem.second;
+    }
+    double mean = ratings.get_size () == 0 ? 0 : sum / ratings.get_size ();
+    for (const auto& elem : ratings)
+    {
+      _ids.push_back (elem.first);
+      _centered.push_back (static_cast<float>(elem.second - mean));
+      num_movies = std::max<movie_id> (num_movies, elem.first + 1);
+    }
+    _means.push_back (mean);
+    _offsets.push_back (_ids.size ());
+  }
+  auto value = [&] (std::size_t user, std::size_t i)
+  {
+    return _similarity == user_similarity::PEARSON
+           ? static_cast<double>(_centered[i])
+           : _centered[i] + _means[user];
+  };
+  std::vector<double> norms (num_users, 0); // of the raw rates, for COSINE
+  std::vector<std::size_t> rater_offsets (num_movies + 1, 0);
+  for (std::size_t user = 0; user < num_users; user++)
+  {
+    for (std::size_t i = _offsets[user]; i < _offsets[user + 1]; i++)
+    {
+      norms[user] += value (user, i) * value (user, i);
+      rater_offsets[_ids[i] + 1]++;
+    }
+    norms[user] = std::sqrt (norms[user]);
+  }
+  for (movie_id movie = 0; movie < num_movies; movie++)
+  {
+    rater_offsets[movie + 1] += rater_offsets[movie];
+  }
+  std::vector<std::uint32_t> raters (_ids.size ());
+  std::vector<double> rater_values (_ids.size ());
+  std::vector<std::size_t> fill (rater_offsets.begin (),
+                                 rater_offsets.end () - 1);
+  for (std::size_t user = 0; user < num_users; user++)
+  {
+    for (std::size_t i = _offsets[user]; i < _offsets[user + 1]; i++)
+    {
+      std::size_t pos = fill[_ids[i]]++;
+      raters[pos] = static_cast<std::uint32_t>(user);
+      rater_values[pos] = value (user, i);
+    }
+  }
+
+  _neighbors.resize (num_users * _k);
+  _similarities.resize (num_users * _k);
+  _counts.assign (num_users, 0);
+  std::vector<compare_scratch> scratch (resolve_num_threads (n_threads));
+  parallel_for_each (0, num_users, n_threads,
+                     [&] (std::size_t user, unsigned worker)
+  {
+    compare_scratch& cur = scratch[worker];
+    cur.sums.resize (num_users);
+    cur.touched.clear ();
+    cur.candidates.clear ();
+    for (std::size_t i = _offsets[user]; i < _offsets[user + 1]; i++)
+    {
+      double x_u = value (user, i);
+      for (std::size_t r = rater_offsets[_ids[i]];
+           r < rater_offsets[_ids[i] + 1]; r++)
+      {
+        std::uint32_t other = raters[r];
+        if (other == user)
+        {
+          continue;
+        }
+        pair_sums& sums = cur.sums[other];
+        if (sums.co_rated++ == 0)
+        {
+          cur.touched.push_back (other);
+        }
+        sums.dot += x_u * rater_values[r];
+        sums.sum_u += x_u * x_u;
+        sums.sum_v += rater_values[r] * rater_values[r];
+      }
+    }
+    for (std::uint32_t other : cur.touched)
+    {
+      const pair_sums& sums = cur.sums[other];
+      double sim;
+      if (_similarity == user_similarity::PEARSON)
+      {
+        sim = sums.co_rated < MIN_CO_RATED ? 0
+              : sums.dot / std::sqrt (sums.sum_u * sums.sum_v);
+      }
+      else
+      {
+        sim = sums.dot / (norms[user] * norms[other]);
+      }
+      if (sim > 0) // also drops the NaN of a constant row
+      {
+        cur.candidates.emplace_back (static_cast<float>(sim), other);
+      }
+      cur.sums[other] = pair_sums ();
+    }
+    std::size_t count = std::min (_k, cur.candidates.size ());
+    std::partial_sort (cur.candidates.begin (),
+                       cur.candidates.begin () + count,
+                       cur.candidates.end (),
+                       [] (const std::pair<float, std::uint32_t>& a,
+                           const std::pair<float, std::uint32_t>& b)
+                       {
+                         return a.first > b.first
+                                || (a.first == b.first
+                                    && a.second < b.second);
+                       });
+    for (std::size_t i = 0; i < count; i++)
+    {
+      _similarities[user * _k + i] = cur.candidates[i].first;
+      _neighbors[user * _k + i] = cur.candidates[i].second;
+    }
+    _counts[user] = static_cast<std::uint32_t>(count);
+  });
+}
+
+/**
+ * the rows are laid out again in user order: a changed user's row is
+ * rebuilt from its ratings, every other row is copied as is.
+ */
+UserNeighbors::UserNeighbors (const UserNeighbors& model,
+                              const std::vector<const RSUser *>& changed)
+    : _k (model._k), _similarity (model._similarity), _index (model._index),
+      _means (model._means), _neighbors (model._neighbors),
+      _similarities (model._similarities), _counts (model._counts)
+{
+  std::vector<const RSUser *> rebuilt (_means.size (), nullptr);
+  for (const RSUser *user : changed)
+  {
+    std::size_t index = find_user (user->get_name ());
+    if (index != INVALID_USER)
+    {
+      rebuilt[index] = user;
+    }
+  }
+  _offsets.reserve (model._offsets.size ());
+  _offsets.assign (1, 0);
+  _ids.reserve (model._ids.size ());
+  _centered.reserve (model._centered.size ());
+  for (std::size_t user = 0; user < _means.size (); user++)
+  {
+    if (rebuilt[user] == nullptr)
+    {
+      std::size_t begin = model._offsets[user];
+      std::size_t end = model._offsets[user + 1];
+      _ids.insert (_ids.end (), model._ids.begin () + begin,
+                   model._ids.begin () + end);
+      _centered.insert (_centered.end (), model._centered.begin () + begin,
+                        model._centered.begin () + end);
+    }
+    else
+    {
+      RatingsView ratings = rebuilt[user]->get_ratings ();
+      double mean = rebuilt[user]->get_profile ().get_mean ();
+      for (const auto& elem : ratings)
+      {
+        _ids.push_back (elem.first);
+        _centered.push_back (static_cast<float>(elem.second - mean));
+      }
+      _means[user] = mean;
+    }
+    _offsets.push_back (_ids.size ());
+  }
+}
+
+std::size_t UserNeighbors::find_user (const std::string& name) const
+{
+  auto it = _index.find (name);
+  return it == _index.end () ? INVALID_USER : it->second;
+}
+
+/**
+ * the neighbors are sorted by similarity, so the first k that rated the
+ * movie are the k most similar raters the list knows of. a neighbor's rate
+ * is found by binary search in its sorted row.
+ */
+double UserNeighbors::predict (std::size_t user, movie_id movie, int k,
+                               double mean) const
+{
+  const std::uint32_t *neighbors = get_neighbors (user);
+  const float *similarities = get_similarities (user);
+  double numerator = 0;
+  double denominator = 0;
+  int found = 0;
+  for (std::size_t i = 0; i < _counts[user] && found < k; i++)
+  {
+    const movie_id *first = _ids.data () + _offsets[neighbors[i]];
+    const movie_id *last = _ids.data () + _offsets[neighbors[i] + 1];
+    const movie_id *it = std::lower_bound (first, last, movie);
+    if (it != last && *it == movie)
+    {
+      numerator += similarities[i] * _centered[it - _ids.data ()];
+      denominator += similarities[i];
+      found++;
+    }
+  }
+  if (found == 0)
+  {
+    return mean;
+  }
+  return mean + numerator / denominator;
+}
+
+std::size_t UserNeighbors::get_k () const
+{
+  return _k;
+}
+
+user_similarity UserNeighbors::get_similarity () const
+{
+  return _similarity;
+}
+
+std::size_t UserNeighbors::get_num_users () const
+{
+  return _means.size ();
+}
+
+std::size_t UserNeighbors::get_count (std::size_t user) const
+{
+  return _counts[user];
+}
+
+const std::uint32_t *UserNeighbors::get_neighbors (std::size_t user) const
+{
+  return _neighbors.data () + user * _k;
+}
+
+const float *UserNeighbors::get_similarities (std::size_t user) const
+{
+  return _similarities.data () + user * _k;
+}
@@ -0,0 +1,124 @@
+#ifndef USERNEIGHBORS_H
+#define USERNEIGHBORS_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Recommendation.h"
+
+class RSUser;
+
+/**
+ * how UserNeighbors compares two users
+ */
+enum class user_similarity
+{
+  PEARSON, // correlation of the mean-centered rates of the co-rated movies
+  COSINE   // cosine of the raw rate vectors, unrated movies counting as 0
+};
+
+/**
+ * user-user collaborative filtering over the sparse ratings of a set of
+ * users: the k most similar users of every user, and predictions from
+ * their mean-centered rates.
+ * the lists are built through an inverted index (movie -> raters), so two
+ * users are only ever compared on the movies they both rated and users
+ * with no movie in common are never compared. the neighbor lists are a
+ * snapshot of the ratings they were built from, and are only recomputed by
+ * building the model again. the rows and means the predictions read are
+ * brought up to date by RatingIngestor after every batch (see
+ * RecommenderSystem::update_user_neighbors), and a prediction is always
+ * offset from the user's live mean. users are identified by name.
+ */
+class UserNeighbors
+{
+ private:
+  std::size_t _k;
+  user_similarity _similarity;
+  std::unordered_map<std::string, std::size_t> _index; // name -> user
+  std::vector<std::size_t> _offsets; // row <user> is [offsets[user],
+                                     // offsets[user + 1])
+  std::vector<movie_id> _ids; // rated movies of every row, ascending
+  std::vector<float> _centered; // rate - mean, parallel to _ids
+  std::vector<double> _means;
+  std::vector<std::uint32_t> _neighbors; // row <user> holds its neighbors
+  std::vector<float> _similarities; // parallel to _neighbors
+  std::vector<std::uint32_t> _counts; // valid entries in each row
+
+ public:
+  /**
+   * builds the model
+   * @param users the users to compare
+   * @param k the number of neighbors to keep per user
+   * @param similarity user_similarity
+   * @param n_threads number of threads, 0 for one per hardware thread
+   */
+  UserNeighbors (const std::vector<RSUser>& users, std::size_t k,
+                 user_similarity similarity, unsigned n_threads);
+
+  /**
+   * copies a model, rebuilding the rows and means of some users from their
+   * current ratings. the neighbor lists are kept as they were built.
+   * @param model the model to copy
+   * @param changed users whose ratings changed; those the model does not
+   * know are skipped
+   */
+  UserNeighbors (const UserNeighbors& model,
+                 const std::vector<const RSUser *>& changed);
+
+  /**
+   * @param name name of a user
+   * @return the user's index in the model, INVALID_USER if it has none
+   */
+  std::size_t find_user (const std::string& name) const;
+
+  /**
+   * predicts the user's rate of a movie as the user's mean plus the
+   * similarity weighted mean offset of the k most similar neighbors that
+   * rated it
+   * @param user index of the user, see find_user
+   * @param movie movie_id of the movie
+   * @param k number of neighbors to use, at most get_k()
+   * @param mean the user's current mean rate
+   * @return the predicted rate; mean if no neighbor rated it
+   */
+  double predict (std::size_t user, movie_id movie, int k,
+                  double mean) const;
+
+  /**
+   * @return the number of neighbors kept per user
+   */
+  std::size_t get_k () const;
+
+  /**
+   * @return the similarity the lists were built with
+   */
+  user_similarity get_similarity () const;
+
+  /**
+   * @return the number of users in the model
+   */
+  std::size_t get_num_users () const;
+
+  /**
+   * @param user index of a user
+   * @return number of neighbors in the user's list (at most get_k())
+   */
+  std::size_t get_count (std::size_t user) const;
+
+  /**
+   * @param user index of a user
+   * @return indices of the user's neighbors, most similar first
+   */
+  const std::uint32_t *get_neighbors (std::size_t user) const;
+
+  /**
+   * @param user index of a user
+   * @return similarities of the user's neighbors, parallel to
+   * get_neighbors()
+   */
+  const float *get_similarities (std::size_t user) const;
+};
+
+#endif //USERNEIGHBORS_H
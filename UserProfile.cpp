@@ -0,0 +1,154 @@
+#include "UserProfile.h"
+#include "SimilarityKernels.h"
+#include "Metrics.h"
+#include <algorithm>
+
+#define WEIGHTED_SUM_ROW 0
+#define FEATURES_SUM_ROW 1
+#define PREFERENCE_ROW 2
+
+UserProfile::UserProfile () : _sum_rates (0), _num_rated (0),
+                              _rows_version (0), _size (0),
+                              _rows (nullptr), _preference_norm (0)
+{
+}
+
+UserProfile::UserProfile (const UserProfile& other)
+    : _sum_rates (other._sum_rates), _num_rated (other._num_rated),
+      _rows_version (other._rows_version), _size (other._size),
+      _buffer (other._rows, other._rows + PROFILE_ROWS * other._size),
+      _rows (_buffer.data ()), _preference_norm (other._preference_norm)
+{
+}
+
+UserProfile& UserProfile::operator= (const UserProfile& other)
+{
+  if (this != &other)
+  {
+    *this = UserProfile (other);
+  }
+  return *this;
+}
+
+/**
+ * zeroes the sums for a number of features, in the profile's own buffer
+ * @param size std::size_t
+ */
+void UserProfile::resize (std::size_t size)
+{
+  _size = size;
+  _buffer.assign (PROFILE_ROWS * size, 0.0);
+  _rows = _buffer.data ();
+}
+
+UserProfile::UserProfile (const RatingsView& ratings,
+                          const MovieCatalog& catalog, MonotonicArena *arena)
+    : UserProfile ()
+{
+  RS_METRICS_TIME (PROFILE_BUILD);
+  _rows_version = catalog.get_rows_version ();
+  std::size_t size = catalog.get_num_features ();
+  if (arena != nullptr)
+  {
+    _size = size;
+    _rows = arena->allocate_array<double> (PROFILE_ROWS * size);
+    std::fill (_rows, _rows + PROFILE_ROWS * size, 0.0);
+  }
+  else
+  {
+    resize (size);
+  }
+  double *weighted_sum = _rows + WEIGHTED_SUM_ROW * size;
+  double *features_sum = _rows + FEATURES_SUM_ROW * size;
+  for (const auto& elem : ratings)
+  {
+    const double *features = catalog.get_features (elem.first);
+    for (std::size_t i = 0; i < size; i++)
+    {
+      weighted_sum[i] += elem.second * features[i];
+      features_sum[i] += features[i];
+    }
+    _sum_rates += elem.second;
+  }
+  _num_rated = ratings.get_size ();
+  update_preference ();
+}
+
+/**
+ * recomputes the preference vector and its norm from the running sums.
+ */
+void UserProfile::update_preference ()
+{
+  double mean = get_mean ();
+  const double *weighted_sum = _rows + WEIGHTED_SUM_ROW * _size;
+  const double *features_sum = _rows + FEATURES_SUM_ROW * _size;
+  double *preference = _rows + PREFERENCE_ROW * _size;
+  for (std::size_t i = 0; i < _size; i++)
+  {
+    preference[i] = weighted_sum[i] - mean * features_sum[i];
+  }
+  _preference_norm = SimilarityKernels::calc_norm (preference, _size);
+}
+
+void UserProfile::add_rating (const double *features, std::size_t size,
+                              double rate)
+{
+  double *weighted_sum = _rows + WEIGHTED_SUM_ROW * size;
+  double *features_sum = _rows + FEATURES_SUM_ROW * size;
+  for (std::size_t i = 0; i < size; i++)
+  {
+    weighted_sum[i] += rate * features[i];
+    features_sum[i] += features[i];
+  }
+  _sum_rates += rate;
+  _num_rated++;
+  update_preference ();
+}
+
+void UserProfile::remove_rating (const double *features, std::size_t size,
+                                 double rate)
+{
+  double *weighted_sum = _rows + WEIGHTED_SUM_ROW * size;
+  double *features_sum = _rows + FEATURES_SUM_ROW * size;
+  for (std::size_t i = 0; i < size; i++)
+  {
+    weighted_sum[i] -= rate * features[i];
+    features_sum[i] -= features[i];
+  }
+  _sum_rates -= rate;
+  _num_rated--;
+  update_preference ();
+}
+
+void UserProfile::change_rating (const double *features, std::size_t size,
+                                 double old_rate, double new_rate)
+{
+  double delta = new_rate - old_rate;
+  double *weighted_sum = _rows + WEIGHTED_SUM_ROW * size;
+  for (std::size_t i = 0; i < size; i++)
+  {
+    weighted_sum[i] += delta * features[i];
+  }
+  _sum_rates += delta;
+  update_preference ();
+}
+
+double UserProfile::get_mean () const
+{
+  return _sum_rates / _num_rated;
+}
+
+const double *UserProfile::get_preference () const
+{
+  return _rows + PREFERENCE_ROW * _size;
+}
+
+double UserProfile::get_preference_norm () const
+{
+  return _preference_norm;
+}
+
+bool UserProfile::is_current (const MovieCatalog& catalog) const
+{
+  return _rows_version == catalog.get_rows_version ();
+}
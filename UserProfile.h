@@ -0,0 +1,110 @@
+#ifndef USERPROFILE_H
+#define USERPROFILE_H
+
+#include <vector>
+#include "MonotonicArena.h"
+#include "MovieCatalog.h"
+#include "UserRatings.h"
+
+#define PROFILE_ROWS 3 // rows of features in a profile's buffer
+
+/**
+ * the parts of a user that content based scoring needs, kept up to date as
+ * ratings change instead of being rebuilt per recommendation.
+ * the preference vector is sum((rate_i - mean) * features_i), which equals
+ * sum(rate_i * features_i) - mean * sum(features_i), so keeping those two
+ * sums and the sum of rates makes adding or removing a rating O(features).
+ * the sums and the preference vector are one buffer, either the profile's
+ * own or carved out of an arena; a copy always owns its buffer.
+ * the sums hold the features the movies had when they were rated, so once
+ * the catalog changes the row of a movie (see
+ * MovieCatalog::get_rows_version) the profile is stale and must be rebuilt.
+ */
+class UserProfile
+{
+ private:
+  double _sum_rates;
+  std::size_t _num_rated;
+  std::uint64_t _rows_version; // of the catalog the profile was built with
+  std::size_t _size; // number of features
+  // three rows of _size: the sum of rate_i * features_i, the sum of
+  // features_i and the preference vector. _rows is _buffer.data(), or
+  // memory in an arena while _buffer is empty.
+  std::vector<double> _buffer;
+  double *_rows;
+  double _preference_norm;
+
+  void resize (std::size_t size);
+  void update_preference ();
+
+ public:
+  UserProfile ();
+
+  /**
+   * builds the profile of a user from scratch. the ratings must not be
+   * empty, which the loaders and RSUser make sure of, so the mean is always
+   * defined and the buffer always has the catalog's number of features
+   * @param ratings the user's ratings
+   * @param catalog the catalog the rated ids belong to
+   * @param arena if not null, the buffer is carved out of it, and it must
+   * outlive the profile
+   */
+  UserProfile (const RatingsView& ratings, const MovieCatalog& catalog,
+               MonotonicArena *arena = nullptr);
+
+  UserProfile (const UserProfile& other);
+  UserProfile& operator= (const UserProfile& other);
+  UserProfile (UserProfile&& other) noexcept = default;
+  UserProfile& operator= (UserProfile&& other) noexcept = default;
+
+  /**
+   * accounts for a new rating
+   * @param features features of the rated movie
+   * @param size number of features
+   * @param rate the user's rate
+   */
+  void add_rating (const double *features, std::size_t size, double rate);
+
+  /**
+   * takes back a rating previously passed to add_rating, which must not
+   * be the last one
+   * @param features features of the rated movie, as they were when added
+   * @param size number of features
+   * @param rate the rate that was added
+   */
+  void remove_rating (const double *features, std::size_t size, double rate);
+
+  /**
+   * replaces the rate of a movie already passed to add_rating, at the cost of
+   * a single pass over the features
+   * @param features features of the rated movie, as they were when added
+   * @param size number of features
+   * @param old_rate the rate that was added
+   * @param new_rate the rate that replaces it
+   */
+  void change_rating (const double *features, std::size_t size,
+                      double old_rate, double new_rate);
+
+  /**
+   * @return mean of the user's rates
+   */
+  double get_mean () const;
+
+  /**
+   * @return the user's preference vector, one element per feature
+   */
+  const double *get_preference () const;
+
+  /**
+   * @return norm of the preference vector
+   */
+  double get_preference_norm () const;
+
+  /**
+   * @param catalog the catalog the rated ids belong to
+   * @return true if no row of catalog changed since the profile was built
+   */
+  bool is_current (const MovieCatalog& catalog) const;
+};
+
+#endif //USERPROFILE_H
@@ -0,0 +1,143 @@
+#include "UserRatings.h"
+#include <algorithm>
+
+/**
+ * sorts the pairs by movie id (stable, so a later duplicate stays later)
+ * and drops all but the last rate of a duplicated movie.
+ * @param entries std::vector<rating_entry>
+ */
+void UserRatings::sort_entries (std::vector<rating_entry>& entries)
+{
+  auto by_id = [] (const rating_entry& e1, const rating_entry& e2)
+  {
+      return e1.first < e2.first;
+  };
+  // rows read in the order of the catalog are sorted already, and
+  // stable_sort would allocate a buffer for them anyway:
+  if (!std::is_sorted (entries.begin (), entries.end (), by_id))
+  {
+    std::stable_sort (entries.begin (), entries.end (), by_id);
+  }
+  std::size_t size = 0;
+  for (const auto& entry : entries)
+  {
+    if (size > 0 && entries[size - 1].first == entry.first)
+    {
+      entries[size - 1].second = entry.second;
+      continue;
+    }
+    entries[size++] = entry;
+  }
+  entries.resize (size);
+}
+
+/**
+ * splits the sorted pairs into the id and rate arrays.
+ * @param entries std::vector<rating_entry>
+ */
+UserRatings::UserRatings (std::vector<rating_entry> entries)
+{
+  sort_entries (entries);
+  _ids.reserve (entries.size ());
+  _rates.reserve (entries.size ());
+  for (const auto& entry : entries)
+  {
+    _ids.push_back (entry.first);
+    _rates.push_back (entry.second);
+  }
+}
+
+UserRatings::UserRatings (std::vector<rating_entry>& entries,
+                          MonotonicArena& arena)
+{
+  sort_entries (entries);
+  auto *ids = arena.allocate_array<movie_id> (entries.size ());
+  auto *rates = arena.allocate_array<double> (entries.size ());
+  for (std::size_t i = 0; i < entries.size (); i++)
+  {
+    ids[i] = entries[i].first;
+    rates[i] = entries[i].second;
+  }
+  _arena_ids = ids;
+  _arena_rates = rates;
+  _arena_size = entries.size ();
+}
+
+/**
+ * copies a row kept in an arena into the row's own arrays, so it can be
+ * changed. does nothing if the row already owns them.
+ */
+void UserRatings::own_row ()
+{
+  if (_arena_ids == nullptr)
+  {
+    return;
+  }
+  _ids.assign (_arena_ids, _arena_ids + _arena_size);
+  _rates.assign (_arena_rates, _arena_rates + _arena_size);
+  _arena_ids = nullptr;
+  _arena_rates = nullptr;
+  _arena_size = 0;
+}
+
+/**
+ * finds the position of the movie by binary search and overwrites or
+ * inserts there, so the row stays sorted.
+ * @param id movie_id
+ * @param rate double
+ */
+void UserRatings::set_rate (movie_id id, double rate)
+{
+  own_row ();
+  auto it = std::lower_bound (_ids.begin (), _ids.end (), id);
+  auto pos = it - _ids.begin ();
+  if (it != _ids.end () && *it == id)
+  {
+    _rates[pos] = rate;
+    return;
+  }
+  _ids.insert (it, id);
+  _rates.insert (_rates.begin () + pos, rate);
+}
+
+bool UserRatings::remove_rate (movie_id id)
+{
+  if (find_rate (id) == nullptr)
+  {
+    return false;
+  }
+  own_row ();
+  auto it = std::lower_bound (_ids.begin (), _ids.end (), id);
+  _rates.erase (_rates.begin () + (it - _ids.begin ()));
+  _ids.erase (it);
+  return true;
+}
+
+const double *RatingsView::find_rate (movie_id id) const
+{
+  const movie_id *it = std::lower_bound (_ids, _ids + _size, id);
+  if (it == _ids + _size || *it != id)
+  {
+    return nullptr;
+  }
+  return _rates + (it - _ids);
+}
+
+const double *UserRatings::find_rate (movie_id id) const
+{
+  return get_view ().find_rate (id);
+}
+
+std::size_t UserRatings::get_size () const
+{
+  return get_view ().get_size ();
+}
+
+RatingsView UserRatings::get_view () const
+{
+  if (_arena_ids != nullptr)
+  {
+    return {_arena_ids, _arena_rates, _arena_size};
+  }
+  return {_ids.data (), _rates.data (), _ids.size ()};
+}
@@ -0,0 +1,163 @@
+#ifndef USERRATINGS_H
+#define USERRATINGS_H
+
+#include <cmath>
+#include <vector>
+#include "MonotonicArena.h"
+#include "MovieCatalog.h"
+
+#define MIN_RATE 1.0
+#define MAX_RATE 10.0
+
+typedef std::pair<movie_id, double> rating_entry; // movie id, user rate
+
+/**
+ * the one rule for a user's rate, shared by the users file and by ratings
+ * changed at runtime
+ * @param rate double
+ * @return true if rate is a whole number from MIN_RATE to MAX_RATE (so not
+ * NaN)
+ */
+inline bool is_valid_rate (double rate)
+{
+  return rate >= MIN_RATE && rate <= MAX_RATE && rate == std::trunc (rate);
+}
+
+/**
+ * a read-only, non-owning view of a user's ratings. copying it copies two
+ * pointers and a size, never the ratings, and it can be used in a range for
+ * loop over rating_entry. it is invalidated when the row it views changes.
+ */
+class RatingsView
+{
+ private:
+  const movie_id *_ids;
+  const double *_rates;
+  std::size_t _size;
+
+ public:
+  class iterator
+  {
+   private:
+    const movie_id *_id;
+    const double *_rate;
+
+   public:
+    iterator (const movie_id *id, const double *rate) : _id (id),
+                                                        _rate (rate) {}
+    rating_entry operator* () const { return {*_id, *_rate}; }
+    iterator& operator++ ()
+    {
+      ++_id;
+      ++_rate;
+      return *this;
+    }
+    bool operator!= (const iterator& other) const
+    {
+      return _id != other._id;
+    }
+  };
+
+  RatingsView (const movie_id *ids, const double *rates, std::size_t size)
+      : _ids (ids), _rates (rates), _size (size) {}
+
+  /**
+   * @return ids of the rated movies, in ascending order
+   */
+  const movie_id *get_ids () const { return _ids; }
+
+  /**
+   * @return rates of the rated movies, parallel to get_ids()
+   */
+  const double *get_rates () const { return _rates; }
+
+  /**
+   * @return number of rated movies
+   */
+  std::size_t get_size () const { return _size; }
+
+  /**
+   * @param id id of a movie
+   * @return pointer to the user's rate for the movie, or nullptr if the
+   * user did not rate it
+   */
+  const double *find_rate (movie_id id) const;
+
+  iterator begin () const { return {_ids, _rates}; }
+  iterator end () const { return {_ids + _size, _rates + _size}; }
+};
+
+/**
+ * one user's row of the sparse rating matrix: only the movies the user
+ * actually rated, as two parallel arrays sorted by movie id (the column and
+ * value arrays of a CSR row). a movie that is not in the row is unrated, so
+ * the unrated set is the complement of the row's ids against the catalog.
+ * a row may also be carved out of a MonotonicArena, which costs no
+ * allocation of its own; it is then copied into the row's own arrays on the
+ * first change, and the arena must outlive the row until then.
+ */
+class UserRatings
+{
+ private:
+  std::vector<movie_id> _ids; // sorted, unique
+  std::vector<double> _rates; // _rates[i] is the rate of _ids[i]
+  // a row in an arena, used instead of _ids and _rates while _arena_ids is
+  // set:
+  const movie_id *_arena_ids = nullptr;
+  const double *_arena_rates = nullptr;
+  std::size_t _arena_size = 0;
+
+  static void sort_entries (std::vector<rating_entry>& entries);
+  void own_row ();
+
+ public:
+  UserRatings () = default;
+
+  /**
+   * builds a row from (movie id, rate) pairs in any order. if a movie
+   * appears more than once, its last rate is kept.
+   * @param entries rated movies
+   */
+  explicit UserRatings (std::vector<rating_entry> entries);
+
+  /**
+   * same, with the row carved out of an arena
+   * @param entries rated movies; sorted in place and left with one entry
+   * per movie
+   * @param arena where the row is kept, must outlive the row
+   */
+  UserRatings (std::vector<rating_entry>& entries, MonotonicArena& arena);
+
+  /**
+   * rates a movie, or overwrites the rate of a movie already rated
+   * @param id id of the movie
+   * @param rate the user's rate
+   */
+  void set_rate (movie_id id, double rate);
+
+  /**
+   * unrates a movie
+   * @param id id of the movie
+   * @return false if the user did not rate the movie
+   */
+  bool remove_rate (movie_id id);
+
+  /**
+   * @param id id of a movie
+   * @return pointer to the user's rate for the movie, or nullptr if the
+   * user did not rate it
+   */
+  const double *find_rate (movie_id id) const;
+
+  /**
+   * @return number of rated movies
+   */
+  std::size_t get_size () const;
+
+  /**
+   * @return a view of the row, valid until the row is next changed
+   */
+  RatingsView get_view () const;
+};
+
+#endif //USERRATINGS_H
@@ -0,0 +1,226 @@
+/**
+ * checks that every bad input file of the repository is rejected with the
+ * error it was written for, and that the sample files still load. it also
+ * saves a snapshot of the sample files, corrupts a feature and a norm of
+ * copies of it, and checks that loading rejects them even without
+ * verifying the checksum, the way a corruption the checksum misses would
+ * look.
+ * build from the repository root:
+ *   g++ -std=c++17 -O2 -pthread -I. *.cpp tools/CheckBadInputs.cpp
+ *       -o check_bad_inputs
+ * usage:
+ *   check_bad_inputs [--dir path]
+ * the input files are read from the current directory, and the snapshots
+ * are written to --dir, the system's temporary directory by default. exits
+ * with a failure if any input is not handled as expected.
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include "RecommenderSnapshot.h"
+#include "RecommenderSystemLoader.h"
+#include "RSUsersLoader.h"
+
+#define USAGE "usage: check_bad_inputs [--dir path]"
+#define SAMPLE_MOVIES "RecommenderSystemLoader_input.txt"
+#define SAMPLE_USERS "RSUsersLoader_input.txt"
+#define SNAPSHOT "check_bad_inputs.snap"
+#define CORRUPT_SNAPSHOT "check_bad_inputs_corrupt.snap"
+// the errors the loaders throw:
+#define RANGE_ERROR "ERROR: data out of range (1.0 - 10.0)."
+#define RATING_ERROR "ERROR: every rating must be NA or a whole number " \
+                     "from 1 to 10."
+#define SNAPSHOT_FORMAT_ERROR "ERROR: not a valid snapshot file."
+#define FIRST_ROW {3.0, 4.0, 5.0, 6.0} // of the sample movies file
+
+/**
+ * a file that must be rejected, and how
+ */
+struct bad_input
+{
+  const char *movies_path;
+  const char *users_path; // nullptr to only load the movies
+  const char *error;
+};
+
+static const bad_input BAD_INPUTS[] = {
+    {"RecommenderSystemLoader_bad_input1.txt", nullptr, RANGE_ERROR},
+    {"RecommenderSystemLoader_bad_input2.txt", nullptr, RANGE_ERROR},
+    {"RecommenderSystemLoader_bad_input3.txt", nullptr, RANGE_ERROR},
+    {SAMPLE_MOVIES, "RSUsersLoader_bad_input1.txt", RATING_ERROR},
+    {SAMPLE_MOVIES, "RSUsersLoader_bad_input2.txt", RATING_ERROR}};
+
+/**
+ * loads a movies file, and a users file if there is one
+ * @param movies_path path of the movies file
+ * @param users_path path of the users file, or nullptr
+ */
+static void load_files (const char *movies_path, const char *users_path)
+{
+  std::shared_ptr<RecommenderSystem> rs = RecommenderSystemLoader::
+      create_rs_from_movies_file (movies_path);
+  if (users_path != nullptr)
+  {
+    RSUsersLoader::create_users_from_file (users_path, rs);
+  }
+}
+
+/**
+ * runs a load that must throw error
+ * @param name what is loaded, for the report
+ * @param error the message expected
+ * @param load callable that loads the input
+ * @return true if it threw error
+ */
+template <typename Load>
+static bool expect_error (const std::string& name, const char *error,
+                          Load load)
+{
+  try
+  {
+    load ();
+    std::cerr << name << ": loaded, expected \"" << error << "\""
+              << std::endl;
+    return false;
+  }
+  catch (const std::exception& e)
+  {
+    if (std::strcmp (e.what (), error) != 0)
+    {
+      std::cerr << name << ": \"" << e.what () << "\", expected \"" << error
+                << "\"" << std::endl;
+      return false;
+    }
+  }
+  std::cout << name << ": rejected" << std::endl;
+  return true;
+}
+
+/**
+ * writes a copy of a file with the bytes of one double replaced
+ * @param contents the file
+ * @param path path of the copy
+ * @param offset where the double starts in contents
+ * @param value the new double
+ */
+static void write_patched (std::string contents, const std::string& path,
+                           std::size_t offset, double value)
+{
+  std::memcpy (&contents[offset], &value, sizeof (value));
+  std::ofstream out (path, std::ios::binary | std::ios::trunc);
+  out.write (contents.data (), static_cast<std::streamsize>
+                                   (contents.size ()));
+  if (!out)
+  {
+    throw std::runtime_error ("ERROR: could not write to " + path);
+  }
+}
+
+/**
+ * saves the sample files as a snapshot, which must load back, and checks
+ * that copies with a feature out of range, a NaN feature and a wrong norm
+ * are rejected with the checksum unchecked
+ * @param dir directory of the snapshots
+ * @return number of failed checks
+ */
+static int check_snapshots (const std::string& dir)
+{
+  std::string path = dir + "/" + SNAPSHOT;
+  std::string corrupt_path = dir + "/" + CORRUPT_SNAPSHOT;
+  RecommenderSnapshot::convert_text_files (SAMPLE_MOVIES, SAMPLE_USERS, path);
+  std::vector<RSUser> users;
+  RecommenderSnapshot::load_snapshot (path, users);
+  std::ifstream in (path, std::ios::binary);
+  std::string contents ((std::istreambuf_iterator<char> (in)),
+                        std::istreambuf_iterator<char> ());
+  const double row[] = FIRST_ROW;
+  double norm = std::sqrt (3.0 * 3.0 + 4.0 * 4.0 + 5.0 * 5.0 + 6.0 * 6.0);
+  std::size_t row_offset = contents.find (std::string
+      (reinterpret_cast<const char *>(row), sizeof (row)));
+  std::size_t norm_offset = contents.find (std::string
+      (reinterpret_cast<const char *>(&norm), sizeof (norm)));
+  if (row_offset == std::string::npos || norm_offset == std::string::npos)
+  {
+    std::cerr << path << ": the first row or its norm was not found"
+              << std::endl;
+    return 1;
+  }
+  struct
+  {
+    const char *name;
+    std::size_t offset;
+    double value;
+  } patches[] = {
+      {"feature out of range", row_offset + sizeof (double), 11.0},
+      {"NaN feature", row_offset + sizeof (double),
+       std::numeric_limits<double>::quiet_NaN ()},
+      {"wrong norm", norm_offset, norm * 1.5}};
+  int num_failed = 0;
+  for (const auto& patch : patches)
+  {
+    write_patched (contents, corrupt_path, patch.offset, patch.value);
+    num_failed += !expect_error (std::string ("snapshot with a ")
+                                 + patch.name, SNAPSHOT_FORMAT_ERROR, [&] ()
+    {
+      std::vector<RSUser> loaded;
+      RecommenderSnapshot::load_snapshot (corrupt_path, loaded, false);
+    });
+  }
+  std::remove (path.c_str ());
+  std::remove (corrupt_path.c_str ());
+  return num_failed;
+}
+
+int main (int argc, char **argv)
+{
+  std::string dir;
+  if (argc % 2 == 0)
+  {
+    std::cerr << USAGE << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp (argv[i], "--dir") == 0)
+    {
+      dir = argv[i + 1];
+    }
+    else
+    {
+      std::cerr << USAGE << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  try
+  {
+    if (dir.empty ())
+    {
+      dir = std::filesystem::temp_directory_path ().string ();
+    }
+    load_files (SAMPLE_MOVIES, SAMPLE_USERS);
+    int num_failed = 0;
+    for (const bad_input& input : BAD_INPUTS)
+    {
+      std::string name = input.users_path == nullptr ? input.movies_path
+                                                     : input.users_path;
+      num_failed += !expect_error (name, input.error, [&input] ()
+      {
+        load_files (input.movies_path, input.users_path);
+      });
+    }
+    num_failed += check_snapshots (dir);
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what () << std::endl;
+    return EXIT_FAILURE;
+  }
+}
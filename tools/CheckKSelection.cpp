@@ -0,0 +1,237 @@
+/**
+ * checks item cf predictions against the full sort that the selection of the
+ * k most similar movies replaced (see RecommenderSystem::get_k_most_similar):
+ * for every user, unrated movie and k, predict_movie_score must equal the
+ * weighted mean of the first k pairs of the rated movies sorted by
+ * similarity, higher first, and equally similar ones by rate, higher first.
+ * it runs on the sample files, and on a generated dataset whose movies share
+ * a handful of rows, so most similarities are tied, and whose users rate
+ * few movies, so k is often at least the number of rated movies.
+ * build from the repository root:
+ *   g++ -std=c++17 -O2 -pthread -I. *.cpp tools/CheckKSelection.cpp
+ *       -o check_k_selection
+ * usage:
+ *   check_k_selection [--dir path] [--seed n]
+ * the sample files are read from the current directory, and the generated
+ * files are written to --dir, the system's temporary directory by default,
+ * and removed once checked. exits with a failure if any prediction
+ * differs.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include "RecommenderSystemLoader.h"
+#include "RSUsersLoader.h"
+#include "SimilarityKernels.h"
+
+#define USAGE "usage: check_k_selection [--dir path] [--seed n]"
+#define SAMPLE_MOVIES "RecommenderSystemLoader_input.txt"
+#define SAMPLE_USERS "RSUsersLoader_input.txt"
+#define TIED_MOVIES "tied_movies.txt"
+#define TIED_USERS "tied_users.txt"
+#define NUM_MOVIES 60
+#define NUM_ROWS 4 // distinct feature rows shared by the movies
+#define NUM_FEATURES 4
+#define NUM_USERS 40
+#define MAX_RATED 12
+#define MAX_K 15
+#define TOLERANCE 1e-12
+
+/**
+ * writes a movies file where every movie has one of NUM_ROWS rows, and a
+ * users file where every user rates 1 to MAX_RATED movies. the numbers are
+ * taken straight from std::mt19937_64, whose output is the same in every
+ * standard library.
+ * @param dir directory of the files
+ * @param seed std::uint64_t
+ */
+static void write_tied_files (const std::string& dir, std::uint64_t seed)
+{
+  std::mt19937_64 random (seed);
+  std::ofstream movies (dir + "/" + TIED_MOVIES);
+  std::vector<std::vector<int>> rows (NUM_ROWS,
+                                      std::vector<int> (NUM_FEATURES));
+  for (auto& row : rows)
+  {
+    for (int& feature : row)
+    {
+      feature = 1 + static_cast<int>(random () % 10);
+    }
+  }
+  for (int movie = 0; movie < NUM_MOVIES; movie++)
+  {
+    movies << "Movie" << movie << "-" << 2000 + movie;
+    for (int feature : rows[random () % NUM_ROWS])
+    {
+      movies << " " << feature;
+    }
+    movies << "\n";
+  }
+  std::ofstream users (dir + "/" + TIED_USERS);
+  for (int movie = 0; movie < NUM_MOVIES; movie++)
+  {
+    users << (movie == 0 ? "" : " ") << "Movie" << movie << "-"
+          << 2000 + movie;
+  }
+  users << "\n";
+  std::vector<int> rates (NUM_MOVIES);
+  for (int user = 0; user < NUM_USERS; user++)
+  {
+    std::fill (rates.begin (), rates.end (), 0);
+    std::size_t num_rated = 1 + random () % MAX_RATED;
+    for (std::size_t i = 0; i < num_rated; i++)
+    {
+      rates[random () % NUM_MOVIES] = 1 + static_cast<int>(random () % 10);
+    }
+    users << "User" << user;
+    for (int rate : rates)
+    {
+      users << " " << (rate == 0 ? std::string ("NA") : std::to_string (rate));
+    }
+    users << "\n";
+  }
+  if (!movies || !users)
+  {
+    throw std::runtime_error ("ERROR: could not write to " + dir);
+  }
+}
+
+/**
+ * the prediction as the full sort computes it
+ * @param catalog the movies
+ * @param ratings the user's ratings
+ * @param movie id of the predicted movie
+ * @param k number of similar movies
+ * @return the weighted mean of the rates of the k most similar movies
+ */
+static double predict_by_sort (const MovieCatalog& catalog,
+                               const RatingsView& ratings, movie_id movie,
+                               int k)
+{
+  std::vector<std::pair<double, double>> pairs; // rate, similarity
+  for (const auto& elem : ratings)
+  {
+    double similarity = SimilarityKernels::inner_product
+        (catalog.get_features (movie), catalog.get_features (elem.first),
+         catalog.get_num_features ())
+        / (catalog.get_norm (movie) * catalog.get_norm (elem.first));
+    pairs.emplace_back (elem.second, similarity);
+  }
+  std::sort (pairs.begin (), pairs.end (), [] (const auto& m1,
+                                               const auto& m2)
+  {
+    return m1.second != m2.second ? m1.second > m2.second
+                                  : m1.first > m2.first;
+  });
+  double numerator = 0;
+  double denominator = 0;
+  for (std::size_t i = 0; i < std::min<std::size_t> (k, pairs.size ()); i++)
+  {
+    numerator += pairs[i].first * pairs[i].second;
+    denominator += pairs[i].second;
+  }
+  return numerator / denominator;
+}
+
+/**
+ * compares every prediction of k = 1 .. MAX_K on a pair of files
+ * @param movies_path path of the movies file
+ * @param users_path path of the users file
+ * @return number of predictions that differ
+ */
+static std::size_t check_files (const std::string& movies_path,
+                                const std::string& users_path)
+{
+  std::shared_ptr<RecommenderSystem> rs = RecommenderSystemLoader::
+      create_rs_from_movies_file (movies_path);
+  std::vector<RSUser> users = RSUsersLoader::create_users_from_file
+      (users_path, rs);
+  std::shared_ptr<const MovieCatalog> catalog = rs->get_catalog ();
+  std::size_t num_checked = 0;
+  std::size_t num_failed = 0;
+  for (const auto& user : users)
+  {
+    RatingsView ratings = user.get_ratings ();
+    for (movie_id movie = 0; movie < catalog->get_num_movies (); movie++)
+    {
+      if (ratings.find_rate (movie) != nullptr)
+      {
+        continue;
+      }
+      for (int k = 1; k <= MAX_K; k++)
+      {
+        double expected = predict_by_sort (*catalog, ratings, movie, k);
+        double actual = rs->predict_movie_score
+            (user, catalog->get_movie (movie), k, cf_mode::EXACT);
+        num_checked++;
+        if (!(std::abs (actual - expected)
+              <= TOLERANCE * std::max (1.0, std::abs (expected))))
+        {
+          num_failed++;
+          std::cerr << user.get_name () << " "
+                    << catalog->get_movie (movie)->get_name () << " k " << k
+                    << ": " << actual << " instead of " << expected
+                    << std::endl;
+        }
+      }
+    }
+  }
+  std::cout << movies_path << ": " << num_checked << " predictions, "
+            << num_failed << " differ" << std::endl;
+  return num_failed;
+}
+
+int main (int argc, char **argv)
+{
+  std::string dir;
+  std::uint64_t seed = 1;
+  if (argc % 2 == 0)
+  {
+    std::cerr << USAGE << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    const char *value = argv[i + 1];
+    if (std::strcmp (argv[i], "--dir") == 0)
+    {
+      dir = value;
+    }
+    else if (std::strcmp (argv[i], "--seed") == 0)
+    {
+      seed = std::strtoull (value, nullptr, 10);
+    }
+    else
+    {
+      std::cerr << USAGE << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  try
+  {
+    if (dir.empty ())
+    {
+      dir = std::filesystem::temp_directory_path ().string ();
+    }
+    std::size_t num_failed = check_files (SAMPLE_MOVIES, SAMPLE_USERS);
+    std::string movies_path = dir + "/" + TIED_MOVIES;
+    std::string users_path = dir + "/" + TIED_USERS;
+    write_tied_files (dir, seed);
+    num_failed += check_files (movies_path, users_path);
+    std::remove (movies_path.c_str ());
+    std::remove (users_path.c_str ());
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what () << std::endl;
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "DatasetGenerator.h"
+
+#define OPTIONS_ERROR "ERROR: invalid dataset options."
+#define WRITE_ERROR "ERROR: could not write the file."
+#define FIRST_YEAR 1950
+#define NUM_YEARS 75
+#define MAX_TRIES_PER_RATING 8 // popularity draws before falling back to
+                               // the most popular unrated movies
+
+/**
+ * splitmix64, a small generator whose output is the same everywhere
+ */
+class random_source
+{
+ private:
+  std::uint64_t _state;
+
+ public:
+  explicit random_source (std::uint64_t seed) : _state (seed) {}
+
+  std::uint64_t next ()
+  {
+    std::uint64_t x = (_state += 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  /**
+   * @return a number in [0, 1)
+   */
+  double uniform ()
+  {
+    return static_cast<double>(next () >> 11) * 0x1.0p-53;
+  }
+
+  /**
+   * @return a standard normal number, by the box-muller transform
+   */
+  double normal ()
+  {
+    double u = 1.0 - uniform ();
+    return std::sqrt (-2.0 * std::log (u))
+           * std::cos (6.283185307179586 * uniform ());
+  }
+};
+
+/**
+ * throws if the options describe no dataset
+ * @param options dataset_options
+ */
+static void check_options (const dataset_options& options)
+{
+  if (options.num_movies == 0 || options.num_features == 0
+      || !(options.density > 0 && options.density <= 1)
+      || !(options.skew >= 0))
+  {
+    throw std::runtime_error (OPTIONS_ERROR);
+  }
+}
+
+/**
+ * the features of every movie, row-major, in [1, 10] with one decimal.
+ * both files are generated from them, so they are drawn from their own
+ * stream of the seed.
+ * @param options dataset_options
+ * @return num_movies * num_features features
+ */
+static std::vector<double> make_features (const dataset_options& options)
+{
+  random_source random (options.seed);
+  std::vector<double> features (options.num_movies * options.num_features);
+  for (double& feature : features)
+  {
+    feature = 1.0 + std::floor (random.uniform () * 91.0) / 10.0;
+  }
+  return features;
+}
+
+/**
+ * throws if writing a file failed
+ * @param out the stream written
+ */
+static void check_stream (const std::ofstream& out)
+{
+  if (!out)
+  {
+    throw std::runtime_error (WRITE_ERROR);
+  }
+}
+
+/**
+ * @param id index of the movie
+ * @return the movie's name and year as the files write them
+ */
+static std::string movie_key_text (std::size_t id)
+{
+  return "Movie" + std::to_string (id) + "-"
+         + std::to_string (FIRST_YEAR + id % NUM_YEARS);
+}
+
+void DatasetGenerator::write_movies (const std::string& path,
+                                     const dataset_options& options)
+{
+  check_options (options);
+  std::vector<double> features = make_features (options);
+  std::ofstream out (path, std::ios::binary);
+  check_stream (out);
+  std::string line;
+  char cell[16];
+  for (std::size_t id = 0; id < options.num_movies; id++)
+  {
+    line = movie_key_text (id);
+    for (std::size_t f = 0; f < options.num_features; f++)
+    {
+      std::snprintf (cell, sizeof (cell), " %.1f",
+                     features[id * options.num_features + f]);
+      line += cell;
+    }
+    line += '\n';
+    out << line;
+  }
+  out.close ();
+  check_stream (out);
+}
+
+/**
+ * the movies are ranked by a shuffled popularity order and a rating picks
+ * rank r with probability proportional to 1 / (r + 1)^skew, by a binary
+ * search in the cumulative weights. a user's rate of a movie is 5.5 plus
+ * the cosine of its taste and the movie's centered features, scaled to
+ * +-4, plus noise, rounded and clamped to [1, 10].
+ */
+void DatasetGenerator::write_users (const std::string& path,
+                                    const dataset_options& options)
+{
+  check_options (options);
+  std::size_t num_movies = options.num_movies;
+  std::size_t num_features = options.num_features;
+  std::vector<double> features = make_features (options);
+  std::vector<double> norms (num_movies, 0.0);
+  for (std::size_t id = 0; id < num_movies; id++)
+  {
+    for (std::size_t f = 0; f < num_features; f++)
+    {
+      double centered = features[id * num_features + f] - 5.5;
+      features[id * num_features + f] = centered;
+      norms[id] += centered * centered;
+    }
+    norms[id] = std::sqrt (norms[id]);
+  }
+  random_source random (options.seed ^ 0x5bd1e995ULL);
+  std::vector<std::size_t> by_rank (num_movies);
+  for (std::size_t id = 0; id < num_movies; id++)
+  {
+    by_rank[id] = id;
+  }
+  for (std::size_t i = num_movies; i > 1; i--) // fisher-yates
+  {
+    std::swap (by_rank[i - 1], by_rank[random.next () % i]);
+  }
+  std::vector<double> cumulative (num_movies);
+  double total = 0;
+  for (std::size_t rank = 0; rank < num_movies; rank++)
+  {
+    total += std::pow (static_cast<double>(rank + 1), -options.skew);
+    cumulative[rank] = total;
+  }
+
+  std::ofstream out (path, std::ios::binary);
+  check_stream (out);
+  std::string line;
+  for (std::size_t id = 0; id < num_movies; id++)
+  {
+    line += (id == 0 ? "" : " ") + movie_key_text (id);
+  }
+  line += '\n';
+  out << line;
+  std::vector<double> taste (num_features);
+  std::vector<int> rates (num_movies, 0); // 0 for NA
+  std::vector<std::size_t> rated;
+  for (std::size_t user = 0; user < options.num_users; user++)
+  {
+    for (double& weight : taste)
+    {
+      weight = random.normal ();
+    }
+    double taste_norm = std::sqrt (std::inner_product
+        (taste.begin (), taste.end (), taste.begin (), 0.0));
+    auto count = static_cast<std::size_t>(options.density * num_movies
+                                          * (0.5 + random.uniform ()));
+    count = std::min (std::max<std::size_t> (count, 1), num_movies);
+    rated.clear ();
+    auto rate = [&] (std::size_t id)
+    {
+      double dot = 0;
+      for (std::size_t f = 0; f < num_features; f++)
+      {
+        dot += taste[f] * features[id * num_features + f];
+      }
+      double cosine = norms[id] > 0 ? dot / (taste_norm * norms[id]) : 0.0;
+      double value = std::round (5.5 + 4.0 * cosine + random.normal ());
+      rates[id] = static_cast<int>(std::min (10.0, std::max (1.0, value)));
+      rated.push_back (id);
+    };
+    for (std::size_t tries = 0; rated.size () < count
+         && tries < count * MAX_TRIES_PER_RATING; tries++)
+    {
+      double pick = random.uniform () * total;
+      auto rank = static_cast<std::size_t>(std::upper_bound
+          (cumulative.begin (), cumulative.end (), pick)
+                                           - cumulative.begin ());
+      std::size_t id = by_rank[std::min (rank, num_movies - 1)];
+      if (rates[id] == 0)
+      {
+        rate (id);
+      }
+    }
+    for (std::size_t rank = 0; rated.size () < count; rank++)
+    {
+      if (rates[by_rank[rank]] == 0)
+      {
+        rate (by_rank[rank]);
+      }
+    }
+    line = "User" + std::to_string (user);
+    for (std::size_t id = 0; id < num_movies; id++)
+    {
+      line += ' ';
+      line += rates[id] == 0 ? "NA" : std::to_string (rates[id]);
+    }
+    line += '\n';
+    out << line;
+    for (std::size_t id : rated)
+    {
+      rates[id] = 0;
+    }
+  }
+  out.close ();
+  check_stream (out);
+}
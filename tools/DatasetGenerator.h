@@ -0,0 +1,55 @@
+#ifndef DATASETGENERATOR_H
+#define DATASETGENERATOR_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * the shape of a generated dataset
+ */
+struct dataset_options
+{
+  std::size_t num_movies = 1000;
+  std::size_t num_features = 8;
+  std::size_t num_users = 1000;
+  double density = 0.05; // mean share of the movies a user rates, in (0, 1]
+  double skew = 1.0; // zipf exponent of the movies' popularity, 0 for none
+  std::uint64_t seed = 1;
+};
+
+/**
+ * writes synthetic movies and users files in the formats of
+ * RecommenderSystemLoader and RSUsersLoader, for benchmarks at any scale.
+ * movies are "Movie<i>-<year>" with features in [1, 10]. every user rates
+ * about density * num_movies movies, picked by a zipf popularity over a
+ * shuffled order of the movies, so a few movies get most of the ratings
+ * like in real data. a user's rates follow a hidden taste vector, so they
+ * correlate with the features and with other users.
+ * the output only depends on the options: the random numbers come from a
+ * generator of our own, not from the standard distributions, whose output
+ * differs between standard libraries.
+ */
+class DatasetGenerator
+{
+ public:
+  DatasetGenerator () = delete;
+
+  /**
+   * writes the movies file
+   * @param path path of the file
+   * @param options dataset_options
+   */
+  static void write_movies (const std::string& path,
+                            const dataset_options& options) noexcept (false);
+
+  /**
+   * writes the users file, for the movies write_movies writes with the same
+   * options
+   * @param path path of the file
+   * @param options dataset_options
+   */
+  static void write_users (const std::string& path,
+                           const dataset_options& options) noexcept (false);
+};
+
+#endif //DATASETGENERATOR_H
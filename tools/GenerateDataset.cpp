@@ -0,0 +1,72 @@
+/**
+ * writes a synthetic movies file and users file, see DatasetGenerator.
+ * build from the repository root:
+ *   g++ -std=c++17 -O2 -Itools tools/DatasetGenerator.cpp
+ *       tools/GenerateDataset.cpp -o generate_dataset
+ * usage:
+ *   generate_dataset <movies file> <users file> [--movies n] [--features n]
+ *                    [--users n] [--density d] [--skew s] [--seed n]
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "DatasetGenerator.h"
+
+#define USAGE "usage: generate_dataset <movies file> <users file> " \
+              "[--movies n] [--features n] [--users n] [--density d] " \
+              "[--skew s] [--seed n]"
+
+int main (int argc, char **argv)
+{
+  if (argc < 3 || argc % 2 == 0)
+  {
+    std::cerr << USAGE << std::endl;
+    return EXIT_FAILURE;
+  }
+  dataset_options options;
+  for (int i = 3; i + 1 < argc; i += 2)
+  {
+    const char *value = argv[i + 1];
+    if (std::strcmp (argv[i], "--movies") == 0)
+    {
+      options.num_movies = std::strtoull (value, nullptr, 10);
+    }
+    else if (std::strcmp (argv[i], "--features") == 0)
+    {
+      options.num_features = std::strtoull (value, nullptr, 10);
+    }
+    else if (std::strcmp (argv[i], "--users") == 0)
+    {
+      options.num_users = std::strtoull (value, nullptr, 10);
+    }
+    else if (std::strcmp (argv[i], "--density") == 0)
+    {
+      options.density = std::strtod (value, nullptr);
+    }
+    else if (std::strcmp (argv[i], "--skew") == 0)
+    {
+      options.skew = std::strtod (value, nullptr);
+    }
+    else if (std::strcmp (argv[i], "--seed") == 0)
+    {
+      options.seed = std::strtoull (value, nullptr, 10);
+    }
+    else
+    {
+      std::cerr << USAGE << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  try
+  {
+    DatasetGenerator::write_movies (argv[1], options);
+    DatasetGenerator::write_users (argv[2], options);
+  }
+  catch (const std::runtime_error& e)
+  {
+    std::cerr << e.what () << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
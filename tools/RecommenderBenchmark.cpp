@@ -0,0 +1,297 @@
+/**
+ * benchmarks loading and recommending on generated datasets (see
+ * DatasetGenerator) at several scales, and writes the results as json in
+ * the layout of google benchmark's --benchmark_format=json, so its compare
+ * tools can track regressions between two runs.
+ * build from the repository root:
+ *   g++ -std=c++17 -O2 -pthread -I. -Itools *.cpp tools/DatasetGenerator.cpp
+ *       tools/RecommenderBenchmark.cpp -o recommender_benchmark
+ * usage:
+ *   recommender_benchmark [--scales MOVIESxFEATURESxUSERS,...]
+ *                         [--density d] [--skew s] [--seed n] [--k n]
+ *                         [--min-time seconds] [--threads n] [--dir path]
+ *                         [--json path]
+ * the json goes to stdout unless --json is given; a table goes to stderr.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "DatasetGenerator.h"
+#include "RecommenderSystemLoader.h"
+#include "RSUsersLoader.h"
+#include "SimilarityKernels.h"
+#include "ParallelFor.h"
+
+#define USAGE "usage: recommender_benchmark " \
+              "[--scales MOVIESxFEATURESxUSERS,...] [--density d] " \
+              "[--skew s] [--seed n] [--k n] [--min-time seconds] " \
+              "[--threads n] [--dir path] [--json path]"
+#define DEFAULT_SCALES "1000x8x500,5000x16x2000"
+#define NUM_PREDICTIONS 1024 // distinct (user, movie) pairs predicted
+
+/**
+ * one measured case
+ */
+struct benchmark_result
+{
+  std::string name;
+  std::size_t iterations;
+  double seconds; // for all the iterations
+  double items; // processed by all the iterations, e.g. users
+};
+
+/**
+ * calls func(iteration) until min_seconds passed, at least once
+ * @param name the case's name
+ * @param min_seconds double
+ * @param items_per_iteration items one call processes
+ * @param func callable as func(std::size_t iteration)
+ * @return the measurement
+ */
+template <typename Func>
+static benchmark_result measure (const std::string& name, double min_seconds,
+                                 std::size_t items_per_iteration, Func func)
+{
+  auto start = std::chrono::steady_clock::now ();
+  std::size_t iterations = 0;
+  double seconds = 0;
+  do
+  {
+    func (iterations++);
+    seconds = std::chrono::duration<double> (std::chrono::steady_clock::now ()
+                                             - start).count ();
+  }
+  while (seconds < min_seconds);
+  benchmark_result result{name, iterations, seconds,
+                          static_cast<double>(iterations
+                                              * items_per_iteration)};
+  std::fprintf (stderr, "%-60s %10zu %14.0f ns %14.1f items/s\n",
+                name.c_str (), iterations, seconds * 1e9 / iterations,
+                result.items / seconds);
+  return result;
+}
+
+/**
+ * @param results the measured cases
+ * @param threads threads of the batch cases
+ * @return the results as google benchmark json
+ */
+static std::string to_json (const std::vector<benchmark_result>& results,
+                            unsigned threads)
+{
+  std::ostringstream out;
+  out.precision (10);
+  char date[64];
+  std::time_t now = std::time (nullptr);
+  std::strftime (date, sizeof (date), "%Y-%m-%dT%H:%M:%S",
+                 std::localtime (&now));
+  out << "{\n  \"context\": {\n"
+      << "    \"date\": \"" << date << "\",\n"
+      << "    \"num_cpus\": " << std::thread::hardware_concurrency ()
+      << ",\n"
+      << "    \"batch_threads\": " << threads << ",\n"
+      << "    \"kernels\": \"" << SimilarityKernels::get_isa () << "\",\n"
+      << "    \"library_build_type\": \"release\"\n  },\n"
+      << "  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size (); i++)
+  {
+    const benchmark_result& result = results[i];
+    double ns = result.seconds * 1e9 / result.iterations;
+    out << (i == 0 ? "\n" : ",\n") << "    {\n"
+        << "      \"name\": \"" << result.name << "\",\n"
+        << "      \"run_name\": \"" << result.name << "\",\n"
+        << "      \"run_type\": \"iteration\",\n"
+        << "      \"iterations\": " << result.iterations << ",\n"
+        << "      \"real_time\": " << ns << ",\n"
+        << "      \"cpu_time\": " << ns << ",\n" // wall time: the batch
+                                                // cases use many threads
+        << "      \"time_unit\": \"ns\",\n"
+        << "      \"items_per_second\": " << result.items / result.seconds
+        << "\n    }";
+  }
+  out << "\n  ]\n}\n";
+  return out.str ();
+}
+
+/**
+ * generates one scale's files and measures every case on them
+ * @param options the dataset of the scale
+ * @param dir directory of the generated files
+ * @param k number of similar movies of the cf cases
+ * @param min_seconds minimum time of each case
+ * @param threads threads of the batch cases, 0 for one per hardware thread
+ * @param results the measurements are appended to it
+ */
+static void run_scale (const dataset_options& options, const std::string& dir,
+                       int k, double min_seconds, unsigned threads,
+                       std::vector<benchmark_result>& results)
+{
+  std::string scale = "/movies:" + std::to_string (options.num_movies)
+                      + "/features:" + std::to_string (options.num_features)
+                      + "/users:" + std::to_string (options.num_users);
+  std::string movies_path = dir + "/bench_movies.txt";
+  std::string users_path = dir + "/bench_users.txt";
+  DatasetGenerator::write_movies (movies_path, options);
+  DatasetGenerator::write_users (users_path, options);
+
+  std::shared_ptr<RecommenderSystem> rs;
+  results.push_back (measure ("load_movies" + scale, min_seconds,
+                              options.num_movies, [&] (std::size_t)
+  {
+    rs = RecommenderSystemLoader::create_rs_from_movies_file (movies_path);
+  }));
+  std::vector<RSUser> users;
+  results.push_back (measure ("load_users" + scale, min_seconds,
+                              options.num_users, [&] (std::size_t)
+  {
+    users = RSUsersLoader::create_users_from_file (users_path, rs, threads);
+  }));
+  rs->set_cache_budget (0); // measure the computation, not the cache
+
+  std::size_t found = 0; // keeps the results alive
+  results.push_back (measure ("recommend_by_content" + scale, min_seconds, 1,
+                              [&] (std::size_t i)
+  {
+    found += users[i % users.size ()].get_recommendation_by_content ()
+             != nullptr;
+  }));
+  std::vector<std::pair<std::size_t, sp_movie>> predictions;
+  for (std::size_t i = 0; i < NUM_PREDICTIONS; i++)
+  {
+    std::size_t user = i % users.size ();
+    auto id = static_cast<movie_id>((i * 2654435761u) % options.num_movies);
+    predictions.emplace_back (user, rs->get_movie (id));
+  }
+  double sum = 0;
+  results.push_back (measure ("predict_movie_score" + scale, min_seconds, 1,
+                              [&] (std::size_t i)
+  {
+    const auto& prediction = predictions[i % predictions.size ()];
+    sum += rs->predict_movie_score (users[prediction.first],
+                                    prediction.second, k);
+  }));
+  results.push_back (measure ("recommend_by_cf" + scale, min_seconds, 1,
+                              [&] (std::size_t i)
+  {
+    found += users[i % users.size ()].get_recommendation_by_cf (k)
+             != nullptr;
+  }));
+  results.push_back (measure ("recommend_batch_content" + scale, min_seconds,
+                              users.size (), [&] (std::size_t)
+  {
+    found += rs->recommend_batch (users, recommend_mode::CONTENT, 0,
+                                  threads).size ();
+  }));
+  results.push_back (measure ("recommend_batch_cf" + scale, min_seconds,
+                              users.size (), [&] (std::size_t)
+  {
+    found += rs->recommend_batch (users, recommend_mode::CF, k,
+                                  threads).size ();
+  }));
+  if (found == 0 && sum == 0)
+  {
+    std::fprintf (stderr, "no recommendations\n");
+  }
+  std::remove (movies_path.c_str ());
+  std::remove (users_path.c_str ());
+}
+
+int main (int argc, char **argv)
+{
+  dataset_options base;
+  std::string scales = DEFAULT_SCALES;
+  std::string dir = ".";
+  std::string json_path;
+  double min_seconds = 0.5;
+  unsigned threads = 0;
+  int k = 10;
+  if (argc % 2 == 0)
+  {
+    std::cerr << USAGE << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    const char *value = argv[i + 1];
+    if (std::strcmp (argv[i], "--scales") == 0)
+    {
+      scales = value;
+    }
+    else if (std::strcmp (argv[i], "--density") == 0)
+    {
+      base.density = std::strtod (value, nullptr);
+    }
+    else if (std::strcmp (argv[i], "--skew") == 0)
+    {
+      base.skew = std::strtod (value, nullptr);
+    }
+    else if (std::strcmp (argv[i], "--seed") == 0)
+    {
+      base.seed = std::strtoull (value, nullptr, 10);
+    }
+    else if (std::strcmp (argv[i], "--k") == 0)
+    {
+      k = std::atoi (value);
+    }
+    else if (std::strcmp (argv[i], "--min-time") == 0)
+    {
+      min_seconds = std::strtod (value, nullptr);
+    }
+    else if (std::strcmp (argv[i], "--threads") == 0)
+    {
+      threads = static_cast<unsigned>(std::strtoul (value, nullptr, 10));
+    }
+    else if (std::strcmp (argv[i], "--dir") == 0)
+    {
+      dir = value;
+    }
+    else if (std::strcmp (argv[i], "--json") == 0)
+    {
+      json_path = value;
+    }
+    else
+    {
+      std::cerr << USAGE << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::vector<benchmark_result> results;
+  try
+  {
+    std::istringstream list (scales);
+    std::string scale;
+    while (std::getline (list, scale, ','))
+    {
+      dataset_options options = base;
+      if (std::sscanf (scale.c_str (), "%zux%zux%zu", &options.num_movies,
+                       &options.num_features, &options.num_users) != 3)
+      {
+        std::cerr << USAGE << std::endl;
+        return EXIT_FAILURE;
+      }
+      run_scale (options, dir, k, min_seconds, threads, results);
+    }
+  }
+  catch (const std::runtime_error& e)
+  {
+    std::cerr << e.what () << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string json = to_json (results, resolve_num_threads (threads));
+  if (json_path.empty ())
+  {
+    std::cout << json;
+  }
+  else
+  {
+    std::ofstream (json_path) << json;
+  }
+  return EXIT_SUCCESS;
+}
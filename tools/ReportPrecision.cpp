@@ -0,0 +1,83 @@
+/**
+ * reports how far content recommendations at each reduced feature precision
+ * are from the ones over the double rows (see
+ * RecommenderSystem::report_precision): the largest score error of a
+ * recommended movie, the largest rank shift between the two top n lists,
+ * and how many users got another best movie.
+ * build from the repository root:
+ *   g++ -std=c++17 -O2 -pthread -I. *.cpp tools/ReportPrecision.cpp
+ *       -o report_precision
+ * usage:
+ *   report_precision <movies file> <users file> [--n n] [--max-shift n]
+ * exits with a failure if --max-shift is given and a rank shift exceeds it.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include "RecommenderSystemLoader.h"
+#include "RSUsersLoader.h"
+
+#define USAGE "usage: report_precision <movies file> <users file> [--n n] " \
+              "[--max-shift n]"
+#define DEFAULT_N 10
+
+int main (int argc, char **argv)
+{
+  if (argc < 3 || argc % 2 == 0)
+  {
+    std::cerr << USAGE << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::size_t n = DEFAULT_N;
+  std::size_t max_shift = std::numeric_limits<std::size_t>::max ();
+  for (int i = 3; i + 1 < argc; i += 2)
+  {
+    const char *value = argv[i + 1];
+    if (std::strcmp (argv[i], "--n") == 0)
+    {
+      n = std::strtoull (value, nullptr, 10);
+    }
+    else if (std::strcmp (argv[i], "--max-shift") == 0)
+    {
+      max_shift = std::strtoull (value, nullptr, 10);
+    }
+    else
+    {
+      std::cerr << USAGE << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  try
+  {
+    std::shared_ptr<RecommenderSystem> rs = RecommenderSystemLoader::
+        create_rs_from_movies_file (argv[1]);
+    std::vector<RSUser> users = RSUsersLoader::create_users_from_file
+        (argv[2], rs);
+    const struct
+    {
+      const char *name;
+      feature_precision precision;
+    } precisions[] = {{"float", feature_precision::FLOAT},
+                      {"uint8", feature_precision::UINT8}};
+    bool failed = false;
+    std::cout << "precision users max_score_error max_rank_shift "
+                 "changed_top_1" << std::endl;
+    for (const auto& cur : precisions)
+    {
+      rs->set_feature_precision (cur.precision);
+      precision_report report = rs->report_precision (users, n);
+      std::cout << cur.name << " " << report.num_users << " "
+                << report.max_score_error << " " << report.max_rank_shift
+                << " " << report.changed_top_1 << std::endl;
+      failed = failed || report.max_rank_shift > max_shift;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what () << std::endl;
+    return EXIT_FAILURE;
+  }
+}